@@ -0,0 +1,66 @@
+#!/bin/bash
+
+RED='\033[0;31m'
+NC='\033[0m'
+
+COMPILER="${1:-./compiler}"
+
+run_bench() {
+    local bench_file="$1"
+    local base_name=$(basename "$bench_file" .sl)
+
+    "$COMPILER" "$bench_file" "output/bench_${base_name}.o" > /dev/null
+    if [ $? -ne 0 ]; then
+        echo -e "${RED}Failed to compile ${base_name}${NC}"
+        return 1
+    fi
+
+    gcc "output/bench_${base_name}.o" -o "output/bench_${base_name}"
+    if [ $? -ne 0 ]; then
+        echo -e "${RED}Failed to build ${base_name}${NC}"
+        return 1
+    fi
+
+    local best=""
+    for run in 1 2 3 4 5; do
+        local start=$(date +%s%N)
+        "./output/bench_${base_name}"
+        local end=$(date +%s%N)
+        local elapsed=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+    done
+
+    printf "%-20s %10d us\n" "$base_name" "$best"
+    return 0
+}
+
+# Assembly text throughput of the code generator's writer, on a generated
+# program far larger than the benchmarks.
+emit_bench() {
+    local statements="$1"
+    local source="output/bench_emit.sl"
+
+    awk -v n="$statements" 'BEGIN {
+        print "i = 0; s = 1;"
+        for (k = 0; k < n; k++)
+            printf "a%d = s * %d + i / 3 - (s << 2); if (a%d > s) { s = a%d - s; }\n", k % 50, k, k % 50, k % 50
+    }' > "$source"
+
+    local stats
+    stats=$("$COMPILER" -O0 --emit-stats "$source" "output/bench_emit.asm" 2>&1 > /dev/null)
+    if [ $? -ne 0 ]; then
+        echo -e "${RED}Failed to compile the emitter benchmark${NC}"
+        return 1
+    fi
+    printf "%-20s %s\n" "emit" "$stats"
+}
+
+mkdir -p output
+
+for bench_file in benchmarks/*.sl; do
+    run_bench "$bench_file"
+done
+
+emit_bench 20000
@@ -0,0 +1,55 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <stddef.h>
+#include "instruction.h"
+
+// Encodes the x86-64 instructions codegen writes, in the same Intel syntax,
+// straight to machine code. Labels are the CFG's block labels. Jumps to them
+// are laid out by assembler_resolve, which relaxes each to rel8 when its
+// target is in reach and rel32 otherwise.
+
+typedef struct
+{
+    long offset;         // in the code emitted so far, -1 until placed
+    size_t jumps_before; // jumps recorded before the label
+} AssemblerLabel;
+
+// Jumps are kept out of `code` until their size is known.
+typedef struct
+{
+    size_t offset;  // where it goes in `code`
+    int condition;  // jcc's condition code, -1 for jmp
+    int label;
+    int near;       // needs rel32
+} AssemblerJump;
+
+typedef struct
+{
+    unsigned char *code;
+    size_t size;
+    size_t capacity;
+
+    AssemblerLabel *labels; // by label number
+    int label_capacity;
+
+    AssemblerJump *jumps;
+    size_t jump_count;
+    size_t jump_capacity;
+} Assembler;
+
+void assembler_init(Assembler *assembler);
+void assembler_free(Assembler *assembler);
+
+// Return 0 for an instruction outside the supported subset, given as text
+// or already decoded.
+int assembler_instruction(Assembler *assembler, const char *text);
+int assembler_encode(Assembler *assembler, const MachineInstruction *instruction);
+void assembler_label(Assembler *assembler, int label);
+int assembler_jump(Assembler *assembler, const char *mnemonic, int label);
+
+// Sizes and inserts every jump, leaving the final code in `code`; returns 0
+// if one targets a label never placed.
+int assembler_resolve(Assembler *assembler);
+
+#endif
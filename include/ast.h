@@ -17,6 +17,8 @@ typedef enum
     NODE_ERROR
 } ASTNodeType;
 
+struct DefUse;
+
 typedef struct ASTNode
 {
     ASTNodeType type;
@@ -61,10 +63,12 @@ typedef struct ASTNode
 
         struct
         {
-            int value;
+            long long value;
         } integer;
     } data;
 
+    struct DefUse *def_use;
+
     int line;
     int column;
 } ASTNode;
@@ -72,7 +76,7 @@ typedef struct ASTNode
 ASTNode *ast_create_node(ASTNodeType type);
 void ast_destroy_node(ASTNode *node);
 
-ASTNode *ast_create_integer(int value);
+ASTNode *ast_create_integer(long long value);
 ASTNode *ast_create_identifier(const char *name);
 ASTNode *ast_create_binary_op(TokenType operator, ASTNode * left, ASTNode *right);
 ASTNode *ast_create_assignment(const char *name, ASTNode *value);
@@ -81,6 +85,15 @@ ASTNode *ast_create_while(ASTNode *condition, ASTNode *body);
 ASTNode *ast_create_block(void);
 void ast_add_statement(ASTNode *block, ASTNode *statement);
 
+ASTNode *ast_clone(ASTNode *node);
+int ast_equal(ASTNode *a, ASTNode *b);
+int ast_size(ASTNode *node);
+
+// Calls `visit` with every variable name in program order, an assignment's
+// target before its value; names repeat as often as they occur.
+typedef void (*VariableVisitor)(const char *name, void *context);
+void ast_visit_variables(ASTNode *node, VariableVisitor visit, void *context);
+
 void ast_print(ASTNode *node, int indent);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stddef.h>
+#include "ast.h"
+#include "symbol_table.h"
+
+// Relations in the order the compare-and-branch opcodes use. Flipping the
+// low bit negates one; see bytecode_mirror for swapping operands.
+typedef enum
+{
+    RELATION_LESS,
+    RELATION_GREATER_EQUAL,
+    RELATION_GREATER,
+    RELATION_LESS_EQUAL,
+    RELATION_EQUAL,
+    RELATION_NOT_EQUAL,
+    RELATION_COUNT
+} Relation;
+
+// Register machine: registers below variable_count hold the variables, by
+// symbol id, and the rest hold temporaries. Jump targets are instruction
+// indices, `immediate` operands are the signed 32-bit field itself.
+typedef enum
+{
+    OP_MOVE,          // a = b
+    OP_LOAD,          // a = immediate b
+    OP_LOAD_CONSTANT, // a = constants[b]
+    OP_ADD,           // a = b + c
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SHL,
+    OP_ADD_IMMEDIATE, // a = b + immediate c, covers x = x + k
+    OP_LESS,          // a = b < c, as 0 or 1
+    OP_GREATER,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_JUMP,              // goto a
+    OP_JUMP_IF_ZERO,      // if b == 0 goto a
+    OP_JUMP_IF_NOT_ZERO,  // if b != 0 goto a
+    OP_BRANCH,            // if b relation c goto a, one opcode per Relation
+    OP_BRANCH_IMMEDIATE = OP_BRANCH + RELATION_COUNT, // if b relation immediate c goto a
+    OP_HALT = OP_BRANCH_IMMEDIATE + RELATION_COUNT,
+    OP_COUNT
+} Opcode;
+
+typedef struct
+{
+    int opcode;
+    int a;
+    int b;
+    int c;
+} Instruction;
+
+typedef struct
+{
+    Instruction *code;
+    size_t code_count;
+    size_t code_capacity;
+
+    long long *constants; // values that do not fit an immediate
+    size_t constant_count;
+    size_t constant_capacity;
+
+    int variable_count;
+    int register_count;
+} Bytecode;
+
+Bytecode *bytecode_compile(ASTNode *program, SymbolTable *symbol_table);
+void bytecode_destroy(Bytecode *bytecode);
+
+Relation bytecode_mirror(Relation relation);
+
+#endif
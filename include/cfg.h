@@ -0,0 +1,65 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdio.h>
+#include "dataflow.h"
+#include "instruction.h"
+#include "assembler.h"
+#include "emitter.h"
+
+typedef enum
+{
+    EXIT_JUMP,
+    EXIT_BRANCH,
+    EXIT_RETURN
+} BlockExit;
+
+typedef struct BasicBlock
+{
+    int label;
+    MachineInstruction *instructions;
+    size_t instruction_count;
+    size_t instruction_capacity;
+
+    BlockExit exit;
+    struct BasicBlock *successor;     // the jump target, or where a branch goes when the test holds
+    struct BasicBlock *branch_target; // where a branch goes when it fails
+    ASTNode *condition;               // the expression a branch tests
+    size_t condition_start;           // first instruction evaluating it
+    TokenType relation;               // the test: `compare` operands related by it
+    MachineInstruction compare;       // the cmp or test ending a branch, cmp rax, 0 unless set
+
+    BitSet defs; // symbol ids the block assigns
+    int predecessor_count;
+    struct BasicBlock *predecessor; // the only one, when there is exactly one
+    int labeled;
+} BasicBlock;
+
+// Blocks in layout order; the first is the entry and falling off the last
+// returns from main.
+typedef struct
+{
+    BasicBlock **blocks;
+    size_t block_count;
+    size_t block_capacity;
+} ControlFlowGraph;
+
+ControlFlowGraph *cfg_create(void);
+void cfg_destroy(ControlFlowGraph *cfg);
+
+BasicBlock *cfg_new_block(int label);
+void cfg_place(ControlFlowGraph *cfg, BasicBlock *block);
+
+// Instructions are given as codegen's text and stored decoded.
+void cfg_append(BasicBlock *block, const char *format, ...);
+void cfg_insert(BasicBlock *block, size_t index, const char *format, ...);
+void cfg_jump(BasicBlock *block, BasicBlock *target);
+void cfg_branch(BasicBlock *block, ASTNode *condition, size_t condition_start, BasicBlock *if_true,
+                BasicBlock *if_false);
+void cfg_compare(BasicBlock *block, TokenType relation, const char *format, ...);
+
+void cfg_simplify(ControlFlowGraph *cfg, SymbolTable *symbol_table);
+void cfg_emit(ControlFlowGraph *cfg, Emitter *emitter);
+int cfg_assemble(ControlFlowGraph *cfg, Assembler *assembler);
+
+#endif
@@ -3,11 +3,15 @@
 
 #include "ast.h"
 #include "symbol_table.h"
+#include "cfg.h"
+#include "register_allocator.h"
+#include "peephole.h"
 
 typedef enum
 {
     ASM_NASM,
-    ASM_GAS
+    ASM_GAS,
+    ASM_OBJECT // an ELF64 object, encoded without an external assembler
 } AssemblerType;
 
 typedef struct
@@ -15,6 +19,8 @@ typedef struct
     AssemblerType assembler;
     int optimize_registers;
     int generate_comments;
+    int simplify_cfg;
+    int peephole;
 } CodeGenOptions;
 
 typedef struct
@@ -24,8 +30,18 @@ typedef struct
     CodeGenOptions options;
     int label_counter;
     int stack_offset;
+    int slot_hole; // a free 4-byte slot left beside another one, 0 if none
     char **used_registers;
     int register_count;
+    int *spill_slots; // frame slots for intermediate values once registers run out, by depth
+    int spill_slot_count;
+    int spill_depth;
+    ControlFlowGraph *cfg;
+    BasicBlock *current; // the block instructions are appended to
+    RegisterAllocationStats allocation;
+    PeepholeStats peephole;
+    size_t emitted_bytes; // assembly text written by codegen_generate
+    double emit_seconds;  // building and writing it
 } CodeGenerator;
 
 CodeGenerator *codegen_create(FILE *output_file, SymbolTable *symbol_table);
@@ -33,9 +49,10 @@ void codegen_destroy(CodeGenerator *generator);
 
 void codegen_set_options(CodeGenerator *generator, CodeGenOptions options);
 int codegen_generate(CodeGenerator *generator, ASTNode *ast);
+void codegen_lower(CodeGenerator *generator, ASTNode *ast);
 
-void codegen_emit_prologue(CodeGenerator *generator);
-void codegen_emit_epilogue(CodeGenerator *generator);
+void codegen_emit_prologue(CodeGenerator *generator, Emitter *emitter);
+void codegen_emit_epilogue(CodeGenerator *generator, Emitter *emitter);
 
 void codegen_emit_expression(CodeGenerator *generator, ASTNode *node);
 void codegen_emit_statement(CodeGenerator *generator, ASTNode *node);
@@ -49,7 +66,8 @@ void codegen_emit_assignment(CodeGenerator *generator, ASTNode *node);
 void codegen_emit_if(CodeGenerator *generator, ASTNode *node);
 void codegen_emit_while(CodeGenerator *generator, ASTNode *node);
 
-char *codegen_new_label(CodeGenerator *generator);
+BasicBlock *codegen_new_block(CodeGenerator *generator);
 int codegen_get_variable_offset(CodeGenerator *generator, const char *name);
+int codegen_is_dword(const Symbol *symbol);
 
 #endif
\ No newline at end of file
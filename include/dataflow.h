@@ -0,0 +1,50 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <stdint.h>
+#include "ast.h"
+#include "symbol_table.h"
+
+#define BITSET_WORD_BITS 64
+
+typedef struct
+{
+    uint64_t *words;
+    size_t word_count;
+} BitSet;
+
+void bitset_init(BitSet *set, size_t bit_count);
+void bitset_free(BitSet *set);
+void bitset_clear(BitSet *set);
+void bitset_copy(BitSet *dst, const BitSet *src);
+
+void bitset_set(BitSet *set, size_t bit);
+void bitset_reset(BitSet *set, size_t bit);
+int bitset_test(const BitSet *set, size_t bit);
+
+void bitset_union_with(BitSet *dst, const BitSet *src);
+void bitset_intersect_with(BitSet *dst, const BitSet *src);
+void bitset_subtract(BitSet *dst, const BitSet *src);
+
+int bitset_intersects(const BitSet *a, const BitSet *b);
+int bitset_is_empty(const BitSet *set);
+int bitset_equals(const BitSet *a, const BitSet *b);
+int bitset_count(const BitSet *set);
+
+// Summary of the variables a subtree may assign (defs) and may read (uses),
+// indexed by symbol id. Cached on statement nodes and rebuilt on demand.
+typedef struct DefUse
+{
+    BitSet defs;
+    BitSet uses;
+} DefUse;
+
+const DefUse *dataflow_def_use(SymbolTable *table, ASTNode *node);
+void dataflow_collect_uses(SymbolTable *table, ASTNode *expression, BitSet *uses);
+void dataflow_invalidate(ASTNode *node);
+
+void dataflow_live_after(SymbolTable *table, ASTNode *root, ASTNode *target,
+                         const BitSet *exit_live, BitSet *live);
+void def_use_destroy(DefUse *summary);
+
+#endif
\ No newline at end of file
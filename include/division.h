@@ -0,0 +1,29 @@
+#ifndef DIVISION_H
+#define DIVISION_H
+
+typedef enum
+{
+    DIVISION_IDIV,     // 0 and -1 keep idiv, which faults where they must
+    DIVISION_IDENTITY, // x / 1
+    DIVISION_SHIFT,    // +-2^k: bias negative dividends, then sar
+    DIVISION_MULTIPLY  // high half of x * multiplier, then sar and round
+} DivisionKind;
+
+// How signed 64-bit division by a constant is lowered. The sequences follow
+// Hacker's Delight, chapter 10.
+typedef struct
+{
+    DivisionKind kind;
+    long long divisor;
+    long long multiplier;
+    int shift;
+    int add_dividend; // 1 adds x to the high half, -1 subtracts it
+    int negate;
+} DivisionPlan;
+
+DivisionPlan division_plan(long long divisor);
+
+// Evaluates the plan step by step, exactly as the emitted code does.
+long long division_apply(const DivisionPlan *plan, long long dividend);
+
+#endif
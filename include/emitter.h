@@ -0,0 +1,46 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "instruction.h"
+
+// Builds assembly text in one growable buffer and hands it to the output
+// file in a single write. An instruction is a mnemonic followed by operands,
+// each appended by its own routine without going through printf; labels are
+// the CFG's integer block labels, printed as .L<n>.
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    int operand_count; // operands appended since the last mnemonic
+} Emitter;
+
+void emitter_init(Emitter *emitter);
+void emitter_free(Emitter *emitter);
+
+void emitter_text(Emitter *emitter, const char *text);
+void emitter_integer(Emitter *emitter, long long value);
+
+// A whole preformatted instruction on its own line.
+void emitter_instruction(Emitter *emitter, const char *text);
+// A decoded one, written as instruction_format would.
+void emitter_machine_instruction(Emitter *emitter, const MachineInstruction *instruction);
+
+// Starts an instruction; operands follow, separated as they are appended,
+// and emitter_end_line finishes it.
+void emitter_mnemonic(Emitter *emitter, const char *mnemonic);
+void emitter_register(Emitter *emitter, const char *name);
+void emitter_immediate(Emitter *emitter, long long value);
+void emitter_label(Emitter *emitter, int label);
+void emitter_end_line(Emitter *emitter);
+
+void emitter_define_label(Emitter *emitter, int label);
+
+// Writes everything buffered to `output` and empties the buffer; returns 0
+// on a write error.
+int emitter_flush(Emitter *emitter, FILE *output);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <stddef.h>
+
+// Codegen writes instructions as Intel-syntax text, which the CFG stores
+// decoded: a mnemonic and up to three operands, each a register, an
+// immediate, or [base+displacement] with an optional BYTE/DWORD/QWORD size,
+// which is all codegen produces. The register allocator and the peephole
+// pass rewrite this form, and the emitter and assembler consume it.
+
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_REGISTER,
+    OPERAND_IMMEDIATE,
+    OPERAND_MEMORY
+} OperandKind;
+
+typedef struct
+{
+    OperandKind kind;
+    int reg;         // register number, or the base of a memory operand
+    int size;        // in bytes, 0 for memory of unstated size and for immediates
+    long long value; // immediate, or displacement
+} Operand;
+
+#define INSTRUCTION_MAX_OPERANDS 3
+
+typedef struct
+{
+    char mnemonic[16];
+    Operand operands[INSTRUCTION_MAX_OPERANDS];
+    int operand_count;
+} MachineInstruction;
+
+// Returns 0 for text outside this syntax.
+int instruction_parse(const char *text, MachineInstruction *instruction);
+
+// Writes the instruction as codegen would; returns 0 if `size` is too small.
+int instruction_format(const MachineInstruction *instruction, char *text, size_t size);
+
+// The name of register `reg` at `size` bytes, NULL if there is none.
+const char *instruction_register_name(int reg, int size);
+
+// BYTE, DWORD or QWORD for a memory operand of `size` bytes, else NULL.
+const char *instruction_size_name(int size);
+
+// Whether two operands name the same register, value or address, whatever
+// their sizes.
+int instruction_same_location(const Operand *a, const Operand *b);
+
+#endif
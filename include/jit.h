@@ -0,0 +1,46 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdio.h>
+#include "ast.h"
+#include "codegen.h"
+
+typedef enum
+{
+    JIT_OK,
+    JIT_DIVISION_FAULT // idiv trapped: division by zero or INT64_MIN / -1
+} JitStatus;
+
+// A program compiled in-process from the same CFG codegen prints. The code
+// takes the address just past the frame in rdi and uses it as rbp, so its
+// [rbp-N] slots land in `frame`, which starts out zeroed.
+typedef struct
+{
+    unsigned char *code; // mapped read+execute once written
+    size_t code_size;
+    size_t mapping_size;
+    unsigned char *frame;
+    size_t frame_size;
+    SymbolTable *symbol_table;
+    double compile_seconds; // lowering, encoding and mapping
+    double execute_seconds; // the last jit_execute
+} JitProgram;
+
+// Returns NULL if the code cannot be encoded or mapped.
+JitProgram *jit_compile(ASTNode *program, SymbolTable *symbol_table, CodeGenOptions options);
+void jit_destroy(JitProgram *program);
+
+// Runs the code from all-zero variables. Not reentrant: a fault is caught
+// with a process-wide SIGFPE handler.
+JitStatus jit_execute(JitProgram *program);
+
+// Reads a variable after jit_execute; returns 0 if the program has no slot
+// for it.
+int jit_variable(const JitProgram *program, const char *name, long long *value);
+
+// Executes and prints `name = value` for every source variable the symbol
+// table noted, in order of appearance, then the timings on stderr. Returns 0
+// on success.
+int jit_run(JitProgram *program, FILE *output);
+
+#endif
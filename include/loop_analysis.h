@@ -0,0 +1,54 @@
+#ifndef LOOP_ANALYSIS_H
+#define LOOP_ANALYSIS_H
+
+#include "optimizer.h"
+
+// A variable whose only assignment in the loop is an unconditional
+// `name = name + step` (or `- step`) directly in the loop body.
+typedef struct
+{
+    const char *name;
+    int id;
+    long long step;
+    size_t update_index;
+} InductionVariable;
+
+typedef struct
+{
+    ASTNode *loop;
+    ASTNode *body;
+    InductionVariable *ivs;
+    size_t iv_count;
+} LoopInfo;
+
+// Iteration count of a loop whose exit test compares a basic induction
+// variable with a loop-invariant bound. `count` is an expression over the
+// values variables hold on entry; when `guarded` is set it is only meaningful
+// if the loop condition holds on entry. Counts wrap modulo 2^64, so
+// `nonnegative` records whether the count also fits a signed value.
+typedef struct
+{
+    InductionVariable *iv;
+    ASTNode *count;
+    int guarded;
+    int nonnegative;
+} TripCount;
+
+typedef ASTNode *(*LoopRewriter)(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop);
+
+void loop_analyze(Optimizer *optimizer, ASTNode *loop, LoopInfo *info);
+void loop_info_free(LoopInfo *info);
+
+int loop_trip_count(Optimizer *optimizer, LoopInfo *info, ASTNode **statements, size_t loop_index,
+                    TripCount *trip);
+void trip_count_free(TripCount *trip);
+
+InductionVariable *loop_find_induction_variable(LoopInfo *info, ASTNode *expression);
+int loop_entry_constant(ASTNode **statements, size_t loop_index, const char *name, long long *value);
+int loop_count_assignments(ASTNode *node, const char *name);
+int loop_contains_loop(ASTNode *node);
+int loop_uses_variable(Optimizer *optimizer, ASTNode *node, int id);
+
+ASTNode *loop_rewrite(Optimizer *optimizer, ASTNode *node, LoopRewriter rewrite);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Writes a relocatable ELF64 x86-64 object whose .text is `code`, defining
+// the global function `symbol` at its start. The code must be position
+// independent and reference nothing outside itself, so no relocations are
+// needed.
+int object_write_elf(FILE *output, const unsigned char *code, size_t size, const char *symbol);
+
+#endif
@@ -2,22 +2,33 @@
 #define OPTIMIZER_H
 
 #include "ast.h"
+#include "dataflow.h"
 #include "symbol_table.h"
 
+#define OPTIMIZER_DEFAULT_LEVEL 2
+#define OPTIMIZER_MAX_LEVEL 3
+#define OPTIMIZER_FULL_UNROLL_BUDGET 160 // AST nodes a fully unrolled loop may grow to, under --unroll too
+
 typedef struct
 {
-    int constant_folding_enabled;
-    int dead_code_elimination_enabled;
-    int strength_reduction_enabled;
+    int unroll_factor; // 0 picks a factor from the loop size
+    long long eval_budget; // AST nodes the compile-time evaluator may visit, 0 disables it
+    int eval_keep_prefix;
 } OptimizerOptions;
 
+struct PassManager;
+
 typedef struct
 {
     OptimizerOptions options;
+    struct PassManager *pass_manager; // the pipeline optimizer_optimize runs
     SymbolTable *symbol_table;
+    ASTNode *program;
     int changes_made;
+    int temporary_count;
 } Optimizer;
 
+OptimizerOptions optimizer_default_options(void);
 Optimizer *optimizer_create(SymbolTable *symbol_table);
 void optimizer_destroy(Optimizer *optimizer);
 
@@ -25,22 +36,36 @@ void optimizer_set_options(Optimizer *optimizer, OptimizerOptions options);
 ASTNode *optimizer_optimize(Optimizer *optimizer, ASTNode *ast);
 
 ASTNode *optimizer_constant_folding(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_algebraic_simplification(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_reassociation(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_value_range_analysis(Optimizer *optimizer, ASTNode *node);
 ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_loop_deletion(Optimizer *optimizer, ASTNode *node);
 ASTNode *optimizer_strength_reduction(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_scalar_evolution(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_loop_fusion(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_loop_invariant_code_motion(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_induction_variables(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_loop_unswitching(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_loop_unrolling(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_value_numbering(Optimizer *optimizer, ASTNode *node);
+ASTNode *optimizer_evaluate_program(Optimizer *optimizer, ASTNode *node);
 
-int optimizer_evaluate_constant_expression(ASTNode *node);
+long long optimizer_evaluate_constant_expression(ASTNode *node);
+long long optimizer_apply_operator(TokenType operator, long long left, long long right);
+int optimizer_division_traps(long long dividend, long long divisor);
 int optimizer_is_constant(ASTNode *node);
+int optimizer_expression_may_trap(ASTNode *node);
 
-typedef struct
-{
-    char **vars;
-    int count;
-} UsedVariables;
+const char *optimizer_new_temporary(Optimizer *optimizer);
+void optimizer_append_flattened(ASTNode *block, ASTNode *statement);
 
-UsedVariables *optimizer_find_used_variables(ASTNode *node);
-void used_variables_destroy(UsedVariables *used_vars);
+const DefUse *optimizer_def_use(Optimizer *optimizer, ASTNode *node);
+void optimizer_note_rewrites(Optimizer *optimizer, ASTNode *node, int changes_before);
+void optimizer_live_after(Optimizer *optimizer, ASTNode *statement, BitSet *live);
 
 int optimizer_can_eliminate_code(ASTNode *node);
+void optimizer_infer_widths(Optimizer *optimizer, ASTNode *program);
 ASTNode *optimizer_simplify_expression(ASTNode *node);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#include <stdio.h>
+#include "optimizer.h"
+
+typedef ASTNode *(*PassFunction)(Optimizer *optimizer, ASTNode *node);
+
+typedef enum
+{
+    PASS_REPEATED, // iterated with the other repeated passes until nothing changes
+    PASS_ONCE      // runs a single time, then the repeated passes clean up after it
+} PassKind;
+
+typedef struct
+{
+    const char *name;
+    PassFunction run;
+    PassKind kind;
+    int level; // lowest -O level that includes the pass
+} Pass;
+
+typedef struct
+{
+    Pass pass;
+    int runs;
+    double seconds;
+    long long nodes; // tree size summed over runs
+    long long rewrites;
+} PassRecord;
+
+typedef struct PassManager
+{
+    Pass *registry;
+    size_t registry_count;
+    PassRecord *pipeline;
+    size_t pipeline_count;
+    int collect_stats;
+} PassManager;
+
+PassManager *pass_manager_create(void);
+void pass_manager_destroy(PassManager *manager);
+
+int pass_manager_register(PassManager *manager, const char *name, PassFunction run, PassKind kind, int level);
+const Pass *pass_manager_find(PassManager *manager, const char *name);
+
+void pass_manager_clear(PassManager *manager);
+int pass_manager_add(PassManager *manager, const char *name);
+void pass_manager_set_level(PassManager *manager, int level);
+int pass_manager_set_pipeline(PassManager *manager, const char *names);
+
+ASTNode *pass_manager_run(PassManager *manager, Optimizer *optimizer, ASTNode *ast);
+void pass_manager_print_stats(PassManager *manager, FILE *output);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "cfg.h"
+
+// Rewrites each block's instructions, decoded, through a window of two
+// until no rule applies; only the dead-write check looks further ahead.
+// Codegen only reads flags in the setcc right after a cmp and in the jumps
+// after a block's closing compare, so a rule may clobber them anywhere else.
+
+typedef enum
+{
+    PEEPHOLE_STORE_FORWARDING, // a read of the slot just stored takes the stored register
+    PEEPHOLE_REDUNDANT_MOVE,   // a move of a value already in place, or overwritten before it is read
+    PEEPHOLE_ZERO_IDIOM,       // mov reg, 0 becomes xor reg, reg
+    PEEPHOLE_TEST_ZERO,        // cmp reg, 0 becomes test reg, reg
+    PEEPHOLE_RULE_COUNT
+} PeepholeRule;
+
+typedef struct
+{
+    int hits[PEEPHOLE_RULE_COUNT];
+} PeepholeStats;
+
+extern const char *peephole_rule_names[PEEPHOLE_RULE_COUNT];
+
+PeepholeStats peephole_optimize(ControlFlowGraph *cfg);
+void peephole_print_stats(const PeepholeStats *stats, FILE *output);
+
+#endif
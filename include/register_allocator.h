@@ -0,0 +1,36 @@
+#ifndef REGISTER_ALLOCATOR_H
+#define REGISTER_ALLOCATOR_H
+
+#include "cfg.h"
+#include "symbol_table.h"
+
+// Codegen keeps every variable in its [rbp-N] slot. Linear scan (Poletto and
+// Sarkar) then moves variables into the callee-saved registers codegen never
+// touches: each gets one live interval over the blocks in layout order, and
+// the intervals are assigned registers by increasing start. Once every
+// register is taken, the cheapest interval stays in memory, counting each
+// reference ten times per enclosing loop.
+//
+// A variable only ever assigned one constant, and not read before it is
+// assigned, is rematerialized: its reads become that constant, as an
+// immediate operand where it fits in 32 bits.
+
+#define ALLOCATABLE_REGISTER_COUNT 5
+
+extern const char *allocatable_registers[ALLOCATABLE_REGISTER_COUNT];
+extern const char *allocatable_registers32[ALLOCATABLE_REGISTER_COUNT];
+
+typedef struct
+{
+    int allocated;      // variables moved into a register
+    int rematerialized; // variables whose loads became constants
+    int spilled;        // variables left in memory for want of a register
+} RegisterAllocationStats;
+
+// Rewrites the CFG's instructions and sets each symbol's register_index.
+// Registers are saved in new frame slots taken from *stack_offset; variables
+// in registers are loaded from their slots on entry and stored back before
+// returning, so the slots still hold the program's final state.
+RegisterAllocationStats register_allocate(ControlFlowGraph *cfg, SymbolTable *symbol_table, int *stack_offset);
+
+#endif
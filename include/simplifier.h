@@ -0,0 +1,40 @@
+#ifndef SIMPLIFIER_H
+#define SIMPLIFIER_H
+
+#include "optimizer.h"
+
+typedef enum
+{
+    OPERAND_ANY,
+    OPERAND_ZERO,
+    OPERAND_ONE,
+    OPERAND_SAME,    // structurally equal to the left operand
+    OPERAND_NEGATION // `0 - y`
+} OperandPattern;
+
+typedef enum
+{
+    RESULT_LEFT,
+    RESULT_RIGHT,
+    RESULT_ZERO,
+    RESULT_ONE,
+    RESULT_NEGATED,  // the y of a right operand `0 - y`
+    RESULT_COMBINED  // `left rewrite y` for a right operand `0 - y`
+} RewriteResult;
+
+// `left operator right` is replaced by `result`. Every rule holds for all
+// 64-bit wrapping operands and shrinks the tree.
+typedef struct
+{
+    const char *name;
+    TokenType operator;
+    OperandPattern left;
+    OperandPattern right;
+    RewriteResult result;
+    TokenType rewrite;
+} SimplifyRule;
+
+extern const SimplifyRule simplify_rules[];
+extern const size_t simplify_rule_count;
+
+#endif
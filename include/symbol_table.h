@@ -13,8 +13,13 @@ typedef struct Symbol
 {
     char *name;
     SymbolType type;
+    int id;
     int scope_level;
     int is_initialized;
+    int stack_offset;
+    int register_index; // see register_allocate; -1 while the variable lives in its slot
+    long long low; // bounds on every value the variable holds, see optimizer_infer_widths
+    long long high;
     struct Symbol *next;
 } Symbol;
 
@@ -22,6 +27,10 @@ typedef struct SymbolTable
 {
     Symbol *head;
     int current_scope;
+    int symbol_count;
+    char **source_names; // see symbol_table_note_source
+    int source_count;
+    int source_capacity;
 } SymbolTable;
 
 SymbolTable *symbol_table_create(void);
@@ -33,6 +42,11 @@ void symbol_table_exit_scope(SymbolTable *table);
 Symbol *symbol_table_add(SymbolTable *table, const char *name, SymbolType type);
 Symbol *symbol_table_lookup(SymbolTable *table, const char *name);
 Symbol *symbol_table_lookup_current_scope(SymbolTable *table, const char *name);
+int symbol_table_get_id(SymbolTable *table, const char *name);
+
+// Records a variable of the source program, once, in order of first
+// appearance. The list outlives the optimizer removing the variable.
+void symbol_table_note_source(SymbolTable *table, const char *name);
 
 void symbol_table_mark_initialized(SymbolTable *table, const char *name);
 int symbol_table_is_initialized(SymbolTable *table, const char *name);
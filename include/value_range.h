@@ -0,0 +1,19 @@
+#ifndef VALUE_RANGE_H
+#define VALUE_RANGE_H
+
+#include "lexer.h"
+
+// A signed 64-bit interval. Operations whose result may wrap give the full
+// range, so an interval always bounds the value the machine computes.
+typedef struct
+{
+    long long low;
+    long long high;
+} Interval;
+
+Interval range_full(void);
+Interval range_constant(long long value);
+Interval range_binary(TokenType operator, Interval a, Interval b);
+int range_within(Interval interval, long long low, long long high);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdio.h>
+#include "bytecode.h"
+
+typedef enum
+{
+    VM_OK,
+    VM_DIVISION_FAULT // division by zero, or INT64_MIN / -1, where idiv would trap
+} VMStatus;
+
+// Runs the bytecode over `registers`, which must hold register_count values
+// with the variables' initial ones first.
+VMStatus vm_execute(const Bytecode *bytecode, long long *registers);
+
+// Runs the program from all-zero variables and prints `name = value` for
+// every source variable the symbol table noted, in order of appearance, even
+// one the optimizer removed. Returns 0 on success; a fault is reported on
+// stderr.
+int vm_run(const Bytecode *bytecode, SymbolTable *symbol_table, FILE *output);
+
+#endif
@@ -0,0 +1,537 @@
+#include "assembler.h"
+#include "instruction.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Condition codes, as the low nibble of jcc and setcc.
+static const struct
+{
+    const char *name;
+    int code;
+} condition_codes[] = {
+    {"o", 0x0},  {"no", 0x1}, {"b", 0x2},  {"ae", 0x3}, {"e", 0x4},  {"z", 0x4},  {"ne", 0x5}, {"nz", 0x5},
+    {"be", 0x6}, {"a", 0x7},  {"s", 0x8},  {"ns", 0x9}, {"p", 0xA},  {"np", 0xB}, {"l", 0xC},  {"ge", 0xD},
+    {"le", 0xE}, {"g", 0xF},
+};
+
+// Group 1 arithmetic: the r/m, reg opcode and the /digit of the immediate forms.
+static const struct
+{
+    const char *name;
+    unsigned char opcode;
+    int digit;
+} arithmetic_opcodes[] = {
+    {"add", 0x01, 0}, {"or", 0x09, 1}, {"and", 0x21, 4}, {"sub", 0x29, 5}, {"xor", 0x31, 6}, {"cmp", 0x39, 7},
+};
+
+// One-operand F7 group, and the shift group's /digit.
+static const struct
+{
+    const char *name;
+    int digit;
+} unary_opcodes[] = {{"not", 2}, {"neg", 3}, {"mul", 4}, {"imul", 5}, {"div", 6}, {"idiv", 7}},
+  shift_opcodes[] = {{"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7}};
+
+void assembler_init(Assembler *assembler)
+{
+    memset(assembler, 0, sizeof(Assembler));
+}
+
+void assembler_free(Assembler *assembler)
+{
+    free(assembler->code);
+    free(assembler->labels);
+    free(assembler->jumps);
+    memset(assembler, 0, sizeof(Assembler));
+}
+
+static void assembler_byte(Assembler *assembler, unsigned char byte)
+{
+    if (assembler->size == assembler->capacity)
+    {
+        assembler->capacity = assembler->capacity ? assembler->capacity * 2 : 256;
+        assembler->code = (unsigned char *)realloc(assembler->code, assembler->capacity);
+    }
+    assembler->code[assembler->size++] = byte;
+}
+
+static void assembler_value(Assembler *assembler, unsigned long long value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        assembler_byte(assembler, (unsigned char)(value >> (8 * i)));
+    }
+}
+
+static int assembler_fits(long long value, int bits)
+{
+    long long limit = 1LL << (bits - 1);
+    return value >= -limit && value < limit;
+}
+
+static void assembler_rex(Assembler *assembler, int wide, int reg, const Operand *rm)
+{
+    unsigned char rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((rm->reg >> 3) & 1);
+    if (rex != 0x40)
+        assembler_byte(assembler, rex);
+}
+
+// Emits REX, the opcode and the ModRM (plus SIB and displacement) for a
+// `reg` field and an r/m operand.
+static void assembler_modrm(Assembler *assembler, int wide, const unsigned char *opcode, size_t opcode_length,
+                            int reg, const Operand *rm)
+{
+    assembler_rex(assembler, wide, reg, rm);
+    for (size_t i = 0; i < opcode_length; i++)
+    {
+        assembler_byte(assembler, opcode[i]);
+    }
+
+    if (rm->kind == OPERAND_REGISTER)
+    {
+        assembler_byte(assembler, 0xC0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+
+    // Always carry a displacement so rbp and r13 bases need no special case.
+    int short_form = assembler_fits(rm->value, 8);
+    assembler_byte(assembler, (short_form ? 0x40 : 0x80) | (reg & 7) << 3 | (rm->reg & 7));
+    if ((rm->reg & 7) == 4)
+        assembler_byte(assembler, 0x24);
+    assembler_value(assembler, (unsigned long long)rm->value, short_form ? 1 : 4);
+}
+
+static void assembler_modrm1(Assembler *assembler, int wide, unsigned char opcode, int reg, const Operand *rm)
+{
+    assembler_modrm(assembler, wide, &opcode, 1, reg, rm);
+}
+
+static void assembler_modrm2(Assembler *assembler, int wide, unsigned char opcode, int reg, const Operand *rm)
+{
+    unsigned char bytes[2] = {0x0F, opcode};
+    assembler_modrm(assembler, wide, bytes, 2, reg, rm);
+}
+
+static int assembler_condition_code(const char *suffix)
+{
+    for (size_t i = 0; i < sizeof(condition_codes) / sizeof(condition_codes[0]); i++)
+    {
+        if (strcmp(condition_codes[i].name, suffix) == 0)
+            return condition_codes[i].code;
+    }
+    return -1;
+}
+
+// The operation's width: a register operand decides, else a sized memory one.
+static int assembler_operand_size(const Operand *destination, const Operand *source)
+{
+    if (destination->kind == OPERAND_REGISTER)
+        return destination->size;
+    if (source->kind == OPERAND_REGISTER)
+        return source->size;
+    return destination->size;
+}
+
+static int assembler_mov(Assembler *assembler, const Operand *destination, const Operand *source)
+{
+    int size = assembler_operand_size(destination, source);
+    if (size != 4 && size != 8)
+        return 0;
+
+    if (source->kind == OPERAND_IMMEDIATE)
+    {
+        long long value = source->value;
+        if (destination->kind == OPERAND_REGISTER && (size == 4 || !assembler_fits(value, 32)))
+        {
+            // B8+r: imm32 zero-extends into the full register, imm64 is movabs.
+            if (size == 4 && !(value >= INT32_MIN && value <= UINT32_MAX))
+                return 0;
+            int wide = size == 8 && !(value >= 0 && value <= UINT32_MAX);
+            assembler_rex(assembler, wide, 0, destination);
+            assembler_byte(assembler, 0xB8 + (destination->reg & 7));
+            assembler_value(assembler, (unsigned long long)value, wide ? 8 : 4);
+            return 1;
+        }
+        if (!assembler_fits(value, 32))
+            return 0;
+        assembler_modrm1(assembler, size == 8, 0xC7, 0, destination);
+        assembler_value(assembler, (unsigned long long)value, 4);
+        return 1;
+    }
+
+    if (source->kind == OPERAND_REGISTER && destination->kind != OPERAND_IMMEDIATE)
+    {
+        if (destination->kind == OPERAND_REGISTER && destination->size != source->size)
+            return 0;
+        assembler_modrm1(assembler, size == 8, 0x89, source->reg, destination);
+        return 1;
+    }
+    if (source->kind == OPERAND_MEMORY && destination->kind == OPERAND_REGISTER)
+    {
+        assembler_modrm1(assembler, size == 8, 0x8B, destination->reg, source);
+        return 1;
+    }
+    return 0;
+}
+
+static int assembler_arithmetic(Assembler *assembler, unsigned char opcode, int digit, const Operand *destination,
+                                const Operand *source)
+{
+    int size = assembler_operand_size(destination, source);
+    if ((size != 4 && size != 8) || destination->kind == OPERAND_IMMEDIATE)
+        return 0;
+
+    if (source->kind == OPERAND_IMMEDIATE)
+    {
+        int short_form = assembler_fits(source->value, 8);
+        if (!assembler_fits(source->value, 32))
+            return 0;
+        assembler_modrm1(assembler, size == 8, short_form ? 0x83 : 0x81, digit, destination);
+        assembler_value(assembler, (unsigned long long)source->value, short_form ? 1 : 4);
+        return 1;
+    }
+    if (source->kind == OPERAND_REGISTER)
+    {
+        if (destination->kind == OPERAND_REGISTER && destination->size != source->size)
+            return 0;
+        assembler_modrm1(assembler, size == 8, opcode, source->reg, destination);
+        return 1;
+    }
+    if (destination->kind == OPERAND_REGISTER)
+    {
+        assembler_modrm1(assembler, size == 8, opcode + 2, destination->reg, source);
+        return 1;
+    }
+    return 0;
+}
+
+static int assembler_two_operands(Assembler *assembler, const char *mnemonic, const Operand *destination,
+                                  const Operand *source)
+{
+    if (strcmp(mnemonic, "mov") == 0)
+        return assembler_mov(assembler, destination, source);
+
+    for (size_t i = 0; i < sizeof(arithmetic_opcodes) / sizeof(arithmetic_opcodes[0]); i++)
+    {
+        if (strcmp(mnemonic, arithmetic_opcodes[i].name) == 0)
+            return assembler_arithmetic(assembler, arithmetic_opcodes[i].opcode, arithmetic_opcodes[i].digit,
+                                        destination, source);
+    }
+
+    for (size_t i = 0; i < sizeof(shift_opcodes) / sizeof(shift_opcodes[0]); i++)
+    {
+        if (strcmp(mnemonic, shift_opcodes[i].name) != 0)
+            continue;
+        int size = assembler_operand_size(destination, source);
+        if ((size != 4 && size != 8) || destination->kind == OPERAND_IMMEDIATE)
+            return 0;
+        if (source->kind == OPERAND_REGISTER && source->reg == 1 && source->size == 1)
+        {
+            assembler_modrm1(assembler, size == 8, 0xD3, shift_opcodes[i].digit, destination);
+            return 1;
+        }
+        if (source->kind != OPERAND_IMMEDIATE || source->value < 0 || source->value > 63)
+            return 0;
+        if (source->value == 1)
+        {
+            assembler_modrm1(assembler, size == 8, 0xD1, shift_opcodes[i].digit, destination);
+            return 1;
+        }
+        assembler_modrm1(assembler, size == 8, 0xC1, shift_opcodes[i].digit, destination);
+        assembler_byte(assembler, (unsigned char)source->value);
+        return 1;
+    }
+
+    if (destination->kind != OPERAND_REGISTER || source->kind == OPERAND_IMMEDIATE)
+        return 0;
+    int wide = destination->size == 8;
+
+    if (strcmp(mnemonic, "imul") == 0 && destination->size >= 4 &&
+        (source->kind == OPERAND_MEMORY || source->size == destination->size))
+    {
+        assembler_modrm2(assembler, wide, 0xAF, destination->reg, source);
+        return 1;
+    }
+    if (strcmp(mnemonic, "test") == 0 && source->kind == OPERAND_REGISTER && source->size == destination->size &&
+        destination->size >= 4)
+    {
+        assembler_modrm1(assembler, wide, 0x85, source->reg, destination);
+        return 1;
+    }
+    if (strcmp(mnemonic, "lea") == 0 && source->kind == OPERAND_MEMORY && destination->size >= 4)
+    {
+        assembler_modrm1(assembler, wide, 0x8D, destination->reg, source);
+        return 1;
+    }
+    if (strcmp(mnemonic, "movsxd") == 0 && wide && (source->kind == OPERAND_MEMORY || source->size == 4))
+    {
+        assembler_modrm1(assembler, 1, 0x63, destination->reg, source);
+        return 1;
+    }
+    if (strcmp(mnemonic, "movzx") == 0 && destination->size >= 4 && source->size == 1)
+    {
+        assembler_modrm2(assembler, wide, 0xB6, destination->reg, source);
+        return 1;
+    }
+    return 0;
+}
+
+static int assembler_one_operand(Assembler *assembler, const char *mnemonic, const Operand *operand)
+{
+    if ((strcmp(mnemonic, "push") == 0 || strcmp(mnemonic, "pop") == 0) && operand->kind == OPERAND_REGISTER &&
+        operand->size == 8)
+    {
+        assembler_rex(assembler, 0, 0, operand);
+        assembler_byte(assembler, (mnemonic[1] == 'u' ? 0x50 : 0x58) + (operand->reg & 7));
+        return 1;
+    }
+
+    if (strncmp(mnemonic, "set", 3) == 0)
+    {
+        int code = assembler_condition_code(mnemonic + 3);
+        if (code < 0 || operand->kind != OPERAND_REGISTER || operand->size != 1)
+            return 0;
+        assembler_modrm2(assembler, 0, 0x90 + code, 0, operand);
+        return 1;
+    }
+
+    int size = operand->size;
+    if (operand->kind == OPERAND_IMMEDIATE || (size != 4 && size != 8))
+        return 0;
+    for (size_t i = 0; i < sizeof(unary_opcodes) / sizeof(unary_opcodes[0]); i++)
+    {
+        if (strcmp(mnemonic, unary_opcodes[i].name) == 0)
+        {
+            assembler_modrm1(assembler, size == 8, 0xF7, unary_opcodes[i].digit, operand);
+            return 1;
+        }
+    }
+    if (strcmp(mnemonic, "inc") == 0 || strcmp(mnemonic, "dec") == 0)
+    {
+        assembler_modrm1(assembler, size == 8, 0xFF, mnemonic[0] == 'd', operand);
+        return 1;
+    }
+    return 0;
+}
+
+// Only imul takes three: reg, r/m, imm, with 6B for an imm8 and 69 otherwise.
+static int assembler_three_operands(Assembler *assembler, const char *mnemonic, const Operand *operands)
+{
+    const Operand *destination = &operands[0];
+    const Operand *source = &operands[1];
+    const Operand *factor = &operands[2];
+    if (strcmp(mnemonic, "imul") != 0 || destination->kind != OPERAND_REGISTER || destination->size < 4 ||
+        source->kind == OPERAND_IMMEDIATE || (source->kind == OPERAND_REGISTER && source->size != destination->size) ||
+        factor->kind != OPERAND_IMMEDIATE || !assembler_fits(factor->value, 32))
+        return 0;
+
+    int short_form = assembler_fits(factor->value, 8);
+    assembler_modrm1(assembler, destination->size == 8, short_form ? 0x6B : 0x69, destination->reg, source);
+    assembler_value(assembler, (unsigned long long)factor->value, short_form ? 1 : 4);
+    return 1;
+}
+
+static int assembler_no_operands(Assembler *assembler, const char *mnemonic)
+{
+    if (strcmp(mnemonic, "ret") == 0)
+        assembler_byte(assembler, 0xC3);
+    else if (strcmp(mnemonic, "cdq") == 0)
+        assembler_byte(assembler, 0x99);
+    else if (strcmp(mnemonic, "cqo") == 0)
+    {
+        assembler_byte(assembler, 0x48);
+        assembler_byte(assembler, 0x99);
+    }
+    else if (strcmp(mnemonic, "nop") == 0)
+        assembler_byte(assembler, 0x90);
+    else
+        return 0;
+    return 1;
+}
+
+int assembler_instruction(Assembler *assembler, const char *text)
+{
+    MachineInstruction instruction;
+    return instruction_parse(text, &instruction) && assembler_encode(assembler, &instruction);
+}
+
+int assembler_encode(Assembler *assembler, const MachineInstruction *instruction)
+{
+    const char *mnemonic = instruction->mnemonic;
+    const Operand *operands = instruction->operands;
+
+    // A failed encoding must not leave a partial instruction behind.
+    size_t start = assembler->size;
+    int encoded;
+    switch (instruction->operand_count)
+    {
+    case 0:
+        encoded = assembler_no_operands(assembler, mnemonic);
+        break;
+    case 1:
+        encoded = assembler_one_operand(assembler, mnemonic, &operands[0]);
+        break;
+    case 2:
+        encoded = assembler_two_operands(assembler, mnemonic, &operands[0], &operands[1]);
+        break;
+    default:
+        encoded = assembler_three_operands(assembler, mnemonic, operands);
+        break;
+    }
+    if (!encoded)
+        assembler->size = start;
+    return encoded;
+}
+
+static void assembler_reserve_label(Assembler *assembler, int label)
+{
+    if (label < assembler->label_capacity)
+        return;
+
+    int capacity = assembler->label_capacity ? assembler->label_capacity : 16;
+    while (capacity <= label)
+        capacity *= 2;
+    assembler->labels = (AssemblerLabel *)realloc(assembler->labels, capacity * sizeof(AssemblerLabel));
+    for (int i = assembler->label_capacity; i < capacity; i++)
+    {
+        assembler->labels[i].offset = -1;
+    }
+    assembler->label_capacity = capacity;
+}
+
+void assembler_label(Assembler *assembler, int label)
+{
+    assembler_reserve_label(assembler, label);
+    assembler->labels[label].offset = (long)assembler->size;
+    assembler->labels[label].jumps_before = assembler->jump_count;
+}
+
+int assembler_jump(Assembler *assembler, const char *mnemonic, int label)
+{
+    int condition = -1;
+    if (strcmp(mnemonic, "jmp") != 0)
+    {
+        condition = mnemonic[0] == 'j' ? assembler_condition_code(mnemonic + 1) : -1;
+        if (condition < 0)
+            return 0;
+    }
+
+    if (assembler->jump_count == assembler->jump_capacity)
+    {
+        assembler->jump_capacity = assembler->jump_capacity ? assembler->jump_capacity * 2 : 16;
+        assembler->jumps =
+            (AssemblerJump *)realloc(assembler->jumps, assembler->jump_capacity * sizeof(AssemblerJump));
+    }
+    AssemblerJump *jump = &assembler->jumps[assembler->jump_count++];
+    jump->offset = assembler->size;
+    jump->condition = condition;
+    jump->label = label;
+    jump->near = 0;
+    return 1;
+}
+
+static int assembler_jump_size(const AssemblerJump *jump)
+{
+    if (!jump->near)
+        return 2;
+    return jump->condition < 0 ? 5 : 6;
+}
+
+// Final addresses: `starts[i]` is where jump i begins once every earlier
+// jump has its current size.
+static void assembler_layout(const Assembler *assembler, size_t *starts)
+{
+    size_t inserted = 0;
+    for (size_t i = 0; i < assembler->jump_count; i++)
+    {
+        starts[i] = assembler->jumps[i].offset + inserted;
+        inserted += assembler_jump_size(&assembler->jumps[i]);
+    }
+}
+
+static long long assembler_label_address(const Assembler *assembler, const size_t *starts, int label)
+{
+    const AssemblerLabel *target = &assembler->labels[label];
+    if (target->jumps_before == 0)
+        return target->offset;
+    const AssemblerJump *previous = &assembler->jumps[target->jumps_before - 1];
+    return (long long)(starts[target->jumps_before - 1] + assembler_jump_size(previous)) +
+           (target->offset - (long long)previous->offset);
+}
+
+int assembler_resolve(Assembler *assembler)
+{
+    for (size_t i = 0; i < assembler->jump_count; i++)
+    {
+        int label = assembler->jumps[i].label;
+        if (label < 0 || label >= assembler->label_capacity || assembler->labels[label].offset < 0)
+            return 0;
+    }
+
+    // Every jump starts short and only ever grows, so this settles.
+    size_t *starts = (size_t *)malloc((assembler->jump_count + 1) * sizeof(size_t));
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        assembler_layout(assembler, starts);
+        for (size_t i = 0; i < assembler->jump_count; i++)
+        {
+            AssemblerJump *jump = &assembler->jumps[i];
+            if (jump->near)
+                continue;
+            long long distance =
+                assembler_label_address(assembler, starts, jump->label) - (long long)(starts[i] + 2);
+            if (!assembler_fits(distance, 8))
+            {
+                jump->near = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    Assembler output;
+    assembler_init(&output);
+    size_t copied = 0;
+    for (size_t i = 0; i < assembler->jump_count; i++)
+    {
+        const AssemblerJump *jump = &assembler->jumps[i];
+        for (; copied < jump->offset; copied++)
+        {
+            assembler_byte(&output, assembler->code[copied]);
+        }
+
+        // Displacements count from the end of the jump.
+        int size = assembler_jump_size(jump);
+        long long distance = assembler_label_address(assembler, starts, jump->label) - (long long)(starts[i] + size);
+        if (!jump->near)
+        {
+            assembler_byte(&output, jump->condition < 0 ? 0xEB : 0x70 + jump->condition);
+            assembler_value(&output, (unsigned long long)distance, 1);
+            continue;
+        }
+        if (jump->condition < 0)
+        {
+            assembler_byte(&output, 0xE9);
+        }
+        else
+        {
+            assembler_byte(&output, 0x0F);
+            assembler_byte(&output, 0x80 + jump->condition);
+        }
+        assembler_value(&output, (unsigned long long)distance, 4);
+    }
+    for (; copied < assembler->size; copied++)
+    {
+        assembler_byte(&output, assembler->code[copied]);
+    }
+    free(starts);
+
+    free(assembler->code);
+    assembler->code = output.code;
+    assembler->size = output.size;
+    assembler->capacity = output.capacity;
+    assembler->jump_count = 0;
+    return 1;
+}
@@ -1,4 +1,5 @@
 #include "ast.h"
+#include "dataflow.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -6,6 +7,7 @@ ASTNode *ast_create_node(ASTNodeType type)
 {
     ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
     node->type = type;
+    node->def_use = NULL;
     node->line = 0;
     node->column = 0;
     return node;
@@ -60,10 +62,11 @@ void ast_destroy_node(ASTNode *node)
         break;
     }
 
+    def_use_destroy(node->def_use);
     free(node);
 }
 
-ASTNode *ast_create_integer(int value)
+ASTNode *ast_create_integer(long long value)
 {
     ASTNode *node = ast_create_node(NODE_INTEGER);
     node->data.integer.value = value;
@@ -134,6 +137,185 @@ void ast_add_statement(ASTNode *block, ASTNode *statement)
     block->data.block.statement_count = new_size;
 }
 
+ASTNode *ast_clone(ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    ASTNode *copy = NULL;
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        copy = ast_create_block();
+        copy->type = node->type;
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ast_add_statement(copy, ast_clone(node->data.block.statements[i]));
+        }
+        break;
+
+    case NODE_IF:
+        copy = ast_create_if(ast_clone(node->data.if_stmt.condition),
+                             ast_clone(node->data.if_stmt.if_body),
+                             ast_clone(node->data.if_stmt.else_body));
+        break;
+
+    case NODE_WHILE:
+        copy = ast_create_while(ast_clone(node->data.while_loop.condition),
+                                ast_clone(node->data.while_loop.body));
+        break;
+
+    case NODE_ASSIGNMENT:
+        copy = ast_create_assignment(node->data.assignment.name, ast_clone(node->data.assignment.value));
+        break;
+
+    case NODE_BINARY_OP:
+        copy = ast_create_binary_op(node->data.binary_op.operator,
+                                    ast_clone(node->data.binary_op.left),
+                                    ast_clone(node->data.binary_op.right));
+        break;
+
+    case NODE_IDENTIFIER:
+        copy = ast_create_identifier(node->data.identifier.name);
+        break;
+
+    case NODE_INTEGER:
+        copy = ast_create_integer(node->data.integer.value);
+        break;
+
+    case NODE_ERROR:
+        copy = ast_create_node(NODE_ERROR);
+        break;
+    }
+
+    copy->line = node->line;
+    copy->column = node->column;
+    return copy;
+}
+
+int ast_equal(ASTNode *a, ASTNode *b)
+{
+    if (!a || !b)
+        return a == b;
+
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        if (a->data.block.statement_count != b->data.block.statement_count)
+            return 0;
+        for (size_t i = 0; i < a->data.block.statement_count; i++)
+        {
+            if (!ast_equal(a->data.block.statements[i], b->data.block.statements[i]))
+                return 0;
+        }
+        return 1;
+
+    case NODE_IF:
+        return ast_equal(a->data.if_stmt.condition, b->data.if_stmt.condition) &&
+               ast_equal(a->data.if_stmt.if_body, b->data.if_stmt.if_body) &&
+               ast_equal(a->data.if_stmt.else_body, b->data.if_stmt.else_body);
+
+    case NODE_WHILE:
+        return ast_equal(a->data.while_loop.condition, b->data.while_loop.condition) &&
+               ast_equal(a->data.while_loop.body, b->data.while_loop.body);
+
+    case NODE_ASSIGNMENT:
+        return strcmp(a->data.assignment.name, b->data.assignment.name) == 0 &&
+               ast_equal(a->data.assignment.value, b->data.assignment.value);
+
+    case NODE_BINARY_OP:
+        return a->data.binary_op.operator== b->data.binary_op.operator&&
+               ast_equal(a->data.binary_op.left, b->data.binary_op.left) &&
+               ast_equal(a->data.binary_op.right, b->data.binary_op.right);
+
+    case NODE_IDENTIFIER:
+        return strcmp(a->data.identifier.name, b->data.identifier.name) == 0;
+
+    case NODE_INTEGER:
+        return a->data.integer.value == b->data.integer.value;
+
+    case NODE_ERROR:
+        return 1;
+    }
+
+    return 0;
+}
+
+int ast_size(ASTNode *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        int size = 1;
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            size += ast_size(node->data.block.statements[i]);
+        }
+        return size;
+    }
+    case NODE_IF:
+        return 1 + ast_size(node->data.if_stmt.condition) + ast_size(node->data.if_stmt.if_body) +
+               ast_size(node->data.if_stmt.else_body);
+    case NODE_WHILE:
+        return 1 + ast_size(node->data.while_loop.condition) + ast_size(node->data.while_loop.body);
+    case NODE_ASSIGNMENT:
+        return 1 + ast_size(node->data.assignment.value);
+    case NODE_BINARY_OP:
+        return 1 + ast_size(node->data.binary_op.left) + ast_size(node->data.binary_op.right);
+    default:
+        return 1;
+    }
+}
+
+void ast_visit_variables(ASTNode *node, VariableVisitor visit, void *context)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ast_visit_variables(node->data.block.statements[i], visit, context);
+        }
+        break;
+    case NODE_IF:
+        ast_visit_variables(node->data.if_stmt.condition, visit, context);
+        ast_visit_variables(node->data.if_stmt.if_body, visit, context);
+        ast_visit_variables(node->data.if_stmt.else_body, visit, context);
+        break;
+    case NODE_WHILE:
+        ast_visit_variables(node->data.while_loop.condition, visit, context);
+        ast_visit_variables(node->data.while_loop.body, visit, context);
+        break;
+    case NODE_ASSIGNMENT:
+        visit(node->data.assignment.name, context);
+        ast_visit_variables(node->data.assignment.value, visit, context);
+        break;
+    case NODE_BINARY_OP:
+        ast_visit_variables(node->data.binary_op.left, visit, context);
+        ast_visit_variables(node->data.binary_op.right, visit, context);
+        break;
+    case NODE_IDENTIFIER:
+        visit(node->data.identifier.name, context);
+        break;
+    default:
+        break;
+    }
+}
+
 static void ast_print_indent(int indent)
 {
     for (int i = 0; i < indent; i++)
@@ -209,7 +391,7 @@ void ast_print(ASTNode *node, int indent)
         break;
 
     case NODE_INTEGER:
-        printf("Integer: %d\n", node->data.integer.value);
+        printf("Integer: %lld\n", node->data.integer.value);
         break;
 
     case NODE_ERROR:
@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include "bytecode.h"
+
+// Lowers the tree to register bytecode for vm_execute. Variables live in
+// their own registers, so an assignment computes straight into its target
+// and x = x + k is a single instruction. Conditions branch on the relation
+// itself, and loops are rotated to test at the bottom, leaving one branch
+// per iteration.
+
+typedef struct
+{
+    Bytecode *bytecode;
+    SymbolTable *symbol_table;
+    int temporary_count; // temporaries in use, allocated as a stack
+} BytecodeCompiler;
+
+static int bytecode_fits_immediate(long long value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static size_t bytecode_emit(BytecodeCompiler *compiler, int opcode, int a, int b, int c)
+{
+    Bytecode *bytecode = compiler->bytecode;
+    if (bytecode->code_count == bytecode->code_capacity)
+    {
+        bytecode->code_capacity = bytecode->code_capacity ? bytecode->code_capacity * 2 : 64;
+        bytecode->code = (Instruction *)realloc(bytecode->code, bytecode->code_capacity * sizeof(Instruction));
+    }
+
+    Instruction *instruction = &bytecode->code[bytecode->code_count];
+    instruction->opcode = opcode;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+    return bytecode->code_count++;
+}
+
+static void bytecode_patch(BytecodeCompiler *compiler, size_t jump)
+{
+    compiler->bytecode->code[jump].a = (int)compiler->bytecode->code_count;
+}
+
+static int bytecode_constant(BytecodeCompiler *compiler, long long value)
+{
+    Bytecode *bytecode = compiler->bytecode;
+    for (size_t i = 0; i < bytecode->constant_count; i++)
+    {
+        if (bytecode->constants[i] == value)
+            return (int)i;
+    }
+
+    if (bytecode->constant_count == bytecode->constant_capacity)
+    {
+        bytecode->constant_capacity = bytecode->constant_capacity ? bytecode->constant_capacity * 2 : 8;
+        bytecode->constants =
+            (long long *)realloc(bytecode->constants, bytecode->constant_capacity * sizeof(long long));
+    }
+    bytecode->constants[bytecode->constant_count] = value;
+    return (int)bytecode->constant_count++;
+}
+
+static int bytecode_variable(BytecodeCompiler *compiler, const char *name)
+{
+    return symbol_table_get_id(compiler->symbol_table, name);
+}
+
+static int bytecode_temporary(BytecodeCompiler *compiler)
+{
+    int reg = compiler->bytecode->variable_count + compiler->temporary_count++;
+    if (reg >= compiler->bytecode->register_count)
+        compiler->bytecode->register_count = reg + 1;
+    return reg;
+}
+
+// Gives every variable its id, so temporaries can be numbered above them.
+static void bytecode_note_variable(const char *name, void *context)
+{
+    bytecode_variable((BytecodeCompiler *)context, name);
+}
+
+static int bytecode_arithmetic_opcode(TokenType operator)
+{
+    switch (operator)
+    {
+    case TOKEN_PLUS:
+        return OP_ADD;
+    case TOKEN_MINUS:
+        return OP_SUB;
+    case TOKEN_MULTIPLY:
+        return OP_MUL;
+    case TOKEN_DIVIDE:
+        return OP_DIV;
+    case TOKEN_SHIFT_LEFT:
+        return OP_SHL;
+    case TOKEN_LESS:
+        return OP_LESS;
+    case TOKEN_GREATER:
+        return OP_GREATER;
+    case TOKEN_EQUAL:
+        return OP_EQUAL;
+    case TOKEN_NOT_EQUAL:
+        return OP_NOT_EQUAL;
+    default:
+        return -1;
+    }
+}
+
+static int bytecode_relation(TokenType operator, Relation *relation)
+{
+    switch (operator)
+    {
+    case TOKEN_LESS:
+        *relation = RELATION_LESS;
+        return 1;
+    case TOKEN_GREATER:
+        *relation = RELATION_GREATER;
+        return 1;
+    case TOKEN_EQUAL:
+        *relation = RELATION_EQUAL;
+        return 1;
+    case TOKEN_NOT_EQUAL:
+        *relation = RELATION_NOT_EQUAL;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+Relation bytecode_mirror(Relation relation)
+{
+    switch (relation)
+    {
+    case RELATION_LESS:
+        return RELATION_GREATER;
+    case RELATION_GREATER:
+        return RELATION_LESS;
+    case RELATION_GREATER_EQUAL:
+        return RELATION_LESS_EQUAL;
+    case RELATION_LESS_EQUAL:
+        return RELATION_GREATER_EQUAL;
+    default:
+        return relation;
+    }
+}
+
+// Evaluates the expression into `target`, or into whatever register is
+// cheapest when target is -1, and returns that register.
+static int bytecode_expression(BytecodeCompiler *compiler, ASTNode *expression, int target)
+{
+    switch (expression->type)
+    {
+    case NODE_INTEGER:
+    {
+        long long value = expression->data.integer.value;
+        int reg = target >= 0 ? target : bytecode_temporary(compiler);
+        if (bytecode_fits_immediate(value))
+            bytecode_emit(compiler, OP_LOAD, reg, (int)value, 0);
+        else
+            bytecode_emit(compiler, OP_LOAD_CONSTANT, reg, bytecode_constant(compiler, value), 0);
+        return reg;
+    }
+    case NODE_IDENTIFIER:
+    {
+        int reg = bytecode_variable(compiler, expression->data.identifier.name);
+        if (target >= 0 && target != reg)
+        {
+            bytecode_emit(compiler, OP_MOVE, target, reg, 0);
+            return target;
+        }
+        return reg;
+    }
+    case NODE_BINARY_OP:
+    {
+        TokenType operator = expression->data.binary_op.operator;
+        ASTNode *left = expression->data.binary_op.left;
+        ASTNode *right = expression->data.binary_op.right;
+        int mark = compiler->temporary_count;
+
+        if (operator == TOKEN_PLUS && left->type == NODE_INTEGER)
+        {
+            ASTNode *swap = left;
+            left = right;
+            right = swap;
+        }
+        if ((operator == TOKEN_PLUS || operator == TOKEN_MINUS) && right->type == NODE_INTEGER)
+        {
+            long long value = right->data.integer.value;
+            if (bytecode_fits_immediate(value) && !(operator == TOKEN_MINUS && value == INT32_MIN))
+            {
+                if (operator == TOKEN_MINUS)
+                    value = -value;
+                int operand = bytecode_expression(compiler, left, -1);
+                compiler->temporary_count = mark;
+                int reg = target >= 0 ? target : bytecode_temporary(compiler);
+                bytecode_emit(compiler, OP_ADD_IMMEDIATE, reg, operand, (int)value);
+                return reg;
+            }
+        }
+
+        int left_reg = bytecode_expression(compiler, left, -1);
+        int right_reg = bytecode_expression(compiler, right, -1);
+        compiler->temporary_count = mark;
+        int reg = target >= 0 ? target : bytecode_temporary(compiler);
+        bytecode_emit(compiler, bytecode_arithmetic_opcode(operator), reg, left_reg, right_reg);
+        return reg;
+    }
+    default:
+        return target >= 0 ? target : bytecode_temporary(compiler);
+    }
+}
+
+// Emits a jump taken when the condition's truth equals `when` and returns
+// it for patching.
+static size_t bytecode_branch(BytecodeCompiler *compiler, ASTNode *condition, int when)
+{
+    int mark = compiler->temporary_count;
+    Relation relation;
+    size_t jump;
+
+    if (condition->type == NODE_BINARY_OP && bytecode_relation(condition->data.binary_op.operator, &relation))
+    {
+        ASTNode *left = condition->data.binary_op.left;
+        ASTNode *right = condition->data.binary_op.right;
+        if (!when)
+            relation ^= 1;
+        if (left->type == NODE_INTEGER && right->type != NODE_INTEGER)
+        {
+            ASTNode *swap = left;
+            left = right;
+            right = swap;
+            relation = bytecode_mirror(relation);
+        }
+
+        if (right->type == NODE_INTEGER && bytecode_fits_immediate(right->data.integer.value))
+        {
+            int left_reg = bytecode_expression(compiler, left, -1);
+            jump = bytecode_emit(compiler, OP_BRANCH_IMMEDIATE + relation, -1, left_reg,
+                                 (int)right->data.integer.value);
+        }
+        else
+        {
+            int left_reg = bytecode_expression(compiler, left, -1);
+            int right_reg = bytecode_expression(compiler, right, -1);
+            jump = bytecode_emit(compiler, OP_BRANCH + relation, -1, left_reg, right_reg);
+        }
+    }
+    else
+    {
+        int reg = bytecode_expression(compiler, condition, -1);
+        jump = bytecode_emit(compiler, when ? OP_JUMP_IF_NOT_ZERO : OP_JUMP_IF_ZERO, -1, reg, 0);
+    }
+
+    compiler->temporary_count = mark;
+    return jump;
+}
+
+static void bytecode_statement(BytecodeCompiler *compiler, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+            bytecode_statement(compiler, node->data.block.statements[i]);
+        break;
+    case NODE_ASSIGNMENT:
+        bytecode_expression(compiler, node->data.assignment.value,
+                            bytecode_variable(compiler, node->data.assignment.name));
+        break;
+    case NODE_IF:
+    {
+        size_t skip = bytecode_branch(compiler, node->data.if_stmt.condition, 0);
+        bytecode_statement(compiler, node->data.if_stmt.if_body);
+        if (node->data.if_stmt.else_body)
+        {
+            size_t end = bytecode_emit(compiler, OP_JUMP, -1, 0, 0);
+            bytecode_patch(compiler, skip);
+            bytecode_statement(compiler, node->data.if_stmt.else_body);
+            bytecode_patch(compiler, end);
+        }
+        else
+        {
+            bytecode_patch(compiler, skip);
+        }
+        break;
+    }
+    case NODE_WHILE:
+    {
+        size_t enter = bytecode_emit(compiler, OP_JUMP, -1, 0, 0);
+        size_t body = compiler->bytecode->code_count;
+        bytecode_statement(compiler, node->data.while_loop.body);
+        bytecode_patch(compiler, enter);
+        size_t repeat = bytecode_branch(compiler, node->data.while_loop.condition, 1);
+        compiler->bytecode->code[repeat].a = (int)body;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+Bytecode *bytecode_compile(ASTNode *program, SymbolTable *symbol_table)
+{
+    Bytecode *bytecode = (Bytecode *)calloc(1, sizeof(Bytecode));
+    BytecodeCompiler compiler = {bytecode, symbol_table, 0};
+
+    ast_visit_variables(program, bytecode_note_variable, &compiler);
+    bytecode->variable_count = symbol_table->symbol_count;
+    bytecode->register_count = bytecode->variable_count;
+
+    bytecode_statement(&compiler, program);
+    bytecode_emit(&compiler, OP_HALT, 0, 0, 0);
+    return bytecode;
+}
+
+void bytecode_destroy(Bytecode *bytecode)
+{
+    if (!bytecode)
+        return;
+    free(bytecode->code);
+    free(bytecode->constants);
+    free(bytecode);
+}
@@ -0,0 +1,546 @@
+#include "cfg.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How far back threading looks for a branch that decides a condition, and
+// how many rounds of cleanup run before giving up on a fixpoint.
+#define CFG_THREAD_DEPTH 8
+#define CFG_MAX_ROUNDS 64
+
+ControlFlowGraph *cfg_create(void)
+{
+    ControlFlowGraph *cfg = (ControlFlowGraph *)malloc(sizeof(ControlFlowGraph));
+    cfg->blocks = NULL;
+    cfg->block_count = 0;
+    cfg->block_capacity = 0;
+    return cfg;
+}
+
+static void cfg_destroy_block(BasicBlock *block)
+{
+    free(block->instructions);
+    bitset_free(&block->defs);
+    free(block);
+}
+
+void cfg_destroy(ControlFlowGraph *cfg)
+{
+    if (!cfg)
+        return;
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        cfg_destroy_block(cfg->blocks[i]);
+    }
+    free(cfg->blocks);
+    free(cfg);
+}
+
+BasicBlock *cfg_new_block(int label)
+{
+    BasicBlock *block = (BasicBlock *)calloc(1, sizeof(BasicBlock));
+    block->label = label;
+    block->exit = EXIT_RETURN;
+    block->relation = TOKEN_NOT_EQUAL;
+    instruction_parse("cmp rax, 0", &block->compare);
+    bitset_init(&block->defs, 0);
+    return block;
+}
+
+void cfg_place(ControlFlowGraph *cfg, BasicBlock *block)
+{
+    if (cfg->block_count == cfg->block_capacity)
+    {
+        cfg->block_capacity = cfg->block_capacity ? cfg->block_capacity * 2 : 16;
+        cfg->blocks = (BasicBlock **)realloc(cfg->blocks, cfg->block_capacity * sizeof(BasicBlock *));
+    }
+    cfg->blocks[cfg->block_count++] = block;
+}
+
+static void cfg_append_instruction(BasicBlock *block, const MachineInstruction *instruction)
+{
+    if (block->instruction_count == block->instruction_capacity)
+    {
+        block->instruction_capacity = block->instruction_capacity ? block->instruction_capacity * 2 : 8;
+        block->instructions =
+            (MachineInstruction *)realloc(block->instructions, block->instruction_capacity * sizeof(MachineInstruction));
+    }
+    block->instructions[block->instruction_count++] = *instruction;
+}
+
+// Codegen only writes instructions in the decoded syntax, so one that does
+// not decode is a bug in codegen rather than in the program.
+static void cfg_decode(MachineInstruction *instruction, const char *prefix, const char *format, va_list args)
+{
+    char text[128];
+    size_t length = strlen(prefix);
+    memcpy(text, prefix, length);
+    int written = vsnprintf(text + length, sizeof(text) - length, format, args);
+    if (written < 0 || (size_t)written >= sizeof(text) - length || !instruction_parse(text, instruction))
+    {
+        fprintf(stderr, "Codegen wrote an instruction it cannot decode: %s\n", text);
+        abort();
+    }
+}
+
+void cfg_append(BasicBlock *block, const char *format, ...)
+{
+    MachineInstruction instruction;
+    va_list args;
+    va_start(args, format);
+    cfg_decode(&instruction, "", format, args);
+    va_end(args);
+    cfg_append_instruction(block, &instruction);
+}
+
+void cfg_insert(BasicBlock *block, size_t index, const char *format, ...)
+{
+    MachineInstruction instruction;
+    va_list args;
+    va_start(args, format);
+    cfg_decode(&instruction, "", format, args);
+    va_end(args);
+
+    cfg_append_instruction(block, &instruction);
+    memmove(&block->instructions[index + 1], &block->instructions[index],
+            (block->instruction_count - 1 - index) * sizeof(MachineInstruction));
+    block->instructions[index] = instruction;
+}
+
+// Sets what the branch ending `block` tests, given as the cmp's operands, so
+// the cmp is emitted right before the conditional jump and the two can fuse.
+void cfg_compare(BasicBlock *block, TokenType relation, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    cfg_decode(&block->compare, "cmp ", format, args);
+    va_end(args);
+    block->relation = relation;
+}
+
+void cfg_jump(BasicBlock *block, BasicBlock *target)
+{
+    block->exit = EXIT_JUMP;
+    block->successor = target;
+}
+
+void cfg_branch(BasicBlock *block, ASTNode *condition, size_t condition_start, BasicBlock *if_true,
+                BasicBlock *if_false)
+{
+    block->exit = EXIT_BRANCH;
+    block->condition = condition;
+    block->condition_start = condition_start;
+    block->successor = if_true;
+    block->branch_target = if_false;
+}
+
+static void cfg_add_predecessor(BasicBlock *block, BasicBlock *predecessor)
+{
+    if (block)
+    {
+        block->predecessor_count++;
+        block->predecessor = predecessor;
+    }
+}
+
+// The entry block also has the function itself as a predecessor.
+static void cfg_count_predecessors(ControlFlowGraph *cfg)
+{
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        cfg->blocks[i]->predecessor_count = i == 0;
+        cfg->blocks[i]->predecessor = NULL;
+    }
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        if (block->exit == EXIT_JUMP || block->exit == EXIT_BRANCH)
+            cfg_add_predecessor(block->successor, block);
+        if (block->exit == EXIT_BRANCH)
+            cfg_add_predecessor(block->branch_target, block);
+    }
+}
+
+static int cfg_is_relation(TokenType operator)
+{
+    return operator== TOKEN_LESS || operator== TOKEN_GREATER || operator== TOKEN_EQUAL || operator== TOKEN_NOT_EQUAL;
+}
+
+static TokenType cfg_mirror_relation(TokenType relation)
+{
+    if (relation == TOKEN_LESS)
+        return TOKEN_GREATER;
+    if (relation == TOKEN_GREATER)
+        return TOKEN_LESS;
+    return relation;
+}
+
+// What `known` evaluating to `value` says about `condition`: 1 or 0 when it
+// decides it, -1 when it does not.
+static int cfg_implied_value(ASTNode *known, int value, ASTNode *condition)
+{
+    if (ast_equal(known, condition))
+        return value;
+    if (known->type != NODE_BINARY_OP || condition->type != NODE_BINARY_OP)
+        return -1;
+
+    TokenType fact = known->data.binary_op.operator;
+    TokenType query = condition->data.binary_op.operator;
+    if (!cfg_is_relation(fact) || !cfg_is_relation(query))
+        return -1;
+
+    if (!ast_equal(known->data.binary_op.left, condition->data.binary_op.left) ||
+        !ast_equal(known->data.binary_op.right, condition->data.binary_op.right))
+    {
+        if (!ast_equal(known->data.binary_op.left, condition->data.binary_op.right) ||
+            !ast_equal(known->data.binary_op.right, condition->data.binary_op.left))
+            return -1;
+        query = cfg_mirror_relation(query);
+    }
+
+    if (fact == query)
+        return value;
+    if (value)
+    {
+        if (fact == TOKEN_EQUAL)
+            return 0;
+        if (fact == TOKEN_NOT_EQUAL)
+            return query == TOKEN_EQUAL ? 0 : -1;
+        return query == TOKEN_NOT_EQUAL;
+    }
+    if (fact == TOKEN_NOT_EQUAL)
+        return query == TOKEN_EQUAL;
+    if (fact == TOKEN_EQUAL)
+        return query == TOKEN_NOT_EQUAL ? 1 : -1;
+    return -1;
+}
+
+// Whether `condition` is decided on the edge leaving `from` (through its
+// successor or its branch target), walking back through blocks with a single
+// predecessor that leave the condition's variables alone.
+static int cfg_edge_value(BasicBlock *from, int via_successor, ASTNode *condition, const BitSet *uses)
+{
+    for (int depth = 0; depth < CFG_THREAD_DEPTH; depth++)
+    {
+        if (from->exit == EXIT_BRANCH && from->successor != from->branch_target)
+        {
+            int value = cfg_implied_value(from->condition, via_successor, condition);
+            if (value >= 0)
+                return value;
+        }
+        if (bitset_intersects(&from->defs, uses) || from->predecessor_count != 1 || !from->predecessor)
+            return -1;
+
+        BasicBlock *to = from;
+        from = from->predecessor;
+        via_successor = from->successor == to;
+    }
+    return -1;
+}
+
+static int cfg_is_forwarder(BasicBlock *block)
+{
+    return block->instruction_count == 0 && block->exit == EXIT_JUMP && block->successor != block;
+}
+
+// A block that does nothing but test its condition.
+static int cfg_is_test(BasicBlock *block)
+{
+    return block->exit == EXIT_BRANCH && block->condition_start == 0 && bitset_is_empty(&block->defs);
+}
+
+static int cfg_thread_edge(BasicBlock *from, BasicBlock **edge, SymbolTable *symbol_table)
+{
+    BasicBlock *target = *edge;
+    for (int steps = 0; steps < CFG_THREAD_DEPTH && cfg_is_forwarder(target); steps++)
+    {
+        target = target->successor;
+    }
+
+    if (cfg_is_test(target))
+    {
+        BitSet uses;
+        bitset_init(&uses, 0);
+        dataflow_collect_uses(symbol_table, target->condition, &uses);
+        int value = cfg_edge_value(from, edge == &from->successor, target->condition, &uses);
+        bitset_free(&uses);
+
+        if (value >= 0)
+            target = value ? target->successor : target->branch_target;
+    }
+
+    if (target == *edge)
+        return 0;
+    *edge = target;
+    return 1;
+}
+
+static void cfg_mark_reachable(BasicBlock *block, unsigned char *reachable, ControlFlowGraph *cfg)
+{
+    while (block)
+    {
+        size_t index = 0;
+        while (cfg->blocks[index] != block)
+        {
+            index++;
+        }
+        if (reachable[index])
+            return;
+        reachable[index] = 1;
+
+        if (block->exit == EXIT_BRANCH)
+            cfg_mark_reachable(block->branch_target, reachable, cfg);
+        block = block->exit == EXIT_RETURN ? NULL : block->successor;
+    }
+}
+
+static int cfg_remove_unreachable(ControlFlowGraph *cfg)
+{
+    unsigned char *reachable = (unsigned char *)calloc(cfg->block_count, 1);
+    cfg_mark_reachable(cfg->blocks[0], reachable, cfg);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        if (reachable[i])
+            cfg->blocks[kept++] = cfg->blocks[i];
+        else
+            cfg_destroy_block(cfg->blocks[i]);
+    }
+
+    int removed = kept != cfg->block_count;
+    cfg->block_count = kept;
+    free(reachable);
+    return removed;
+}
+
+static size_t cfg_index_of(ControlFlowGraph *cfg, BasicBlock *block)
+{
+    size_t index = 0;
+    while (cfg->blocks[index] != block)
+    {
+        index++;
+    }
+    return index;
+}
+
+static void cfg_remove_at(ControlFlowGraph *cfg, size_t index)
+{
+    memmove(&cfg->blocks[index], &cfg->blocks[index + 1], (cfg->block_count - index - 1) * sizeof(BasicBlock *));
+    cfg->block_count--;
+}
+
+// Folds `next` into `block`, which is its only predecessor and jumps to it.
+static void cfg_merge(ControlFlowGraph *cfg, BasicBlock *block, BasicBlock *next)
+{
+    size_t offset = block->instruction_count;
+    for (size_t i = 0; i < next->instruction_count; i++)
+    {
+        cfg_append_instruction(block, &next->instructions[i]);
+    }
+
+    block->exit = next->exit;
+    block->successor = next->successor;
+    block->branch_target = next->branch_target;
+    block->condition = next->condition;
+    block->condition_start = offset + next->condition_start;
+    block->compare = next->compare;
+    block->relation = next->relation;
+    bitset_union_with(&block->defs, &next->defs);
+
+    // Falling off the last block returns, so the merged block takes its place.
+    size_t next_index = cfg_index_of(cfg, next);
+    if (next->exit == EXIT_RETURN)
+    {
+        cfg->blocks[next_index] = block;
+        cfg_remove_at(cfg, cfg_index_of(cfg, block));
+    }
+    else
+    {
+        cfg_remove_at(cfg, next_index);
+    }
+    cfg_destroy_block(next);
+}
+
+static int cfg_merge_chains(ControlFlowGraph *cfg)
+{
+    int merged = 0;
+    cfg_count_predecessors(cfg);
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        while (block->exit == EXIT_JUMP && block->successor != block && block->successor->predecessor_count == 1)
+        {
+            cfg_merge(cfg, block, block->successor);
+            cfg_count_predecessors(cfg);
+            merged = 1;
+        }
+    }
+    return merged;
+}
+
+void cfg_simplify(ControlFlowGraph *cfg, SymbolTable *symbol_table)
+{
+    int changed = 1;
+    for (int round = 0; changed && round < CFG_MAX_ROUNDS; round++)
+    {
+        changed = 0;
+        cfg_count_predecessors(cfg);
+        for (size_t i = 0; i < cfg->block_count; i++)
+        {
+            BasicBlock *block = cfg->blocks[i];
+            if (block->exit == EXIT_RETURN)
+                continue;
+
+            int threaded = cfg_thread_edge(block, &block->successor, symbol_table);
+            if (block->exit == EXIT_BRANCH)
+            {
+                threaded |= cfg_thread_edge(block, &block->branch_target, symbol_table);
+                // The test still runs: a division in it may fault.
+                if (block->successor == block->branch_target)
+                {
+                    block->exit = EXIT_JUMP;
+                    block->condition = NULL;
+                    threaded = 1;
+                }
+            }
+
+            if (threaded)
+            {
+                cfg_count_predecessors(cfg);
+                changed = 1;
+            }
+        }
+
+        changed |= cfg_remove_unreachable(cfg);
+        changed |= cfg_merge_chains(cfg);
+    }
+}
+
+// The conditional jump taken when `relation` holds, or when it fails.
+static const char *cfg_jump_mnemonic(TokenType relation, int holds)
+{
+    switch (relation)
+    {
+    case TOKEN_LESS:
+        return holds ? "jl" : "jge";
+    case TOKEN_GREATER:
+        return holds ? "jg" : "jle";
+    case TOKEN_EQUAL:
+        return holds ? "je" : "jne";
+    default:
+        return holds ? "jne" : "je";
+    }
+}
+
+// The jumps that leave `block` when `next` is laid out after it.
+static int cfg_exit_jumps(BasicBlock *block, BasicBlock *next, const char **mnemonics, BasicBlock **targets)
+{
+    switch (block->exit)
+    {
+    case EXIT_JUMP:
+        if (block->successor == next)
+            return 0;
+        mnemonics[0] = "jmp";
+        targets[0] = block->successor;
+        return 1;
+
+    case EXIT_BRANCH:
+        if (block->branch_target == next)
+        {
+            mnemonics[0] = cfg_jump_mnemonic(block->relation, 1);
+            targets[0] = block->successor;
+            return 1;
+        }
+        mnemonics[0] = cfg_jump_mnemonic(block->relation, 0);
+        targets[0] = block->branch_target;
+        if (block->successor == next)
+            return 1;
+        mnemonics[1] = "jmp";
+        targets[1] = block->successor;
+        return 2;
+
+    default:
+        return 0;
+    }
+}
+
+static void cfg_mark_labels(ControlFlowGraph *cfg)
+{
+    const char *mnemonics[2];
+    BasicBlock *targets[2];
+
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *next = i + 1 < cfg->block_count ? cfg->blocks[i + 1] : NULL;
+        int count = cfg_exit_jumps(cfg->blocks[i], next, mnemonics, targets);
+        for (int j = 0; j < count; j++)
+        {
+            targets[j]->labeled = 1;
+        }
+    }
+}
+
+void cfg_emit(ControlFlowGraph *cfg, Emitter *emitter)
+{
+    const char *mnemonics[2];
+    BasicBlock *targets[2];
+
+    cfg_mark_labels(cfg);
+
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        BasicBlock *next = i + 1 < cfg->block_count ? cfg->blocks[i + 1] : NULL;
+
+        if (block->labeled)
+            emitter_define_label(emitter, block->label);
+        for (size_t j = 0; j < block->instruction_count; j++)
+        {
+            emitter_machine_instruction(emitter, &block->instructions[j]);
+        }
+
+        if (block->exit == EXIT_BRANCH)
+            emitter_machine_instruction(emitter, &block->compare);
+        int count = cfg_exit_jumps(block, next, mnemonics, targets);
+        for (int j = 0; j < count; j++)
+        {
+            emitter_mnemonic(emitter, mnemonics[j]);
+            emitter_label(emitter, targets[j]->label);
+            emitter_end_line(emitter);
+        }
+    }
+}
+
+// Encodes the blocks as cfg_emit would print them; returns 0 if an
+// instruction is outside what the assembler knows.
+int cfg_assemble(ControlFlowGraph *cfg, Assembler *assembler)
+{
+    const char *mnemonics[2];
+    BasicBlock *targets[2];
+
+    cfg_mark_labels(cfg);
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        BasicBlock *next = i + 1 < cfg->block_count ? cfg->blocks[i + 1] : NULL;
+
+        if (block->labeled)
+            assembler_label(assembler, block->label);
+        for (size_t j = 0; j < block->instruction_count; j++)
+        {
+            if (!assembler_encode(assembler, &block->instructions[j]))
+                return 0;
+        }
+
+        if (block->exit == EXIT_BRANCH && !assembler_encode(assembler, &block->compare))
+            return 0;
+        int count = cfg_exit_jumps(block, next, mnemonics, targets);
+        for (int j = 0; j < count; j++)
+        {
+            if (!assembler_jump(assembler, mnemonics[j], targets[j]->label))
+                return 0;
+        }
+    }
+    return 1;
+}
@@ -1,7 +1,15 @@
 #include "codegen.h"
+#include "division.h"
+#include "object.h"
+#include "value_range.h"
+#include <stdint.h>
+#include <time.h>
 
-const char *registers[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
-const int NUM_REGISTERS = 10;
+// rax holds every expression result and rcx/rdx are clobbered by shifts and
+// idiv, so scratch values only live in the remaining caller-saved registers.
+const char *registers[] = {"rsi", "rdi", "r8", "r9", "r10", "r11"};
+const char *registers32[] = {"esi", "edi", "r8d", "r9d", "r10d", "r11d"};
+const int NUM_REGISTERS = 6;
 
 CodeGenerator *codegen_create(FILE *output_file, SymbolTable *symbol_table)
 {
@@ -10,42 +18,161 @@ CodeGenerator *codegen_create(FILE *output_file, SymbolTable *symbol_table)
     generator->symbol_table = symbol_table;
     generator->label_counter = 0;
     generator->stack_offset = 0;
+    generator->slot_hole = 0;
     generator->used_registers = (char **)calloc(NUM_REGISTERS, sizeof(char *));
     generator->register_count = 0;
+    generator->spill_slots = NULL;
+    generator->spill_slot_count = 0;
+    generator->spill_depth = 0;
+    generator->cfg = NULL;
+    generator->current = NULL;
+    generator->emitted_bytes = 0;
+    generator->emit_seconds = 0;
+    memset(&generator->allocation, 0, sizeof(generator->allocation));
+    memset(&generator->peephole, 0, sizeof(generator->peephole));
     generator->options.assembler = ASM_NASM;
     generator->options.optimize_registers = 1;
     generator->options.generate_comments = 1;
+    generator->options.simplify_cfg = 1;
+    generator->options.peephole = 1;
     return generator;
 }
 
 void codegen_destroy(CodeGenerator *generator)
 {
     free(generator->used_registers);
+    free(generator->spill_slots);
     free(generator);
 }
 
-void codegen_emit_prologue(CodeGenerator *generator)
+void codegen_set_options(CodeGenerator *generator, CodeGenOptions options)
 {
-    fprintf(generator->output_file, "section .text\n");
-    fprintf(generator->output_file, "global main\n");
-    fprintf(generator->output_file, "main:\n");
-    fprintf(generator->output_file, "    push rbp\n");
-    fprintf(generator->output_file, "    mov rbp, rsp\n");
+    generator->options = options;
 }
 
-void codegen_emit_epilogue(CodeGenerator *generator)
+static Interval codegen_symbol_range(const Symbol *symbol)
 {
-    fprintf(generator->output_file, "    mov rsp, rbp\n");
-    fprintf(generator->output_file, "    pop rbp\n");
-    fprintf(generator->output_file, "    xor eax, eax\n");
-    fprintf(generator->output_file, "    ret\n");
+    Interval range = {symbol->low, symbol->high};
+    return range;
 }
 
-char *codegen_new_label(CodeGenerator *generator)
+// Variables that stay within 32 bits get a 4-byte slot.
+int codegen_is_dword(const Symbol *symbol)
 {
-    char *label = (char *)malloc(16);
-    sprintf(label, ".L%d", generator->label_counter++);
-    return label;
+    return range_within(codegen_symbol_range(symbol), INT32_MIN, INT32_MAX);
+}
+
+static const char *epilogue[] = {"mov rsp, rbp", "pop rbp", "xor eax, eax", "ret"};
+
+// The frame is sized once every slot is known, keeping rsp 16-byte aligned.
+static int codegen_frame_size(CodeGenerator *generator)
+{
+    return (generator->stack_offset + 15) & ~15;
+}
+
+void codegen_emit_prologue(CodeGenerator *generator, Emitter *emitter)
+{
+    emitter_text(emitter, "section .text\nglobal main\nmain:\n");
+    emitter_mnemonic(emitter, "push");
+    emitter_register(emitter, "rbp");
+    emitter_end_line(emitter);
+    emitter_mnemonic(emitter, "mov");
+    emitter_register(emitter, "rbp");
+    emitter_register(emitter, "rsp");
+    emitter_end_line(emitter);
+    if (generator->stack_offset)
+    {
+        emitter_mnemonic(emitter, "sub");
+        emitter_register(emitter, "rsp");
+        emitter_immediate(emitter, codegen_frame_size(generator));
+        emitter_end_line(emitter);
+    }
+
+    if (!generator->options.generate_comments)
+        return;
+    for (Symbol *symbol = generator->symbol_table->head; symbol; symbol = symbol->next)
+    {
+        if (!symbol->stack_offset)
+            continue;
+        emitter_text(emitter, "    ; ");
+        emitter_text(emitter, symbol->name);
+        emitter_text(emitter, codegen_is_dword(symbol) ? ": DWORD [rbp-" : ": QWORD [rbp-");
+        emitter_integer(emitter, symbol->stack_offset);
+        emitter_text(emitter, "]");
+        if (symbol->register_index >= 0)
+        {
+            emitter_text(emitter, " in ");
+            emitter_text(emitter, codegen_is_dword(symbol) ? allocatable_registers32[symbol->register_index]
+                                                           : allocatable_registers[symbol->register_index]);
+        }
+        emitter_text(emitter, "\n");
+    }
+}
+
+void codegen_emit_epilogue(CodeGenerator *generator, Emitter *emitter)
+{
+    (void)generator;
+    for (size_t i = 0; i < sizeof(epilogue) / sizeof(epilogue[0]); i++)
+    {
+        emitter_instruction(emitter, epilogue[i]);
+    }
+}
+
+// Builds the whole NASM text in memory and writes it at once.
+static int codegen_write_text(CodeGenerator *generator)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Emitter emitter;
+    emitter_init(&emitter);
+    codegen_emit_prologue(generator, &emitter);
+    cfg_emit(generator->cfg, &emitter);
+    codegen_emit_epilogue(generator, &emitter);
+    generator->emitted_bytes = emitter.size;
+    int written = emitter_flush(&emitter, generator->output_file);
+    emitter_free(&emitter);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    generator->emit_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return written;
+}
+
+// Encodes main exactly as the NASM text would assemble and writes it as an
+// ELF object.
+static int codegen_write_object(CodeGenerator *generator)
+{
+    Assembler assembler;
+    assembler_init(&assembler);
+
+    char frame[32];
+    snprintf(frame, sizeof(frame), "sub rsp, %d", codegen_frame_size(generator));
+    int encoded = assembler_instruction(&assembler, "push rbp") && assembler_instruction(&assembler, "mov rbp, rsp") &&
+                  (!generator->stack_offset || assembler_instruction(&assembler, frame)) &&
+                  cfg_assemble(generator->cfg, &assembler);
+    for (size_t i = 0; encoded && i < sizeof(epilogue) / sizeof(epilogue[0]); i++)
+    {
+        encoded = assembler_instruction(&assembler, epilogue[i]);
+    }
+    encoded = encoded && assembler_resolve(&assembler);
+
+    int written = encoded && object_write_elf(generator->output_file, assembler.code, assembler.size, "main");
+    if (!encoded)
+        fprintf(stderr, "Instruction outside the encodable subset\n");
+    assembler_free(&assembler);
+    return written;
+}
+
+BasicBlock *codegen_new_block(CodeGenerator *generator)
+{
+    return cfg_new_block(generator->label_counter++);
+}
+
+// Lays `block` out next and directs further instructions into it.
+static void codegen_start_block(CodeGenerator *generator, BasicBlock *block)
+{
+    cfg_place(generator->cfg, block);
+    generator->current = block;
 }
 
 int codegen_allocate_register(CodeGenerator *generator)
@@ -71,61 +198,325 @@ void codegen_free_register(CodeGenerator *generator, int reg)
     }
 }
 
-void codegen_emit_binary_op(CodeGenerator *generator, ASTNode *node)
+// Lowers rax / divisor without idiv; rcx and rdx are the only scratch.
+static void codegen_emit_constant_division(CodeGenerator *generator, const DivisionPlan *plan)
+{
+    BasicBlock *block = generator->current;
+
+    switch (plan->kind)
+    {
+    case DIVISION_SHIFT:
+        cfg_append(block, "mov rcx, rax");
+        if (plan->shift > 1)
+            cfg_append(block, "sar rcx, 63");
+        cfg_append(block, "shr rcx, %d", 64 - plan->shift);
+        cfg_append(block, "add rax, rcx");
+        cfg_append(block, "sar rax, %d", plan->shift);
+        if (plan->negate)
+            cfg_append(block, "neg rax");
+        break;
+
+    case DIVISION_MULTIPLY:
+        cfg_append(block, "mov rcx, rax");
+        cfg_append(block, "mov rax, %lld", plan->multiplier);
+        cfg_append(block, "imul rcx");
+        if (plan->add_dividend > 0)
+            cfg_append(block, "add rdx, rcx");
+        else if (plan->add_dividend < 0)
+            cfg_append(block, "sub rdx, rcx");
+        if (plan->shift)
+            cfg_append(block, "sar rdx, %d", plan->shift);
+        cfg_append(block, "mov rax, rdx");
+        cfg_append(block, "shr rax, 63");
+        cfg_append(block, "add rax, rdx");
+        break;
+
+    default:
+        break;
+    }
+}
+
+static Interval codegen_range(CodeGenerator *generator, ASTNode *node)
+{
+    switch (node->type)
+    {
+    case NODE_INTEGER:
+        return range_constant(node->data.integer.value);
+    case NODE_IDENTIFIER:
+    {
+        Symbol *symbol = symbol_table_lookup(generator->symbol_table, node->data.identifier.name);
+        return symbol ? codegen_symbol_range(symbol) : range_full();
+    }
+    case NODE_BINARY_OP:
+        return range_binary(node->data.binary_op.operator, codegen_range(generator, node->data.binary_op.left),
+                            codegen_range(generator, node->data.binary_op.right));
+    default:
+        return range_full();
+    }
+}
+
+// Whether `node` can run on 32-bit registers, whose results are zero-extended
+// into rax.
+static int codegen_is_narrow(CodeGenerator *generator, ASTNode *node)
+{
+    TokenType operator= node->data.binary_op.operator;
+    Interval left = codegen_range(generator, node->data.binary_op.left);
+    Interval right = codegen_range(generator, node->data.binary_op.right);
+    Interval value = range_binary(operator, left, right);
+
+    switch (operator)
+    {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_MULTIPLY:
+        // The low half of the result only depends on the operands' low halves.
+        return range_within(value, 0, UINT32_MAX);
+    case TOKEN_SHIFT_LEFT:
+        // A 32-bit shl masks its count to five bits.
+        return range_within(right, 0, 31) && range_within(value, 0, UINT32_MAX);
+    case TOKEN_DIVIDE:
+        // 32-bit idiv sees signed halves and faults on a quotient of 2^31.
+        return range_within(left, INT32_MIN, INT32_MAX) && range_within(right, INT32_MIN, INT32_MAX) &&
+               range_within(value, 0, INT32_MAX);
+    default:
+        return range_within(left, INT32_MIN, INT32_MAX) && range_within(right, INT32_MIN, INT32_MAX);
+    }
+}
+
+// An operand an instruction takes in place of a register: a constant that
+// fits an imm32, or a variable's slot read at the operation's width.
+typedef struct
+{
+    char text[32];
+    int immediate;
+    long long value;
+} CodegenOperand;
+
+static int codegen_operand(CodeGenerator *generator, ASTNode *node, int narrow, CodegenOperand *operand)
+{
+    if (node->type == NODE_INTEGER)
+    {
+        operand->immediate = 1;
+        operand->value = node->data.integer.value;
+        snprintf(operand->text, sizeof(operand->text), "%lld", operand->value);
+        return range_within(range_constant(operand->value), INT32_MIN, INT32_MAX);
+    }
+    if (node->type != NODE_IDENTIFIER)
+        return 0;
+
+    // A 4-byte slot read as a qword would take in its neighbour.
+    Symbol *symbol = symbol_table_lookup(generator->symbol_table, node->data.identifier.name);
+    if (!narrow && symbol && codegen_is_dword(symbol))
+        return 0;
+    operand->immediate = 0;
+    snprintf(operand->text, sizeof(operand->text), "%s [rbp-%d]", narrow ? "DWORD" : "QWORD",
+             codegen_get_variable_offset(generator, node->data.identifier.name));
+    return 1;
+}
+
+// The Sethi-Ullman number of `node`: how many intermediate values computing
+// it holds at once, a leaf right operand needing none.
+static int codegen_need(ASTNode *node)
+{
+    if (node->type != NODE_BINARY_OP)
+        return 1;
+
+    ASTNode *right = node->data.binary_op.right;
+    int left_need = codegen_need(node->data.binary_op.left);
+    int right_need = right->type == NODE_INTEGER || right->type == NODE_IDENTIFIER ? 0 : codegen_need(right);
+    if (left_need == right_need)
+        return left_need + 1;
+    return left_need > right_need ? left_need : right_need;
+}
+
+// Where a value waits while the other operand is computed: a scratch
+// register, or a frame slot once those run out.
+typedef struct
+{
+    int reg;
+    int offset;
+} CodegenTemporary;
+
+static CodegenTemporary codegen_save(CodeGenerator *generator)
 {
-    codegen_emit_expression(generator, node->data.binary_op.left);
-    int left_reg = codegen_allocate_register(generator);
-    fprintf(generator->output_file, "    mov %s, rax\n", registers[left_reg]);
+    CodegenTemporary temporary = {codegen_allocate_register(generator), 0};
+    if (temporary.reg >= 0)
+    {
+        cfg_append(generator->current, "mov %s, rax", registers[temporary.reg]);
+        return temporary;
+    }
+
+    // Slots are reused by depth, so a frame only grows by the deepest spill.
+    if (generator->spill_depth == generator->spill_slot_count)
+    {
+        generator->spill_slots =
+            (int *)realloc(generator->spill_slots, (generator->spill_slot_count + 1) * sizeof(int));
+        generator->stack_offset += 8;
+        generator->spill_slots[generator->spill_slot_count++] = generator->stack_offset;
+    }
+    temporary.offset = generator->spill_slots[generator->spill_depth++];
+    cfg_append(generator->current, "mov [rbp-%d], rax", temporary.offset);
+    return temporary;
+}
+
+static CodegenOperand codegen_temporary_operand(const CodegenTemporary *temporary, int narrow)
+{
+    CodegenOperand operand = {"", 0, 0};
+    if (temporary->reg >= 0)
+        snprintf(operand.text, sizeof(operand.text), "%s", (narrow ? registers32 : registers)[temporary->reg]);
+    else
+        snprintf(operand.text, sizeof(operand.text), "%s [rbp-%d]", narrow ? "DWORD" : "QWORD", temporary->offset);
+    return operand;
+}
 
-    codegen_emit_expression(generator, node->data.binary_op.right);
-    int right_reg = codegen_allocate_register(generator);
-    fprintf(generator->output_file, "    mov %s, rax\n", registers[right_reg]);
+static void codegen_release(CodeGenerator *generator, const CodegenTemporary *temporary)
+{
+    if (temporary->reg >= 0)
+        codegen_free_register(generator, temporary->reg);
+    else
+        generator->spill_depth--;
+}
 
-    switch (node->data.binary_op.operator)
+// The relation that holds with its operands exchanged.
+static TokenType codegen_mirror(TokenType relation)
+{
+    return relation == TOKEN_LESS ? TOKEN_GREATER : relation == TOKEN_GREATER ? TOKEN_LESS : relation;
+}
+
+// rax = rax `operator` operand.
+static void codegen_emit_operation(CodeGenerator *generator, TokenType operator, int narrow,
+                                   const CodegenOperand *operand)
+{
+    BasicBlock *block = generator->current;
+    const char *result = narrow ? "eax" : "rax";
+    const char *count = narrow ? "ecx" : "rcx";
+
+    switch (operator)
     {
     case TOKEN_PLUS:
-        fprintf(generator->output_file, "    add %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    mov rax, %s\n", registers[left_reg]);
+        cfg_append(block, "add %s, %s", result, operand->text);
         break;
     case TOKEN_MINUS:
-        fprintf(generator->output_file, "    sub %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    mov rax, %s\n", registers[left_reg]);
+        cfg_append(block, "sub %s, %s", result, operand->text);
         break;
     case TOKEN_MULTIPLY:
-        fprintf(generator->output_file, "    imul %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    mov rax, %s\n", registers[left_reg]);
+        if (operand->immediate)
+            cfg_append(block, "imul %s, %s, %s", result, result, operand->text);
+        else
+            cfg_append(block, "imul %s, %s", result, operand->text);
         break;
     case TOKEN_DIVIDE:
-        fprintf(generator->output_file, "    mov rax, %s\n", registers[left_reg]);
-        fprintf(generator->output_file, "    cqo\n");
-        fprintf(generator->output_file, "    idiv %s\n", registers[right_reg]);
+        // idiv has no immediate form; constant divisors only get here as 0 or -1.
+        if (operand->immediate)
+            cfg_append(block, "mov %s, %s", count, operand->text);
+        cfg_append(block, narrow ? "cdq" : "cqo");
+        cfg_append(block, "idiv %s", operand->immediate ? count : operand->text);
         break;
     case TOKEN_SHIFT_LEFT:
-        fprintf(generator->output_file, "    mov rax, %s\n", registers[left_reg]);
-        fprintf(generator->output_file, "    mov rcx, %s\n", registers[right_reg]);
-        fprintf(generator->output_file, "    shl rax, cl\n");
+        if (operand->immediate && operand->value >= 0 && operand->value <= (narrow ? 31 : 63))
+        {
+            cfg_append(block, "shl %s, %s", result, operand->text);
+            break;
+        }
+        cfg_append(block, "mov %s, %s", count, operand->text);
+        cfg_append(block, "shl %s, cl", result);
         break;
     case TOKEN_LESS:
-        fprintf(generator->output_file, "    cmp %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    setl al\n");
-        fprintf(generator->output_file, "    movzx rax, al\n");
-        break;
     case TOKEN_GREATER:
-        fprintf(generator->output_file, "    cmp %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    setg al\n");
-        fprintf(generator->output_file, "    movzx rax, al\n");
-        break;
     case TOKEN_EQUAL:
-        fprintf(generator->output_file, "    cmp %s, %s\n", registers[left_reg], registers[right_reg]);
-        fprintf(generator->output_file, "    sete al\n");
-        fprintf(generator->output_file, "    movzx rax, al\n");
+    case TOKEN_NOT_EQUAL:
+        cfg_append(block, "cmp %s, %s", result, operand->text);
+        cfg_append(block, operator== TOKEN_LESS      ? "setl al"
+                          : operator== TOKEN_GREATER ? "setg al"
+                          : operator== TOKEN_EQUAL   ? "sete al"
+                                                     : "setne al");
+        cfg_append(block, "movzx eax, al");
         break;
     default:
         break;
     }
+}
+
+// rax = operand `operator` rax, for when the right operand was computed last.
+static void codegen_emit_reversed_operation(CodeGenerator *generator, TokenType operator, int narrow,
+                                            const CodegenOperand *operand)
+{
+    BasicBlock *block = generator->current;
+    const char *result = narrow ? "eax" : "rax";
+    const char *count = narrow ? "ecx" : "rcx";
+
+    switch (operator)
+    {
+    case TOKEN_MINUS:
+        cfg_append(block, "neg %s", result);
+        codegen_emit_operation(generator, TOKEN_PLUS, narrow, operand);
+        break;
+    case TOKEN_DIVIDE:
+    case TOKEN_SHIFT_LEFT:
+        cfg_append(block, "mov %s, %s", count, result);
+        cfg_append(block, "mov %s, %s", result, operand->text);
+        if (operator== TOKEN_DIVIDE)
+        {
+            cfg_append(block, narrow ? "cdq" : "cqo");
+            cfg_append(block, "idiv %s", count);
+        }
+        else
+        {
+            cfg_append(block, "shl %s, cl", result);
+        }
+        break;
+    default:
+        codegen_emit_operation(generator, codegen_mirror(operator), narrow, operand);
+        break;
+    }
+}
+
+// Leaves the value of `node` in rax. A leaf operand goes straight into the
+// instruction; otherwise the side needing more registers is computed first
+// and waits in a scratch register while the other side runs.
+void codegen_emit_binary_op(CodeGenerator *generator, ASTNode *node)
+{
+    TokenType operator= node->data.binary_op.operator;
+    ASTNode *left = node->data.binary_op.left;
+    ASTNode *right = node->data.binary_op.right;
+    if (operator== TOKEN_DIVIDE && right->type == NODE_INTEGER)
+    {
+        DivisionPlan plan = division_plan(right->data.integer.value);
+        if (plan.kind != DIVISION_IDIV)
+        {
+            codegen_emit_expression(generator, left);
+            codegen_emit_constant_division(generator, &plan);
+            return;
+        }
+    }
+
+    // Narrow operations use the 32-bit register names; writing eax clears
+    // the upper half of rax.
+    int narrow = codegen_is_narrow(generator, node);
+    CodegenOperand operand;
+    if (codegen_operand(generator, right, narrow, &operand))
+    {
+        codegen_emit_expression(generator, left);
+        codegen_emit_operation(generator, operator, narrow, &operand);
+        return;
+    }
+    if (codegen_operand(generator, left, narrow, &operand))
+    {
+        codegen_emit_expression(generator, right);
+        codegen_emit_reversed_operation(generator, operator, narrow, &operand);
+        return;
+    }
 
-    codegen_free_register(generator, right_reg);
-    codegen_free_register(generator, left_reg);
+    int right_first = codegen_need(right) > codegen_need(left);
+    codegen_emit_expression(generator, right_first ? right : left);
+    CodegenTemporary temporary = codegen_save(generator);
+    codegen_emit_expression(generator, right_first ? left : right);
+    operand = codegen_temporary_operand(&temporary, narrow);
+    if (right_first)
+        codegen_emit_operation(generator, operator, narrow, &operand);
+    else
+        codegen_emit_reversed_operation(generator, operator, narrow, &operand);
+    codegen_release(generator, &temporary);
 }
 
 void codegen_emit_expression(CodeGenerator *generator, ASTNode *node)
@@ -136,12 +527,23 @@ void codegen_emit_expression(CodeGenerator *generator, ASTNode *node)
     switch (node->type)
     {
     case NODE_INTEGER:
-        fprintf(generator->output_file, "    mov rax, %d\n", node->data.integer.value);
+        if (range_within(range_constant(node->data.integer.value), 0, UINT32_MAX))
+            cfg_append(generator->current, "mov eax, %lld", node->data.integer.value);
+        else
+            cfg_append(generator->current, "mov rax, %lld", node->data.integer.value);
         break;
     case NODE_IDENTIFIER:
-        fprintf(generator->output_file, "    mov rax, [rbp-%d]\n",
-                codegen_get_variable_offset(generator, node->data.identifier.name));
+    {
+        int offset = codegen_get_variable_offset(generator, node->data.identifier.name);
+        Symbol *symbol = symbol_table_lookup(generator->symbol_table, node->data.identifier.name);
+        if (!codegen_is_dword(symbol))
+            cfg_append(generator->current, "mov rax, [rbp-%d]", offset);
+        else if (symbol->low >= 0)
+            cfg_append(generator->current, "mov eax, [rbp-%d]", offset);
+        else
+            cfg_append(generator->current, "movsxd rax, DWORD [rbp-%d]", offset);
         break;
+    }
     case NODE_BINARY_OP:
         codegen_emit_binary_op(generator, node);
         break;
@@ -150,6 +552,54 @@ void codegen_emit_expression(CodeGenerator *generator, ASTNode *node)
     }
 }
 
+static int codegen_is_relation(TokenType operator)
+{
+    return operator== TOKEN_LESS || operator== TOKEN_GREATER || operator== TOKEN_EQUAL || operator== TOKEN_NOT_EQUAL;
+}
+
+// Evaluates a branch condition. A comparison leaves its operands for the
+// block's closing cmp instead of materializing 0 or 1, with a leaf operand
+// folded into the cmp.
+static void codegen_emit_condition(CodeGenerator *generator, ASTNode *condition)
+{
+    if (condition->type != NODE_BINARY_OP || !codegen_is_relation(condition->data.binary_op.operator))
+    {
+        codegen_emit_expression(generator, condition);
+        return;
+    }
+
+    TokenType relation = condition->data.binary_op.operator;
+    ASTNode *left = condition->data.binary_op.left;
+    ASTNode *right = condition->data.binary_op.right;
+    int narrow = codegen_is_narrow(generator, condition);
+    const char *result = narrow ? "eax" : "rax";
+
+    CodegenOperand operand;
+    if (codegen_operand(generator, right, narrow, &operand))
+    {
+        codegen_emit_expression(generator, left);
+        cfg_compare(generator->current, relation, "%s, %s", result, operand.text);
+        return;
+    }
+    if (codegen_operand(generator, left, narrow, &operand))
+    {
+        codegen_emit_expression(generator, right);
+        cfg_compare(generator->current, codegen_mirror(relation), "%s, %s", result, operand.text);
+        return;
+    }
+
+    int right_first = codegen_need(right) > codegen_need(left);
+    codegen_emit_expression(generator, right_first ? right : left);
+    CodegenTemporary temporary = codegen_save(generator);
+    codegen_emit_expression(generator, right_first ? left : right);
+    operand = codegen_temporary_operand(&temporary, narrow);
+    if (right_first)
+        cfg_compare(generator->current, relation, "%s, %s", result, operand.text);
+    else
+        cfg_compare(generator->current, relation, "%s, %s", operand.text, result);
+    codegen_release(generator, &temporary);
+}
+
 void codegen_emit_statement(CodeGenerator *generator, ASTNode *node)
 {
     if (!node)
@@ -161,51 +611,55 @@ void codegen_emit_statement(CodeGenerator *generator, ASTNode *node)
     {
         codegen_emit_expression(generator, node->data.assignment.value);
         int offset = codegen_get_variable_offset(generator, node->data.assignment.name);
-        generator->stack_offset = offset;
-        fprintf(generator->output_file, "    mov [rbp-%d], rax\n", offset);
+        Symbol *symbol = symbol_table_lookup(generator->symbol_table, node->data.assignment.name);
+        cfg_append(generator->current, "mov [rbp-%d], %s", offset, codegen_is_dword(symbol) ? "eax" : "rax");
+        bitset_set(&generator->current->defs,
+                   symbol_table_get_id(generator->symbol_table, node->data.assignment.name));
         break;
     }
     case NODE_IF:
     {
-        char *else_label = codegen_new_label(generator);
-        char *end_label = codegen_new_label(generator);
+        BasicBlock *then_block = codegen_new_block(generator);
+        BasicBlock *else_block = codegen_new_block(generator);
+        BasicBlock *end_block = codegen_new_block(generator);
 
-        codegen_emit_expression(generator, node->data.if_stmt.condition);
-        fprintf(generator->output_file, "    cmp rax, 0\n");
-        fprintf(generator->output_file, "    je %s\n", else_label);
+        size_t condition_start = generator->current->instruction_count;
+        codegen_emit_condition(generator, node->data.if_stmt.condition);
+        cfg_branch(generator->current, node->data.if_stmt.condition, condition_start, then_block, else_block);
 
+        codegen_start_block(generator, then_block);
         codegen_emit_statement(generator, node->data.if_stmt.if_body);
-        fprintf(generator->output_file, "    jmp %s\n", end_label);
+        cfg_jump(generator->current, end_block);
 
-        fprintf(generator->output_file, "%s:\n", else_label);
+        codegen_start_block(generator, else_block);
         if (node->data.if_stmt.else_body)
         {
             codegen_emit_statement(generator, node->data.if_stmt.else_body);
         }
+        cfg_jump(generator->current, end_block);
 
-        fprintf(generator->output_file, "%s:\n", end_label);
-        free(else_label);
-        free(end_label);
+        codegen_start_block(generator, end_block);
         break;
     }
     case NODE_WHILE:
     {
-        char *start_label = codegen_new_label(generator);
-        char *end_label = codegen_new_label(generator);
+        BasicBlock *header_block = codegen_new_block(generator);
+        BasicBlock *body_block = codegen_new_block(generator);
+        BasicBlock *end_block = codegen_new_block(generator);
 
-        fprintf(generator->output_file, "%s:\n", start_label);
-        codegen_emit_expression(generator, node->data.while_loop.condition);
-        fprintf(generator->output_file, "    cmp rax, 0\n");
-        fprintf(generator->output_file, "    je %s\n", end_label);
+        cfg_jump(generator->current, header_block);
+        codegen_start_block(generator, header_block);
+        codegen_emit_condition(generator, node->data.while_loop.condition);
+        cfg_branch(header_block, node->data.while_loop.condition, 0, body_block, end_block);
 
+        codegen_start_block(generator, body_block);
         codegen_emit_statement(generator, node->data.while_loop.body);
-        fprintf(generator->output_file, "    jmp %s\n", start_label);
-        fprintf(generator->output_file, "%s:\n", end_label);
+        cfg_jump(generator->current, header_block);
 
-        free(start_label);
-        free(end_label);
+        codegen_start_block(generator, end_block);
         break;
     }
+    case NODE_PROGRAM:
     case NODE_BLOCK:
         for (size_t i = 0; i < node->data.block.statement_count; i++)
         {
@@ -223,16 +677,57 @@ int codegen_get_variable_offset(CodeGenerator *generator, const char *name)
     if (!symbol)
     {
         symbol = symbol_table_add(generator->symbol_table, name, SYMBOL_INTEGER);
+    }
+    if (symbol->stack_offset)
+        return symbol->stack_offset;
+
+    // 4-byte slots are handed out in pairs so 8-byte ones stay aligned.
+    if (codegen_is_dword(symbol) && generator->slot_hole)
+    {
+        symbol->stack_offset = generator->slot_hole;
+        generator->slot_hole = 0;
+    }
+    else
+    {
         generator->stack_offset += 8;
-        fprintf(generator->output_file, "    sub rsp, 8\n");
+        symbol->stack_offset = generator->stack_offset;
+        if (codegen_is_dword(symbol))
+            generator->slot_hole = generator->stack_offset - 4;
     }
-    return generator->stack_offset;
+    return symbol->stack_offset;
 }
 
-int codegen_generate(CodeGenerator *generator, ASTNode *ast)
+// Builds generator->cfg for the program and assigns every variable its slot,
+// and its register when registers are optimized, before the peephole pass.
+void codegen_lower(CodeGenerator *generator, ASTNode *ast)
 {
-    codegen_emit_prologue(generator);
+    generator->cfg = cfg_create();
+    codegen_start_block(generator, codegen_new_block(generator));
     codegen_emit_statement(generator, ast);
-    codegen_emit_epilogue(generator);
-    return 1;
+    if (generator->options.simplify_cfg)
+        cfg_simplify(generator->cfg, generator->symbol_table);
+    if (generator->options.optimize_registers)
+        generator->allocation = register_allocate(generator->cfg, generator->symbol_table, &generator->stack_offset);
+    if (generator->options.peephole)
+        generator->peephole = peephole_optimize(generator->cfg);
+}
+
+int codegen_generate(CodeGenerator *generator, ASTNode *ast)
+{
+    codegen_lower(generator, ast);
+
+    int generated = 1;
+    if (generator->options.assembler == ASM_OBJECT)
+    {
+        generated = codegen_write_object(generator);
+    }
+    else
+    {
+        generated = codegen_write_text(generator);
+    }
+
+    cfg_destroy(generator->cfg);
+    generator->cfg = NULL;
+    generator->current = NULL;
+    return generated;
 }
\ No newline at end of file
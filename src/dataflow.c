@@ -0,0 +1,318 @@
+#include "dataflow.h"
+
+static size_t bitset_words_for(size_t bit_count)
+{
+    return (bit_count + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+}
+
+static void bitset_grow(BitSet *set, size_t word_count)
+{
+    if (word_count <= set->word_count)
+        return;
+
+    set->words = realloc(set->words, word_count * sizeof(uint64_t));
+    memset(set->words + set->word_count, 0, (word_count - set->word_count) * sizeof(uint64_t));
+    set->word_count = word_count;
+}
+
+void bitset_init(BitSet *set, size_t bit_count)
+{
+    set->word_count = bitset_words_for(bit_count);
+    set->words = set->word_count ? (uint64_t *)calloc(set->word_count, sizeof(uint64_t)) : NULL;
+}
+
+void bitset_free(BitSet *set)
+{
+    free(set->words);
+    set->words = NULL;
+    set->word_count = 0;
+}
+
+void bitset_clear(BitSet *set)
+{
+    if (set->word_count)
+        memset(set->words, 0, set->word_count * sizeof(uint64_t));
+}
+
+void bitset_copy(BitSet *dst, const BitSet *src)
+{
+    bitset_grow(dst, src->word_count);
+    bitset_clear(dst);
+    if (src->word_count)
+        memcpy(dst->words, src->words, src->word_count * sizeof(uint64_t));
+}
+
+void bitset_set(BitSet *set, size_t bit)
+{
+    bitset_grow(set, bit / BITSET_WORD_BITS + 1);
+    set->words[bit / BITSET_WORD_BITS] |= (uint64_t)1 << (bit % BITSET_WORD_BITS);
+}
+
+void bitset_reset(BitSet *set, size_t bit)
+{
+    if (bit / BITSET_WORD_BITS < set->word_count)
+        set->words[bit / BITSET_WORD_BITS] &= ~((uint64_t)1 << (bit % BITSET_WORD_BITS));
+}
+
+int bitset_test(const BitSet *set, size_t bit)
+{
+    if (bit / BITSET_WORD_BITS >= set->word_count)
+        return 0;
+    return (set->words[bit / BITSET_WORD_BITS] >> (bit % BITSET_WORD_BITS)) & 1;
+}
+
+void bitset_union_with(BitSet *dst, const BitSet *src)
+{
+    bitset_grow(dst, src->word_count);
+    for (size_t i = 0; i < src->word_count; i++)
+    {
+        dst->words[i] |= src->words[i];
+    }
+}
+
+void bitset_intersect_with(BitSet *dst, const BitSet *src)
+{
+    for (size_t i = 0; i < dst->word_count; i++)
+    {
+        dst->words[i] &= i < src->word_count ? src->words[i] : 0;
+    }
+}
+
+void bitset_subtract(BitSet *dst, const BitSet *src)
+{
+    size_t common = dst->word_count < src->word_count ? dst->word_count : src->word_count;
+    for (size_t i = 0; i < common; i++)
+    {
+        dst->words[i] &= ~src->words[i];
+    }
+}
+
+int bitset_intersects(const BitSet *a, const BitSet *b)
+{
+    size_t common = a->word_count < b->word_count ? a->word_count : b->word_count;
+    for (size_t i = 0; i < common; i++)
+    {
+        if (a->words[i] & b->words[i])
+            return 1;
+    }
+    return 0;
+}
+
+int bitset_is_empty(const BitSet *set)
+{
+    for (size_t i = 0; i < set->word_count; i++)
+    {
+        if (set->words[i])
+            return 0;
+    }
+    return 1;
+}
+
+int bitset_equals(const BitSet *a, const BitSet *b)
+{
+    size_t longest = a->word_count > b->word_count ? a->word_count : b->word_count;
+    for (size_t i = 0; i < longest; i++)
+    {
+        uint64_t left = i < a->word_count ? a->words[i] : 0;
+        uint64_t right = i < b->word_count ? b->words[i] : 0;
+        if (left != right)
+            return 0;
+    }
+    return 1;
+}
+
+int bitset_count(const BitSet *set)
+{
+    int count = 0;
+    for (size_t i = 0; i < set->word_count; i++)
+    {
+        count += __builtin_popcountll(set->words[i]);
+    }
+    return count;
+}
+
+void dataflow_collect_uses(SymbolTable *table, ASTNode *expression, BitSet *uses)
+{
+    if (!expression)
+        return;
+
+    switch (expression->type)
+    {
+    case NODE_IDENTIFIER:
+        bitset_set(uses, symbol_table_get_id(table, expression->data.identifier.name));
+        break;
+    case NODE_BINARY_OP:
+        dataflow_collect_uses(table, expression->data.binary_op.left, uses);
+        dataflow_collect_uses(table, expression->data.binary_op.right, uses);
+        break;
+    default:
+        break;
+    }
+}
+
+static void dataflow_merge(DefUse *summary, const DefUse *child)
+{
+    if (!child)
+        return;
+    bitset_union_with(&summary->defs, &child->defs);
+    bitset_union_with(&summary->uses, &child->uses);
+}
+
+const DefUse *dataflow_def_use(SymbolTable *table, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    if (node->def_use)
+        return node->def_use;
+
+    DefUse *summary = (DefUse *)malloc(sizeof(DefUse));
+    bitset_init(&summary->defs, table->symbol_count);
+    bitset_init(&summary->uses, table->symbol_count);
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            dataflow_merge(summary, dataflow_def_use(table, node->data.block.statements[i]));
+        }
+        break;
+
+    case NODE_IF:
+        dataflow_collect_uses(table, node->data.if_stmt.condition, &summary->uses);
+        dataflow_merge(summary, dataflow_def_use(table, node->data.if_stmt.if_body));
+        dataflow_merge(summary, dataflow_def_use(table, node->data.if_stmt.else_body));
+        break;
+
+    case NODE_WHILE:
+        dataflow_collect_uses(table, node->data.while_loop.condition, &summary->uses);
+        dataflow_merge(summary, dataflow_def_use(table, node->data.while_loop.body));
+        break;
+
+    case NODE_ASSIGNMENT:
+        bitset_set(&summary->defs, symbol_table_get_id(table, node->data.assignment.name));
+        dataflow_collect_uses(table, node->data.assignment.value, &summary->uses);
+        break;
+
+    default:
+        dataflow_collect_uses(table, node, &summary->uses);
+        break;
+    }
+
+    node->def_use = summary;
+    return summary;
+}
+
+typedef struct
+{
+    SymbolTable *table;
+    ASTNode *target;
+    BitSet *result;
+} LivenessQuery;
+
+// Backward transfer: live holds the live-out set of node on entry and its
+// live-in set on return.
+static void dataflow_liveness(LivenessQuery *query, ASTNode *node, BitSet *live)
+{
+    if (!node)
+        return;
+
+    if (node == query->target)
+        bitset_copy(query->result, live);
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = node->data.block.statement_count; i > 0; i--)
+        {
+            dataflow_liveness(query, node->data.block.statements[i - 1], live);
+        }
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        const DefUse *summary = dataflow_def_use(query->table, node);
+        bitset_subtract(live, &summary->defs);
+        bitset_union_with(live, &summary->uses);
+        break;
+    }
+
+    case NODE_IF:
+    {
+        BitSet else_live;
+        bitset_init(&else_live, 0);
+        bitset_copy(&else_live, live);
+        dataflow_liveness(query, node->data.if_stmt.if_body, live);
+        dataflow_liveness(query, node->data.if_stmt.else_body, &else_live);
+        bitset_union_with(live, &else_live);
+        dataflow_collect_uses(query->table, node->data.if_stmt.condition, live);
+        bitset_free(&else_live);
+        break;
+    }
+
+    case NODE_WHILE:
+    {
+        BitSet head, body_live;
+        bitset_init(&head, 0);
+        bitset_init(&body_live, 0);
+
+        dataflow_collect_uses(query->table, node->data.while_loop.condition, live);
+        bitset_copy(&head, live);
+        while (1)
+        {
+            bitset_copy(&body_live, &head);
+            dataflow_liveness(query, node->data.while_loop.body, &body_live);
+            bitset_union_with(&body_live, live);
+            if (bitset_equals(&body_live, &head))
+                break;
+            bitset_copy(&head, &body_live);
+        }
+        bitset_copy(live, &head);
+
+        bitset_free(&head);
+        bitset_free(&body_live);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+void dataflow_live_after(SymbolTable *table, ASTNode *root, ASTNode *target,
+                         const BitSet *exit_live, BitSet *live)
+{
+    LivenessQuery query;
+    query.table = table;
+    query.target = target;
+    query.result = live;
+
+    BitSet scratch;
+    bitset_init(&scratch, 0);
+    bitset_copy(&scratch, exit_live);
+    bitset_clear(live);
+    dataflow_liveness(&query, root, &scratch);
+    bitset_free(&scratch);
+}
+
+void dataflow_invalidate(ASTNode *node)
+{
+    if (node && node->def_use)
+    {
+        def_use_destroy(node->def_use);
+        node->def_use = NULL;
+    }
+}
+
+void def_use_destroy(DefUse *summary)
+{
+    if (summary)
+    {
+        bitset_free(&summary->defs);
+        bitset_free(&summary->uses);
+        free(summary);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "division.h"
+
+// Smallest multiplier and shift with floor(x * multiplier / 2^(64 + shift))
+// rounding to x / divisor for every signed 64-bit x, valid for
+// 2 <= |divisor| that is not a power of two.
+static void division_magic(long long divisor, DivisionPlan *plan)
+{
+    const unsigned long long two63 = 1ULL << 63;
+    unsigned long long absolute = divisor < 0 ? 0 - (unsigned long long)divisor : (unsigned long long)divisor;
+    unsigned long long t = two63 + ((unsigned long long)divisor >> 63);
+    unsigned long long absolute_nc = t - 1 - t % absolute;
+    unsigned long long q1 = two63 / absolute_nc;
+    unsigned long long r1 = two63 - q1 * absolute_nc;
+    unsigned long long q2 = two63 / absolute;
+    unsigned long long r2 = two63 - q2 * absolute;
+    unsigned long long delta;
+    int p = 63;
+
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= absolute_nc)
+        {
+            q1++;
+            r1 -= absolute_nc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= absolute)
+        {
+            q2++;
+            r2 -= absolute;
+        }
+        delta = absolute - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    unsigned long long multiplier = q2 + 1;
+    plan->multiplier = (long long)(divisor < 0 ? 0 - multiplier : multiplier);
+    plan->shift = p - 64;
+
+    // The multiplier wrapped past the signed range: fix up with the dividend.
+    if (divisor > 0 && plan->multiplier < 0)
+        plan->add_dividend = 1;
+    else if (divisor < 0 && plan->multiplier > 0)
+        plan->add_dividend = -1;
+}
+
+DivisionPlan division_plan(long long divisor)
+{
+    DivisionPlan plan;
+    plan.kind = DIVISION_IDIV;
+    plan.divisor = divisor;
+    plan.multiplier = 0;
+    plan.shift = 0;
+    plan.add_dividend = 0;
+    plan.negate = 0;
+
+    if (divisor == 0 || divisor == -1)
+        return plan;
+
+    if (divisor == 1)
+    {
+        plan.kind = DIVISION_IDENTITY;
+        return plan;
+    }
+
+    unsigned long long absolute = divisor < 0 ? 0 - (unsigned long long)divisor : (unsigned long long)divisor;
+    if ((absolute & (absolute - 1)) == 0)
+    {
+        plan.kind = DIVISION_SHIFT;
+        plan.shift = __builtin_ctzll(absolute);
+        plan.negate = divisor < 0;
+        return plan;
+    }
+
+    plan.kind = DIVISION_MULTIPLY;
+    division_magic(divisor, &plan);
+    return plan;
+}
+
+long long division_apply(const DivisionPlan *plan, long long dividend)
+{
+    switch (plan->kind)
+    {
+    case DIVISION_IDENTITY:
+        return dividend;
+
+    case DIVISION_SHIFT:
+    {
+        // Negative dividends get 2^k - 1 added so the shift rounds to zero.
+        unsigned long long bias = (unsigned long long)(dividend >> 63) >> (64 - plan->shift);
+        long long quotient = (long long)((unsigned long long)dividend + bias) >> plan->shift;
+        return plan->negate ? (long long)(0 - (unsigned long long)quotient) : quotient;
+    }
+
+    case DIVISION_MULTIPLY:
+    {
+        unsigned long long high = (unsigned long long)(((__int128)plan->multiplier * dividend) >> 64);
+        if (plan->add_dividend > 0)
+            high += (unsigned long long)dividend;
+        else if (plan->add_dividend < 0)
+            high -= (unsigned long long)dividend;
+        long long quotient = (long long)high >> plan->shift;
+        return (long long)((unsigned long long)quotient + ((unsigned long long)quotient >> 63));
+    }
+
+    default:
+        return dividend / plan->divisor;
+    }
+}
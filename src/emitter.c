@@ -0,0 +1,201 @@
+#include "emitter.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EMITTER_INITIAL_CAPACITY (64 * 1024)
+
+// Room for the longest decoded instruction: a mnemonic and three operands
+// of at most a size keyword, a register and a 64-bit displacement each.
+#define EMITTER_MAX_INSTRUCTION 160
+
+void emitter_init(Emitter *emitter)
+{
+    emitter->data = NULL;
+    emitter->size = 0;
+    emitter->capacity = 0;
+    emitter->operand_count = 0;
+}
+
+void emitter_free(Emitter *emitter)
+{
+    free(emitter->data);
+    emitter_init(emitter);
+}
+
+static char *emitter_reserve(Emitter *emitter, size_t length)
+{
+    if (emitter->size + length > emitter->capacity)
+    {
+        size_t capacity = emitter->capacity ? emitter->capacity : EMITTER_INITIAL_CAPACITY;
+        while (emitter->size + length > capacity)
+        {
+            capacity *= 2;
+        }
+        emitter->data = (char *)realloc(emitter->data, capacity);
+        emitter->capacity = capacity;
+    }
+    return emitter->data + emitter->size;
+}
+
+static void emitter_bytes(Emitter *emitter, const char *bytes, size_t length)
+{
+    memcpy(emitter_reserve(emitter, length), bytes, length);
+    emitter->size += length;
+}
+
+void emitter_text(Emitter *emitter, const char *text)
+{
+    emitter_bytes(emitter, text, strlen(text));
+}
+
+// Digits are produced backwards into a scratch buffer; the magnitude is
+// taken as unsigned so INT64_MIN needs no special case.
+static char *emitter_put_integer(char *out, long long value)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do
+    {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        *--start = '-';
+    memcpy(out, start, (size_t)(end - start));
+    return out + (end - start);
+}
+
+static char *emitter_put(char *out, const char *text)
+{
+    while (*text)
+        *out++ = *text++;
+    return out;
+}
+
+void emitter_integer(Emitter *emitter, long long value)
+{
+    char *out = emitter_reserve(emitter, 24);
+    emitter->size += (size_t)(emitter_put_integer(out, value) - out);
+}
+
+void emitter_instruction(Emitter *emitter, const char *text)
+{
+    size_t length = strlen(text);
+    char *out = emitter_reserve(emitter, length + 5);
+    memcpy(out, "    ", 4);
+    memcpy(out + 4, text, length);
+    out[length + 4] = '\n';
+    emitter->size += length + 5;
+}
+
+void emitter_machine_instruction(Emitter *emitter, const MachineInstruction *instruction)
+{
+    char *start = emitter_reserve(emitter, EMITTER_MAX_INSTRUCTION);
+    char *out = emitter_put(start, "    ");
+    out = emitter_put(out, instruction->mnemonic);
+    for (int i = 0; i < instruction->operand_count; i++)
+    {
+        const Operand *operand = &instruction->operands[i];
+        out = emitter_put(out, i ? ", " : " ");
+        if (operand->kind == OPERAND_REGISTER)
+        {
+            out = emitter_put(out, instruction_register_name(operand->reg, operand->size));
+        }
+        else if (operand->kind == OPERAND_IMMEDIATE)
+        {
+            out = emitter_put_integer(out, operand->value);
+        }
+        else
+        {
+            const char *size_name = instruction_size_name(operand->size);
+            if (size_name)
+            {
+                out = emitter_put(out, size_name);
+                *out++ = ' ';
+            }
+            *out++ = '[';
+            out = emitter_put(out, instruction_register_name(operand->reg, 8));
+            if (operand->value >= 0)
+                *out++ = '+';
+            out = emitter_put_integer(out, operand->value);
+            *out++ = ']';
+        }
+    }
+    *out++ = '\n';
+    emitter->size += (size_t)(out - start);
+}
+
+void emitter_mnemonic(Emitter *emitter, const char *mnemonic)
+{
+    emitter_bytes(emitter, "    ", 4);
+    emitter_text(emitter, mnemonic);
+    emitter->operand_count = 0;
+}
+
+static void emitter_separator(Emitter *emitter)
+{
+    if (emitter->operand_count++)
+        emitter_bytes(emitter, ", ", 2);
+    else
+        emitter_bytes(emitter, " ", 1);
+}
+
+void emitter_register(Emitter *emitter, const char *name)
+{
+    emitter_separator(emitter);
+    emitter_text(emitter, name);
+}
+
+void emitter_immediate(Emitter *emitter, long long value)
+{
+    emitter_separator(emitter);
+    emitter_integer(emitter, value);
+}
+
+void emitter_label(Emitter *emitter, int label)
+{
+    emitter_separator(emitter);
+    emitter_bytes(emitter, ".L", 2);
+    emitter_integer(emitter, label);
+}
+
+void emitter_end_line(Emitter *emitter)
+{
+    emitter_bytes(emitter, "\n", 1);
+}
+
+void emitter_define_label(Emitter *emitter, int label)
+{
+    emitter_bytes(emitter, ".L", 2);
+    emitter_integer(emitter, label);
+    emitter_bytes(emitter, ":\n", 2);
+}
+
+// Anything already in the FILE's own buffer goes first, then the text in as
+// few write calls as the kernel allows.
+int emitter_flush(Emitter *emitter, FILE *output)
+{
+    if (fflush(output) != 0)
+        return 0;
+
+    int descriptor = fileno(output);
+    size_t written = 0;
+    while (written < emitter->size)
+    {
+        ssize_t count = write(descriptor, emitter->data + written, emitter->size - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+        {
+            perror("write");
+            return 0;
+        }
+        written += (size_t)count;
+    }
+    emitter->size = 0;
+    return 1;
+}
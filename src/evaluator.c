@@ -0,0 +1,254 @@
+#include "optimizer.h"
+
+// Programs take no input, so running one at compile time yields exactly the
+// state the generated code would end in. The evaluator interprets the tree
+// under a budget of visited nodes; a fault or a read of a variable that was
+// never assigned stops it just as running out of budget does.
+
+typedef enum
+{
+    EVALUATION_RUNNING,
+    EVALUATION_STOPPED
+} EvaluationStatus;
+
+typedef struct
+{
+    long long *values;
+    unsigned char *assigned;
+    int *order; // ids in order of first assignment
+    size_t order_count;
+} EvaluationState;
+
+typedef struct
+{
+    Optimizer *optimizer;
+    size_t variable_count;
+    long long budget;
+    EvaluationStatus status;
+    EvaluationState state;
+} Evaluator;
+
+static void evaluation_state_init(EvaluationState *state, size_t variable_count)
+{
+    state->values = (long long *)calloc(variable_count + 1, sizeof(long long));
+    state->assigned = (unsigned char *)calloc(variable_count + 1, 1);
+    state->order = (int *)malloc((variable_count + 1) * sizeof(int));
+    state->order_count = 0;
+}
+
+static void evaluation_state_copy(EvaluationState *dst, const EvaluationState *src, size_t variable_count)
+{
+    memcpy(dst->values, src->values, variable_count * sizeof(long long));
+    memcpy(dst->assigned, src->assigned, variable_count);
+    memcpy(dst->order, src->order, src->order_count * sizeof(int));
+    dst->order_count = src->order_count;
+}
+
+static void evaluation_state_free(EvaluationState *state)
+{
+    free(state->values);
+    free(state->assigned);
+    free(state->order);
+}
+
+static int evaluator_spend(Evaluator *evaluator)
+{
+    if (evaluator->status != EVALUATION_RUNNING)
+        return 0;
+    if (evaluator->budget-- <= 0)
+    {
+        evaluator->status = EVALUATION_STOPPED;
+        return 0;
+    }
+    return 1;
+}
+
+static size_t evaluator_id(Evaluator *evaluator, const char *name)
+{
+    return (size_t)symbol_table_get_id(evaluator->optimizer->symbol_table, name);
+}
+
+static long long evaluator_expression(Evaluator *evaluator, ASTNode *expression)
+{
+    if (!evaluator_spend(evaluator))
+        return 0;
+
+    switch (expression->type)
+    {
+    case NODE_INTEGER:
+        return expression->data.integer.value;
+
+    case NODE_IDENTIFIER:
+    {
+        size_t id = evaluator_id(evaluator, expression->data.identifier.name);
+        if (id >= evaluator->variable_count || !evaluator->state.assigned[id])
+        {
+            // The generated code would read whatever the stack slot holds.
+            evaluator->status = EVALUATION_STOPPED;
+            return 0;
+        }
+        return evaluator->state.values[id];
+    }
+
+    case NODE_BINARY_OP:
+    {
+        long long left = evaluator_expression(evaluator, expression->data.binary_op.left);
+        long long right = evaluator_expression(evaluator, expression->data.binary_op.right);
+        if (evaluator->status != EVALUATION_RUNNING)
+            return 0;
+
+        // A faulting division ends the program at run time instead.
+        if (expression->data.binary_op.operator== TOKEN_DIVIDE && optimizer_division_traps(left, right))
+        {
+            evaluator->status = EVALUATION_STOPPED;
+            return 0;
+        }
+        return optimizer_apply_operator(expression->data.binary_op.operator, left, right);
+    }
+
+    default:
+        evaluator->status = EVALUATION_STOPPED;
+        return 0;
+    }
+}
+
+static void evaluator_statement(Evaluator *evaluator, ASTNode *node)
+{
+    if (!node || !evaluator_spend(evaluator))
+        return;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count && evaluator->status == EVALUATION_RUNNING; i++)
+        {
+            evaluator_statement(evaluator, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        long long value = evaluator_expression(evaluator, node->data.assignment.value);
+        size_t id = evaluator_id(evaluator, node->data.assignment.name);
+        if (evaluator->status != EVALUATION_RUNNING || id >= evaluator->variable_count)
+        {
+            evaluator->status = EVALUATION_STOPPED;
+            return;
+        }
+
+        EvaluationState *state = &evaluator->state;
+        if (!state->assigned[id])
+        {
+            state->assigned[id] = 1;
+            state->order[state->order_count++] = (int)id;
+        }
+        state->values[id] = value;
+        break;
+    }
+
+    case NODE_IF:
+    {
+        long long condition = evaluator_expression(evaluator, node->data.if_stmt.condition);
+        if (evaluator->status == EVALUATION_RUNNING)
+            evaluator_statement(evaluator, condition ? node->data.if_stmt.if_body : node->data.if_stmt.else_body);
+        break;
+    }
+
+    case NODE_WHILE:
+        while (evaluator_expression(evaluator, node->data.while_loop.condition) &&
+               evaluator->status == EVALUATION_RUNNING)
+        {
+            evaluator_statement(evaluator, node->data.while_loop.body);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static const char *evaluator_name(Evaluator *evaluator, int id)
+{
+    Symbol *symbol = evaluator->optimizer->symbol_table->head;
+    for (; symbol; symbol = symbol->next)
+    {
+        if (symbol->id == id)
+            return symbol->name;
+    }
+    return NULL;
+}
+
+// Assignments that recreate `state`. Temporaries are only needed when code
+// that may read them follows.
+static void evaluator_materialize(Evaluator *evaluator, const EvaluationState *state, ASTNode *block,
+                                  int include_temporaries)
+{
+    for (size_t i = 0; i < state->order_count; i++)
+    {
+        int id = state->order[i];
+        const char *name = evaluator_name(evaluator, id);
+        if (!name || (name[0] == '.' && !include_temporaries))
+            continue;
+        ast_add_statement(block, ast_create_assignment(name, ast_create_integer(state->values[id])));
+    }
+}
+
+ASTNode *optimizer_evaluate_program(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node || node->type != NODE_PROGRAM || optimizer->options.eval_budget <= 0)
+        return node;
+
+    // Summarizing the program first gives every variable its symbol id.
+    optimizer_def_use(optimizer, node);
+
+    Evaluator evaluator;
+    evaluator.optimizer = optimizer;
+    evaluator.variable_count = (size_t)optimizer->symbol_table->symbol_count;
+    evaluator.budget = optimizer->options.eval_budget;
+    evaluator.status = EVALUATION_RUNNING;
+    evaluation_state_init(&evaluator.state, evaluator.variable_count);
+
+    // State after the last top-level statement that ran to completion.
+    EvaluationState completed_state;
+    evaluation_state_init(&completed_state, evaluator.variable_count);
+    size_t completed = 0;
+
+    size_t count = node->data.block.statement_count;
+    while (completed < count)
+    {
+        evaluator_statement(&evaluator, node->data.block.statements[completed]);
+        if (evaluator.status != EVALUATION_RUNNING)
+            break;
+        completed++;
+        evaluation_state_copy(&completed_state, &evaluator.state, evaluator.variable_count);
+    }
+
+    int finished = completed == count;
+    if (finished || (optimizer->options.eval_keep_prefix && completed > 0 && completed_state.order_count > 0))
+    {
+        ASTNode *replacement = ast_create_block();
+        evaluator_materialize(&evaluator, &completed_state, replacement, !finished);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i < completed)
+                ast_destroy_node(node->data.block.statements[i]);
+            else
+                ast_add_statement(replacement, node->data.block.statements[i]);
+        }
+
+        free(node->data.block.statements);
+        node->data.block.statements = replacement->data.block.statements;
+        node->data.block.statement_count = replacement->data.block.statement_count;
+        replacement->data.block.statements = NULL;
+        replacement->data.block.statement_count = 0;
+        ast_destroy_node(replacement);
+
+        dataflow_invalidate(node);
+        optimizer->changes_made++;
+    }
+
+    evaluation_state_free(&evaluator.state);
+    evaluation_state_free(&completed_state);
+    return node;
+}
@@ -0,0 +1,198 @@
+#include "instruction.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    const char *name;
+    int number;
+    int size;
+} RegisterName;
+
+static const RegisterName register_names[] = {
+    {"rax", 0, 8},   {"rcx", 1, 8},   {"rdx", 2, 8},   {"rbx", 3, 8},   {"rsp", 4, 8},   {"rbp", 5, 8},
+    {"rsi", 6, 8},   {"rdi", 7, 8},   {"r8", 8, 8},    {"r9", 9, 8},    {"r10", 10, 8},  {"r11", 11, 8},
+    {"r12", 12, 8},  {"r13", 13, 8},  {"r14", 14, 8},  {"r15", 15, 8},  {"eax", 0, 4},   {"ecx", 1, 4},
+    {"edx", 2, 4},   {"ebx", 3, 4},   {"esp", 4, 4},   {"ebp", 5, 4},   {"esi", 6, 4},   {"edi", 7, 4},
+    {"r8d", 8, 4},   {"r9d", 9, 4},   {"r10d", 10, 4}, {"r11d", 11, 4}, {"r12d", 12, 4}, {"r13d", 13, 4},
+    {"r14d", 14, 4}, {"r15d", 15, 4}, {"al", 0, 1},    {"cl", 1, 1},    {"dl", 2, 1},    {"bl", 3, 1},
+};
+
+static const char *instruction_skip_spaces(const char *text)
+{
+    while (*text == ' ' || *text == '\t')
+        text++;
+    return text;
+}
+
+static int instruction_lookup_register(const char *name, size_t length, Operand *operand)
+{
+    for (size_t i = 0; i < sizeof(register_names) / sizeof(register_names[0]); i++)
+    {
+        if (strlen(register_names[i].name) == length && strncmp(register_names[i].name, name, length) == 0)
+        {
+            operand->reg = register_names[i].number;
+            operand->size = register_names[i].size;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The table holds the 64-bit registers, then the 32-bit ones, then the four
+// byte registers, each in number order.
+const char *instruction_register_name(int reg, int size)
+{
+    if (reg < 0 || reg > 15)
+        return NULL;
+    if (size == 8)
+        return register_names[reg].name;
+    if (size == 4)
+        return register_names[16 + reg].name;
+    return size == 1 && reg < 4 ? register_names[32 + reg].name : NULL;
+}
+
+const char *instruction_size_name(int size)
+{
+    return size == 1 ? "BYTE" : size == 4 ? "DWORD" : size == 8 ? "QWORD" : NULL;
+}
+
+static size_t instruction_word_length(const char *text)
+{
+    size_t length = 0;
+    while (isalnum((unsigned char)text[length]) || text[length] == '_')
+        length++;
+    return length;
+}
+
+// Parses one operand and returns the text after it, or NULL.
+static const char *instruction_parse_operand(const char *text, Operand *operand)
+{
+    memset(operand, 0, sizeof(Operand));
+    text = instruction_skip_spaces(text);
+
+    int size = 0;
+    size_t length = instruction_word_length(text);
+    if (length == 4 && strncmp(text, "BYTE", 4) == 0)
+        size = 1;
+    else if (length == 5 && strncmp(text, "DWORD", 5) == 0)
+        size = 4;
+    else if (length == 5 && strncmp(text, "QWORD", 5) == 0)
+        size = 8;
+    if (size)
+    {
+        text = instruction_skip_spaces(text + length);
+        if (*text != '[')
+            return NULL;
+    }
+
+    if (*text == '[')
+    {
+        Operand base;
+        text = instruction_skip_spaces(text + 1);
+        length = instruction_word_length(text);
+        if (!instruction_lookup_register(text, length, &base) || base.size != 8)
+            return NULL;
+        text = instruction_skip_spaces(text + length);
+
+        long long displacement = 0;
+        if (*text == '+' || *text == '-')
+        {
+            char *end;
+            int negative = *text == '-';
+            displacement = strtoll(instruction_skip_spaces(text + 1), &end, 10);
+            if (negative)
+                displacement = -displacement;
+            text = instruction_skip_spaces(end);
+        }
+        if (*text != ']' || displacement < INT32_MIN || displacement > INT32_MAX)
+            return NULL;
+
+        operand->kind = OPERAND_MEMORY;
+        operand->reg = base.reg;
+        operand->size = size;
+        operand->value = displacement;
+        return text + 1;
+    }
+
+    if (isdigit((unsigned char)*text) || *text == '-')
+    {
+        char *end;
+        operand->kind = OPERAND_IMMEDIATE;
+        operand->value = strtoll(text, &end, 10);
+        return end == text ? NULL : end;
+    }
+
+    length = instruction_word_length(text);
+    if (!instruction_lookup_register(text, length, operand))
+        return NULL;
+    operand->kind = OPERAND_REGISTER;
+    return text + length;
+}
+
+int instruction_parse(const char *text, MachineInstruction *instruction)
+{
+    text = instruction_skip_spaces(text);
+    size_t length = instruction_word_length(text);
+    if (length == 0 || length >= sizeof(instruction->mnemonic))
+        return 0;
+    memcpy(instruction->mnemonic, text, length);
+    instruction->mnemonic[length] = '\0';
+    text = instruction_skip_spaces(text + length);
+
+    int count = 0;
+    while (*text && *text != ';')
+    {
+        if (count == INSTRUCTION_MAX_OPERANDS || (count > 0 && *text++ != ','))
+            return 0;
+        text = instruction_parse_operand(text, &instruction->operands[count++]);
+        if (!text)
+            return 0;
+        text = instruction_skip_spaces(text);
+    }
+    instruction->operand_count = count;
+    return 1;
+}
+
+int instruction_format(const MachineInstruction *instruction, char *text, size_t size)
+{
+    size_t used = (size_t)snprintf(text, size, "%s", instruction->mnemonic);
+    for (int i = 0; i < instruction->operand_count && used < size; i++)
+    {
+        const Operand *operand = &instruction->operands[i];
+        const char *separator = i ? ", " : " ";
+        switch (operand->kind)
+        {
+        case OPERAND_REGISTER:
+            used += (size_t)snprintf(text + used, size - used, "%s%s", separator,
+                                     instruction_register_name(operand->reg, operand->size));
+            break;
+        case OPERAND_IMMEDIATE:
+            used += (size_t)snprintf(text + used, size - used, "%s%lld", separator, operand->value);
+            break;
+        case OPERAND_MEMORY:
+        {
+            const char *size_name = instruction_size_name(operand->size);
+            used += (size_t)snprintf(text + used, size - used, "%s%s%s[%s%+lld]", separator,
+                                     size_name ? size_name : "", size_name ? " " : "",
+                                     instruction_register_name(operand->reg, 8), operand->value);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return used < size;
+}
+
+int instruction_same_location(const Operand *a, const Operand *b)
+{
+    if (a->kind != b->kind)
+        return 0;
+    if (a->kind == OPERAND_IMMEDIATE)
+        return a->value == b->value;
+    return a->reg == b->reg && (a->kind == OPERAND_REGISTER || a->value == b->value);
+}
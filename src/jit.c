@@ -0,0 +1,178 @@
+#include "jit.h"
+#include <setjmp.h>
+#include <stdint.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Reuses codegen's lowering and CFG, and encodes its instructions with the
+// assembler instead of printing them. The mapping is writable while the code
+// is copied in and executable afterwards, never both.
+
+static sigjmp_buf jit_fault;
+
+static void jit_fault_handler(int signal_number)
+{
+    (void)signal_number;
+    siglongjmp(jit_fault, 1);
+}
+
+static double jit_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// The function around the CFG: rbp is pointed past the caller's frame
+// buffer. The body saves and restores the callee-saved registers it
+// allocates (rbx, r12-r15) in that frame itself, so only rbp needs saving.
+static int jit_assemble(CodeGenerator *generator, Assembler *assembler, size_t frame_size)
+{
+    char prologue[64];
+    snprintf(prologue, sizeof(prologue), "lea rbp, [rdi+%zu]", frame_size);
+
+    return assembler_instruction(assembler, "push rbp") && assembler_instruction(assembler, prologue) &&
+           cfg_assemble(generator->cfg, assembler) && assembler_instruction(assembler, "pop rbp") &&
+           assembler_instruction(assembler, "ret") && assembler_resolve(assembler);
+}
+
+static unsigned char *jit_map(const Assembler *assembler, size_t *mapping_size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *mapping_size = (assembler->size + page - 1) / page * page;
+
+    void *memory = mmap(NULL, *mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    memcpy(memory, assembler->code, assembler->size);
+    if (mprotect(memory, *mapping_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        perror("mprotect");
+        munmap(memory, *mapping_size);
+        return NULL;
+    }
+    return (unsigned char *)memory;
+}
+
+JitProgram *jit_compile(ASTNode *program, SymbolTable *symbol_table, CodeGenOptions options)
+{
+    double start = jit_seconds();
+
+    CodeGenerator *generator = codegen_create(NULL, symbol_table);
+    codegen_set_options(generator, options);
+    codegen_lower(generator, program);
+
+    size_t frame_size = (size_t)generator->stack_offset;
+    Assembler assembler;
+    assembler_init(&assembler);
+    int assembled = jit_assemble(generator, &assembler, frame_size);
+
+    cfg_destroy(generator->cfg);
+    codegen_destroy(generator);
+    if (!assembled)
+    {
+        fprintf(stderr, "JIT: instruction outside the encodable subset\n");
+        assembler_free(&assembler);
+        return NULL;
+    }
+
+    size_t mapping_size;
+    unsigned char *code = jit_map(&assembler, &mapping_size);
+    size_t code_size = assembler.size;
+    assembler_free(&assembler);
+    if (!code)
+        return NULL;
+
+    JitProgram *jit = (JitProgram *)calloc(1, sizeof(JitProgram));
+    jit->code = code;
+    jit->code_size = code_size;
+    jit->mapping_size = mapping_size;
+    jit->frame_size = frame_size;
+    jit->frame = (unsigned char *)calloc(frame_size + 1, 1);
+    jit->symbol_table = symbol_table;
+    jit->compile_seconds = jit_seconds() - start;
+    return jit;
+}
+
+void jit_destroy(JitProgram *program)
+{
+    if (!program)
+        return;
+    munmap(program->code, program->mapping_size);
+    free(program->frame);
+    free(program);
+}
+
+JitStatus jit_execute(JitProgram *program)
+{
+    void (*entry)(unsigned char *);
+    memcpy(&entry, &program->code, sizeof(entry));
+    memset(program->frame, 0, program->frame_size);
+
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = jit_fault_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGFPE, &action, &previous);
+
+    JitStatus status = JIT_OK;
+    double start = jit_seconds();
+    if (sigsetjmp(jit_fault, 1) == 0)
+        entry(program->frame);
+    else
+        status = JIT_DIVISION_FAULT;
+    program->execute_seconds = jit_seconds() - start;
+
+    sigaction(SIGFPE, &previous, NULL);
+    return status;
+}
+
+int jit_variable(const JitProgram *program, const char *name, long long *value)
+{
+    Symbol *symbol = symbol_table_lookup(program->symbol_table, name);
+    if (!symbol || !symbol->stack_offset)
+        return 0;
+
+    const unsigned char *slot = program->frame + program->frame_size - symbol->stack_offset;
+    if (codegen_is_dword(symbol))
+    {
+        int32_t narrow;
+        memcpy(&narrow, slot, sizeof(narrow));
+        *value = narrow;
+    }
+    else
+    {
+        memcpy(value, slot, sizeof(*value));
+    }
+    return 1;
+}
+
+int jit_run(JitProgram *program, FILE *output)
+{
+    if (jit_execute(program) != JIT_OK)
+    {
+        fprintf(stderr, "Runtime error: division by zero or overflow\n");
+        return 1;
+    }
+
+    // A variable without a slot was removed by the optimizer and keeps its
+    // initial zero.
+    SymbolTable *symbol_table = program->symbol_table;
+    for (int i = 0; i < symbol_table->source_count; i++)
+    {
+        long long value;
+        if (!jit_variable(program, symbol_table->source_names[i], &value))
+            value = 0;
+        fprintf(output, "%s = %lld\n", symbol_table->source_names[i], value);
+    }
+
+    fprintf(stderr, "JIT: %zu bytes, compiled in %.3f ms, executed in %.3f ms\n", program->code_size,
+            program->compile_seconds * 1e3, program->execute_seconds * 1e3);
+    return 0;
+}
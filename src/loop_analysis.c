@@ -0,0 +1,403 @@
+#include "loop_analysis.h"
+#include <limits.h>
+
+static int loop_match_step(ASTNode *statement, long long *step)
+{
+    if (statement->type != NODE_ASSIGNMENT)
+        return 0;
+
+    const char *name = statement->data.assignment.name;
+    ASTNode *value = statement->data.assignment.value;
+    if (value->type != NODE_BINARY_OP)
+        return 0;
+
+    ASTNode *left = value->data.binary_op.left;
+    ASTNode *right = value->data.binary_op.right;
+
+    switch (value->data.binary_op.operator)
+    {
+    case TOKEN_PLUS:
+        if (left->type == NODE_IDENTIFIER && strcmp(left->data.identifier.name, name) == 0 &&
+            optimizer_is_constant(right))
+        {
+            *step = right->data.integer.value;
+            return 1;
+        }
+        if (right->type == NODE_IDENTIFIER && strcmp(right->data.identifier.name, name) == 0 &&
+            optimizer_is_constant(left))
+        {
+            *step = left->data.integer.value;
+            return 1;
+        }
+        return 0;
+
+    case TOKEN_MINUS:
+        if (left->type == NODE_IDENTIFIER && strcmp(left->data.identifier.name, name) == 0 &&
+            optimizer_is_constant(right))
+        {
+            *step = -(long long)right->data.integer.value;
+            return 1;
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+void loop_analyze(Optimizer *optimizer, ASTNode *loop, LoopInfo *info)
+{
+    // Work on a block body so statements can be addressed by index.
+    if (loop->data.while_loop.body->type != NODE_BLOCK)
+    {
+        ASTNode *block = ast_create_block();
+        ast_add_statement(block, loop->data.while_loop.body);
+        loop->data.while_loop.body = block;
+    }
+
+    info->loop = loop;
+    info->body = loop->data.while_loop.body;
+    info->ivs = NULL;
+    info->iv_count = 0;
+
+    for (size_t i = 0; i < info->body->data.block.statement_count; i++)
+    {
+        ASTNode *statement = info->body->data.block.statements[i];
+        long long step;
+        if (!loop_match_step(statement, &step) || step == 0)
+            continue;
+
+        const char *name = statement->data.assignment.name;
+        if (loop_count_assignments(info->body, name) != 1)
+            continue;
+
+        info->ivs = realloc(info->ivs, (info->iv_count + 1) * sizeof(InductionVariable));
+        InductionVariable *iv = &info->ivs[info->iv_count++];
+        iv->name = name;
+        iv->id = symbol_table_get_id(optimizer->symbol_table, name);
+        iv->step = step;
+        iv->update_index = i;
+    }
+}
+
+void loop_info_free(LoopInfo *info)
+{
+    free(info->ivs);
+    info->ivs = NULL;
+    info->iv_count = 0;
+}
+
+InductionVariable *loop_find_induction_variable(LoopInfo *info, ASTNode *expression)
+{
+    if (!expression || expression->type != NODE_IDENTIFIER)
+        return NULL;
+
+    for (size_t i = 0; i < info->iv_count; i++)
+    {
+        if (strcmp(info->ivs[i].name, expression->data.identifier.name) == 0)
+            return &info->ivs[i];
+    }
+    return NULL;
+}
+
+// Finds the constant the variable holds on entry to the loop at index
+// loop_index, looking back over straight-line assignments.
+int loop_entry_constant(ASTNode **statements, size_t loop_index, const char *name, long long *value)
+{
+    for (size_t i = loop_index; i > 0; i--)
+    {
+        ASTNode *statement = statements[i - 1];
+        if (statement->type != NODE_ASSIGNMENT)
+            return 0;
+        if (strcmp(statement->data.assignment.name, name) == 0)
+        {
+            if (!optimizer_is_constant(statement->data.assignment.value))
+                return 0;
+            *value = statement->data.assignment.value->data.integer.value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static TokenType loop_mirror_relation(TokenType relation)
+{
+    if (relation == TOKEN_LESS)
+        return TOKEN_GREATER;
+    if (relation == TOKEN_GREATER)
+        return TOKEN_LESS;
+    return relation;
+}
+
+// Smallest n with step * n == distance (mod 2^64): the iteration on which
+// `iv != bound` first fails. There is none when the low bits disagree.
+static int loop_solve_congruence(unsigned long long step, unsigned long long distance, unsigned long long *count)
+{
+    int shift = __builtin_ctzll(step);
+    if (distance & ((1ULL << shift) - 1))
+        return 0;
+
+    // Newton's iteration doubles the correct low bits of the inverse each
+    // step, starting from the three an odd number is its own inverse for.
+    unsigned long long odd = step >> shift;
+    unsigned long long inverse = odd;
+    for (int i = 0; i < 5; i++)
+    {
+        inverse *= 2 - odd * inverse;
+    }
+
+    *count = (distance >> shift) * inverse;
+    if (shift)
+        *count &= ~0ULL >> shift;
+    return 1;
+}
+
+static int loop_constant_trip_count(TokenType relation, long long start, long long step, long long limit,
+                                    unsigned long long *count)
+{
+    __int128 iterations;
+
+    switch (relation)
+    {
+    case TOKEN_LESS:
+        if (start >= limit)
+        {
+            *count = 0;
+            return 1;
+        }
+        if (step < 0)
+            return 0;
+        iterations = ((__int128)limit - start + step - 1) / step;
+        // A final value past INT64_MAX would wrap and keep the loop going.
+        if ((__int128)start + iterations * step > LLONG_MAX)
+            return 0;
+        *count = (unsigned long long)iterations;
+        return 1;
+
+    case TOKEN_GREATER:
+        if (start <= limit)
+        {
+            *count = 0;
+            return 1;
+        }
+        if (step > 0)
+            return 0;
+        iterations = ((__int128)start - limit - step - 1) / -(__int128)step;
+        if ((__int128)start + iterations * step < LLONG_MIN)
+            return 0;
+        *count = (unsigned long long)iterations;
+        return 1;
+
+    case TOKEN_EQUAL:
+        *count = start == limit;
+        return 1;
+
+    case TOKEN_NOT_EQUAL:
+        return loop_solve_congruence((unsigned long long)step,
+                                     (unsigned long long)limit - (unsigned long long)start, count);
+
+    default:
+        return 0;
+    }
+}
+
+int loop_trip_count(Optimizer *optimizer, LoopInfo *info, ASTNode **statements, size_t loop_index,
+                    TripCount *trip)
+{
+    ASTNode *condition = info->loop->data.while_loop.condition;
+    if (condition->type != NODE_BINARY_OP)
+        return 0;
+
+    TokenType relation = condition->data.binary_op.operator;
+    ASTNode *variable = condition->data.binary_op.left;
+    ASTNode *bound = condition->data.binary_op.right;
+    InductionVariable *iv = loop_find_induction_variable(info, variable);
+    if (!iv)
+    {
+        iv = loop_find_induction_variable(info, bound);
+        bound = variable;
+        relation = loop_mirror_relation(relation);
+    }
+    if (!iv)
+        return 0;
+
+    if (relation != TOKEN_LESS && relation != TOKEN_GREATER &&
+        relation != TOKEN_EQUAL && relation != TOKEN_NOT_EQUAL)
+        return 0;
+
+    BitSet bound_uses;
+    bitset_init(&bound_uses, 0);
+    dataflow_collect_uses(optimizer->symbol_table, bound, &bound_uses);
+    int invariant = !bitset_intersects(&bound_uses, &optimizer_def_use(optimizer, info->body)->defs);
+    bitset_free(&bound_uses);
+    if (!invariant)
+        return 0;
+
+    trip->iv = iv;
+    trip->count = NULL;
+    trip->guarded = 1;
+    trip->nonnegative = 0;
+
+    long long start;
+    int start_known = loop_entry_constant(statements, loop_index, iv->name, &start);
+    int limit_known = optimizer_is_constant(bound);
+    long long limit = limit_known ? bound->data.integer.value : 0;
+
+    if (start_known && limit_known)
+    {
+        unsigned long long count;
+        if (!loop_constant_trip_count(relation, start, iv->step, limit, &count))
+            return 0;
+        trip->count = ast_create_integer((long long)count);
+        trip->guarded = 0;
+        trip->nonnegative = count <= LLONG_MAX;
+        return 1;
+    }
+
+    // Otherwise only unit steps, which cannot skip past the bound.
+    if (relation == TOKEN_EQUAL)
+    {
+        trip->count = ast_create_integer(1);
+        trip->nonnegative = 1;
+    }
+    else if (iv->step == 1 && (relation == TOKEN_LESS || relation == TOKEN_NOT_EQUAL))
+    {
+        trip->count = ast_create_binary_op(TOKEN_MINUS, ast_clone(bound), ast_create_identifier(iv->name));
+        trip->nonnegative = relation == TOKEN_LESS &&
+                            ((start_known && start >= 0) || (limit_known && limit < 0));
+    }
+    else if (iv->step == -1 && (relation == TOKEN_GREATER || relation == TOKEN_NOT_EQUAL))
+    {
+        trip->count = ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(iv->name), ast_clone(bound));
+        trip->nonnegative = relation == TOKEN_GREATER &&
+                            ((limit_known && limit >= 0) || (start_known && start < 0));
+    }
+    return trip->count != NULL;
+}
+
+void trip_count_free(TripCount *trip)
+{
+    ast_destroy_node(trip->count);
+    trip->count = NULL;
+}
+
+int loop_count_assignments(ASTNode *node, const char *name)
+{
+    if (!node)
+        return 0;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        int count = 0;
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            count += loop_count_assignments(node->data.block.statements[i], name);
+        }
+        return count;
+    }
+    case NODE_IF:
+        return loop_count_assignments(node->data.if_stmt.if_body, name) +
+               loop_count_assignments(node->data.if_stmt.else_body, name);
+    case NODE_WHILE:
+        return loop_count_assignments(node->data.while_loop.body, name);
+    case NODE_ASSIGNMENT:
+        return strcmp(node->data.assignment.name, name) == 0;
+    default:
+        return 0;
+    }
+}
+
+int loop_contains_loop(ASTNode *node)
+{
+    if (!node)
+        return 0;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            if (loop_contains_loop(node->data.block.statements[i]))
+                return 1;
+        }
+        return 0;
+    case NODE_IF:
+        return loop_contains_loop(node->data.if_stmt.if_body) ||
+               loop_contains_loop(node->data.if_stmt.else_body);
+    case NODE_WHILE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int loop_uses_variable(Optimizer *optimizer, ASTNode *node, int id)
+{
+    const DefUse *summary = optimizer_def_use(optimizer, node);
+    return summary && bitset_test(&summary->uses, id);
+}
+
+// Applies `rewrite` to every loop, inner loops first, splicing block results
+// into the enclosing block. The rewriter sees the statements preceding the
+// loop so it can look for entry values.
+ASTNode *loop_rewrite(Optimizer *optimizer, ASTNode *node, LoopRewriter rewrite)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        int replaced = 0;
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *statement = loop_rewrite(optimizer, node->data.block.statements[i], rewrite);
+            node->data.block.statements[i] = statement;
+            if (statement->type == NODE_WHILE)
+            {
+                node->data.block.statements[i] = rewrite(optimizer, node->data.block.statements, i, statement);
+                replaced |= node->data.block.statements[i] != statement;
+            }
+        }
+
+        if (replaced)
+        {
+            ASTNode *rebuilt = ast_create_block();
+            for (size_t i = 0; i < node->data.block.statement_count; i++)
+            {
+                optimizer_append_flattened(rebuilt, node->data.block.statements[i]);
+            }
+            free(node->data.block.statements);
+            node->data.block.statements = rebuilt->data.block.statements;
+            node->data.block.statement_count = rebuilt->data.block.statement_count;
+            rebuilt->data.block.statements = NULL;
+            rebuilt->data.block.statement_count = 0;
+            ast_destroy_node(rebuilt);
+        }
+        break;
+    }
+
+    case NODE_IF:
+        node->data.if_stmt.if_body = loop_rewrite(optimizer, node->data.if_stmt.if_body, rewrite);
+        node->data.if_stmt.else_body = loop_rewrite(optimizer, node->data.if_stmt.else_body, rewrite);
+        break;
+
+    case NODE_WHILE:
+        node->data.while_loop.body = loop_rewrite(optimizer, node->data.while_loop.body, rewrite);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
@@ -0,0 +1,39 @@
+#include "loop_analysis.h"
+
+// A loop can go once it provably finishes, cannot fault, and nothing it
+// assigns is read before being overwritten. Inner loops are visited first,
+// so a nest empties from the inside out.
+static ASTNode *delete_loop(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop)
+{
+    if (optimizer_expression_may_trap(loop->data.while_loop.condition) ||
+        !optimizer_can_eliminate_code(loop->data.while_loop.body))
+        return loop;
+
+    LoopInfo info;
+    loop_analyze(optimizer, loop, &info);
+
+    TripCount trip;
+    int finite = loop_trip_count(optimizer, &info, statements, loop_index, &trip);
+    if (finite)
+        trip_count_free(&trip);
+    loop_info_free(&info);
+    if (!finite)
+        return loop;
+
+    BitSet live;
+    bitset_init(&live, 0);
+    optimizer_live_after(optimizer, loop, &live);
+    int dead = !bitset_intersects(&optimizer_def_use(optimizer, loop)->defs, &live);
+    bitset_free(&live);
+    if (!dead)
+        return loop;
+
+    ast_destroy_node(loop);
+    optimizer->changes_made++;
+    return ast_create_block();
+}
+
+ASTNode *optimizer_loop_deletion(Optimizer *optimizer, ASTNode *node)
+{
+    return loop_rewrite(optimizer, node, delete_loop);
+}
@@ -0,0 +1,257 @@
+#include "loop_analysis.h"
+
+typedef struct
+{
+    LoopInfo info;
+    InductionVariable *iv;
+    long long start;
+} FusionLoop;
+
+// Only innermost loops whose iteration space is known: a counter starting
+// from a constant, stepping by a constant and tested against an invariant
+// bound.
+static int fusion_analyze(Optimizer *optimizer, ASTNode **statements, size_t index, FusionLoop *loop)
+{
+    ASTNode *node = statements[index];
+    if (loop_contains_loop(node->data.while_loop.body))
+        return 0;
+
+    loop_analyze(optimizer, node, &loop->info);
+
+    TripCount trip;
+    if (!loop_trip_count(optimizer, &loop->info, statements, index, &trip))
+    {
+        loop_info_free(&loop->info);
+        return 0;
+    }
+    loop->iv = trip.iv;
+    trip_count_free(&trip);
+
+    if (!loop_entry_constant(statements, index, loop->iv->name, &loop->start))
+    {
+        loop_info_free(&loop->info);
+        return 0;
+    }
+    return 1;
+}
+
+// Compares two loop tests, treating each loop's counter as the same name.
+static int fusion_same_test(ASTNode *a, const char *a_iv, ASTNode *b, const char *b_iv)
+{
+    if (a->type == NODE_IDENTIFIER && b->type == NODE_IDENTIFIER)
+    {
+        int a_counter = strcmp(a->data.identifier.name, a_iv) == 0;
+        int b_counter = strcmp(b->data.identifier.name, b_iv) == 0;
+        if (a_counter || b_counter)
+            return a_counter && b_counter;
+    }
+
+    if (a->type == NODE_BINARY_OP && b->type == NODE_BINARY_OP)
+    {
+        return a->data.binary_op.operator == b->data.binary_op.operator &&
+               fusion_same_test(a->data.binary_op.left, a_iv, b->data.binary_op.left, b_iv) &&
+               fusion_same_test(a->data.binary_op.right, a_iv, b->data.binary_op.right, b_iv);
+    }
+
+    return ast_equal(a, b);
+}
+
+static int fusion_is_counter_setup(ASTNode *statement, FusionLoop *loop)
+{
+    return strcmp(statement->data.assignment.name, loop->iv->name) == 0;
+}
+
+// The statements between the loops move in front of the first one, so they
+// may neither read nor write anything it writes, nor write anything it reads.
+// When both loops share a counter its reset is dropped instead.
+static int fusion_can_hoist(Optimizer *optimizer, ASTNode *statement, const DefUse *first)
+{
+    const DefUse *summary = optimizer_def_use(optimizer, statement);
+    return !bitset_intersects(&summary->defs, &first->defs) && !bitset_intersects(&summary->defs, &first->uses) &&
+           !bitset_intersects(&summary->uses, &first->defs);
+}
+
+static int fusion_legal(Optimizer *optimizer, ASTNode **statements, size_t first, size_t second, FusionLoop *a,
+                        FusionLoop *b, int shared)
+{
+    if (a->iv->step != b->iv->step || a->start != b->start ||
+        !fusion_same_test(a->info.loop->data.while_loop.condition, a->iv->name,
+                          b->info.loop->data.while_loop.condition, b->iv->name))
+        return 0;
+
+    // A shared counter is stepped once, after both bodies.
+    if (shared && (a->iv->update_index + 1 != a->info.body->data.block.statement_count ||
+                   b->iv->update_index + 1 != b->info.body->data.block.statement_count))
+        return 0;
+
+    const DefUse *first_summary = optimizer_def_use(optimizer, a->info.loop);
+    const DefUse *second_summary = optimizer_def_use(optimizer, b->info.loop);
+
+    for (size_t i = first + 1; i < second; i++)
+    {
+        ASTNode *statement = statements[i];
+        if (shared && fusion_is_counter_setup(statement, a))
+        {
+            if (optimizer_expression_may_trap(statement->data.assignment.value))
+                return 0;
+        }
+        else if (!fusion_can_hoist(optimizer, statement, first_summary))
+        {
+            return 0;
+        }
+    }
+
+    // Fusing runs iteration k of the second body before iteration k + 1 of
+    // the first, so neither body may write a variable the other touches.
+    BitSet first_defs, second_defs;
+    bitset_init(&first_defs, 0);
+    bitset_init(&second_defs, 0);
+    bitset_copy(&first_defs, &first_summary->defs);
+    bitset_copy(&second_defs, &second_summary->defs);
+    if (shared)
+    {
+        bitset_reset(&first_defs, a->iv->id);
+        bitset_reset(&second_defs, b->iv->id);
+    }
+
+    int independent = !bitset_intersects(&first_defs, &second_summary->uses) &&
+                      !bitset_intersects(&first_defs, &second_defs) &&
+                      !bitset_intersects(&second_defs, &first_summary->uses);
+    bitset_free(&first_defs);
+    bitset_free(&second_defs);
+    return independent;
+}
+
+static ASTNode *fusion_merge(FusionLoop *a, FusionLoop *b, int shared)
+{
+    ASTNode *first_body = a->info.body;
+    ASTNode *second_body = b->info.body;
+    size_t first_count = first_body->data.block.statement_count - shared;
+    size_t second_count = second_body->data.block.statement_count - shared;
+
+    ASTNode *body = ast_create_block();
+    for (size_t i = 0; i < first_count; i++)
+    {
+        ast_add_statement(body, first_body->data.block.statements[i]);
+    }
+    for (size_t i = 0; i < second_count; i++)
+    {
+        ast_add_statement(body, second_body->data.block.statements[i]);
+    }
+    if (shared)
+    {
+        ast_add_statement(body, first_body->data.block.statements[first_count]);
+        ast_destroy_node(second_body->data.block.statements[second_count]);
+    }
+    first_body->data.block.statement_count = 0;
+    second_body->data.block.statement_count = 0;
+
+    ASTNode *loop = ast_create_while(a->info.loop->data.while_loop.condition, body);
+    a->info.loop->data.while_loop.condition = NULL;
+    ast_destroy_node(a->info.loop);
+    ast_destroy_node(b->info.loop);
+    return loop;
+}
+
+// Fuses the loops at `first` and `second`, which only straight-line
+// assignments separate, leaving the fused loop at `*fused_index`.
+static int fusion_fuse(Optimizer *optimizer, ASTNode *block, size_t first, size_t second, size_t *fused_index)
+{
+    ASTNode **statements = block->data.block.statements;
+
+    FusionLoop a, b;
+    if (!fusion_analyze(optimizer, statements, first, &a))
+        return 0;
+    if (!fusion_analyze(optimizer, statements, second, &b))
+    {
+        loop_info_free(&a.info);
+        return 0;
+    }
+
+    int shared = strcmp(a.iv->name, b.iv->name) == 0;
+    int fused = fusion_legal(optimizer, statements, first, second, &a, &b, shared);
+    if (fused)
+    {
+        size_t out = first;
+        for (size_t i = first + 1; i < second; i++)
+        {
+            if (shared && fusion_is_counter_setup(statements[i], &a))
+                ast_destroy_node(statements[i]);
+            else
+                statements[out++] = statements[i];
+        }
+
+        statements[out] = fusion_merge(&a, &b, shared);
+        size_t count = block->data.block.statement_count;
+        memmove(&statements[out + 1], &statements[second + 1], (count - second - 1) * sizeof(ASTNode *));
+        block->data.block.statement_count = count - (second - out);
+        *fused_index = out;
+    }
+
+    loop_info_free(&a.info);
+    loop_info_free(&b.info);
+    return fused;
+}
+
+static size_t fusion_next_loop(ASTNode *block, size_t index)
+{
+    for (size_t i = index + 1; i < block->data.block.statement_count; i++)
+    {
+        ASTNode *statement = block->data.block.statements[i];
+        if (statement->type == NODE_WHILE)
+            return i;
+        if (statement->type != NODE_ASSIGNMENT)
+            return 0;
+    }
+    return 0;
+}
+
+ASTNode *optimizer_loop_fusion(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            optimizer_loop_fusion(optimizer, node->data.block.statements[i]);
+        }
+
+        // A fused loop stays in place to be fused with the next one.
+        size_t i = 0;
+        while (i < node->data.block.statement_count)
+        {
+            size_t next = fusion_next_loop(node, i);
+            if (node->data.block.statements[i]->type == NODE_WHILE && next &&
+                fusion_fuse(optimizer, node, i, next, &i))
+            {
+                optimizer->changes_made++;
+                continue;
+            }
+            i++;
+        }
+        break;
+    }
+
+    case NODE_IF:
+        optimizer_loop_fusion(optimizer, node->data.if_stmt.if_body);
+        optimizer_loop_fusion(optimizer, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        optimizer_loop_fusion(optimizer, node->data.while_loop.body);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
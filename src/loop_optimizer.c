@@ -0,0 +1,594 @@
+#include <limits.h>
+#include "loop_analysis.h"
+
+typedef struct
+{
+    Optimizer *optimizer;
+    const BitSet *loop_defs;
+    ASTNode *preheader;
+    ASTNode *guarded;
+} LoopHoist;
+
+static int licm_visit_expression(LoopHoist *hoist, ASTNode **slot, ASTNode *trapping_target);
+
+static const char *licm_find_hoisted(ASTNode *block, ASTNode *expression)
+{
+    for (size_t i = 0; i < block->data.block.statement_count; i++)
+    {
+        ASTNode *assignment = block->data.block.statements[i];
+        if (ast_equal(assignment->data.assignment.value, expression))
+            return assignment->data.assignment.name;
+    }
+    return NULL;
+}
+
+static void licm_hoist(LoopHoist *hoist, ASTNode **slot, ASTNode *trapping_target)
+{
+    ASTNode *expression = *slot;
+    if (expression->type != NODE_BINARY_OP)
+        return;
+
+    int may_trap = optimizer_expression_may_trap(expression);
+    if (may_trap && !trapping_target)
+    {
+        // Not safe to evaluate early here; its invariant operands still are.
+        licm_hoist(hoist, &expression->data.binary_op.left, NULL);
+        licm_hoist(hoist, &expression->data.binary_op.right, NULL);
+        return;
+    }
+
+    const char *temporary = licm_find_hoisted(hoist->preheader, expression);
+    if (!temporary)
+        temporary = licm_find_hoisted(hoist->guarded, expression);
+
+    if (temporary)
+    {
+        ast_destroy_node(expression);
+    }
+    else
+    {
+        temporary = optimizer_new_temporary(hoist->optimizer);
+        ast_add_statement(may_trap ? trapping_target : hoist->preheader,
+                          ast_create_assignment(temporary, expression));
+    }
+
+    *slot = ast_create_identifier(temporary);
+    hoist->optimizer->changes_made++;
+}
+
+// Returns 1 when the whole expression is invariant, leaving it for the caller
+// so that only maximal invariant subtrees get their own temporary.
+static int licm_visit_expression(LoopHoist *hoist, ASTNode **slot, ASTNode *trapping_target)
+{
+    ASTNode *expression = *slot;
+    switch (expression->type)
+    {
+    case NODE_INTEGER:
+        return 1;
+
+    case NODE_IDENTIFIER:
+        return !bitset_test(hoist->loop_defs,
+                            symbol_table_get_id(hoist->optimizer->symbol_table, expression->data.identifier.name));
+
+    case NODE_BINARY_OP:
+    {
+        int left = licm_visit_expression(hoist, &expression->data.binary_op.left, trapping_target);
+        int right = licm_visit_expression(hoist, &expression->data.binary_op.right, trapping_target);
+        if (left && right)
+            return 1;
+
+        if (left)
+            licm_hoist(hoist, &expression->data.binary_op.left, trapping_target);
+        if (right)
+            licm_hoist(hoist, &expression->data.binary_op.right, trapping_target);
+        return 0;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+static void licm_expression(LoopHoist *hoist, ASTNode **slot, ASTNode *trapping_target)
+{
+    if (*slot && licm_visit_expression(hoist, slot, trapping_target))
+        licm_hoist(hoist, slot, trapping_target);
+}
+
+// trapping_target is where an expression that can fault may be moved: only
+// code that runs on every entry to the loop body qualifies.
+static void licm_statement(LoopHoist *hoist, ASTNode *node, ASTNode *trapping_target)
+{
+    if (!node)
+        return;
+
+    int changes_before = hoist->optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            licm_statement(hoist, node->data.block.statements[i], trapping_target);
+        }
+        break;
+
+    case NODE_IF:
+        licm_expression(hoist, &node->data.if_stmt.condition, trapping_target);
+        licm_statement(hoist, node->data.if_stmt.if_body, NULL);
+        licm_statement(hoist, node->data.if_stmt.else_body, NULL);
+        break;
+
+    case NODE_WHILE:
+        licm_expression(hoist, &node->data.while_loop.condition, trapping_target);
+        licm_statement(hoist, node->data.while_loop.body, NULL);
+        break;
+
+    case NODE_ASSIGNMENT:
+        licm_expression(hoist, &node->data.assignment.value, trapping_target);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(hoist->optimizer, node, changes_before);
+}
+
+static ASTNode *licm_hoist_loop(Optimizer *optimizer, ASTNode *loop)
+{
+    const DefUse *summary = optimizer_def_use(optimizer, loop);
+
+    LoopHoist hoist;
+    hoist.optimizer = optimizer;
+    hoist.loop_defs = &summary->defs;
+    hoist.preheader = ast_create_block();
+    hoist.guarded = ast_create_block();
+
+    // The condition is evaluated at least once whenever the loop is reached.
+    licm_expression(&hoist, &loop->data.while_loop.condition, hoist.preheader);
+    licm_statement(&hoist, loop->data.while_loop.body, hoist.guarded);
+
+    if (hoist.preheader->data.block.statement_count == 0 &&
+        hoist.guarded->data.block.statement_count == 0)
+    {
+        ast_destroy_node(hoist.preheader);
+        ast_destroy_node(hoist.guarded);
+        return loop;
+    }
+
+    dataflow_invalidate(loop);
+
+    if (hoist.guarded->data.block.statement_count == 0)
+    {
+        ast_destroy_node(hoist.guarded);
+        ast_add_statement(hoist.preheader, loop);
+        return hoist.preheader;
+    }
+
+    // Faulting expressions may only run if the loop would have run them, so
+    // they sit behind a copy of the entry test.
+    ast_add_statement(hoist.guarded, loop);
+    ast_add_statement(hoist.preheader,
+                      ast_create_if(ast_clone(loop->data.while_loop.condition), hoist.guarded, NULL));
+    return hoist.preheader;
+}
+
+ASTNode *optimizer_loop_invariant_code_motion(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        ASTNode *rebuilt = ast_create_block();
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *statement = node->data.block.statements[i];
+            ASTNode *result = optimizer_loop_invariant_code_motion(optimizer, statement);
+            if (result != statement)
+                optimizer_append_flattened(rebuilt, result);
+            else
+                ast_add_statement(rebuilt, result);
+        }
+        free(node->data.block.statements);
+        node->data.block.statements = rebuilt->data.block.statements;
+        node->data.block.statement_count = rebuilt->data.block.statement_count;
+        rebuilt->data.block.statements = NULL;
+        rebuilt->data.block.statement_count = 0;
+        ast_destroy_node(rebuilt);
+        break;
+    }
+
+    case NODE_IF:
+        node->data.if_stmt.if_body = optimizer_loop_invariant_code_motion(optimizer, node->data.if_stmt.if_body);
+        node->data.if_stmt.else_body = optimizer_loop_invariant_code_motion(optimizer, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        // Inner loops first, so their preheaders become candidates here.
+        node->data.while_loop.body = optimizer_loop_invariant_code_motion(optimizer, node->data.while_loop.body);
+        optimizer_note_rewrites(optimizer, node, changes_before);
+        return licm_hoist_loop(optimizer, node);
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
+
+typedef struct
+{
+    InductionVariable *iv;
+    long long factor;
+    const char *temporary;
+} ReducedProduct;
+
+typedef struct
+{
+    Optimizer *optimizer;
+    LoopInfo *info;
+    ReducedProduct *products;
+    size_t product_count;
+} StrengthReduction;
+
+static int iv_fits_int(long long value)
+{
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+// Matches iv * k, k * iv and iv << s for a basic induction variable iv.
+static InductionVariable *iv_match_product(LoopInfo *info, ASTNode *expression, long long *factor)
+{
+    if (expression->type != NODE_BINARY_OP)
+        return NULL;
+
+    ASTNode *left = expression->data.binary_op.left;
+    ASTNode *right = expression->data.binary_op.right;
+    InductionVariable *iv = NULL;
+
+    switch (expression->data.binary_op.operator)
+    {
+    case TOKEN_MULTIPLY:
+        if ((iv = loop_find_induction_variable(info, left)) && optimizer_is_constant(right))
+            *factor = right->data.integer.value;
+        else if ((iv = loop_find_induction_variable(info, right)) && optimizer_is_constant(left))
+            *factor = left->data.integer.value;
+        else
+            return NULL;
+        break;
+
+    case TOKEN_SHIFT_LEFT:
+        if ((iv = loop_find_induction_variable(info, left)) && optimizer_is_constant(right) &&
+            right->data.integer.value > 0 && right->data.integer.value < 31)
+            *factor = 1LL << right->data.integer.value;
+        else
+            return NULL;
+        break;
+
+    default:
+        return NULL;
+    }
+
+    if (*factor == 0 || *factor == 1 || !iv_fits_int(*factor) || !iv_fits_int(iv->step) ||
+        !iv_fits_int(iv->step * *factor))
+        return NULL;
+    return iv;
+}
+
+static const char *sr_temporary_for(StrengthReduction *sr, InductionVariable *iv, long long factor)
+{
+    for (size_t i = 0; i < sr->product_count; i++)
+    {
+        if (sr->products[i].iv == iv && sr->products[i].factor == factor)
+            return sr->products[i].temporary;
+    }
+
+    sr->products = realloc(sr->products, (sr->product_count + 1) * sizeof(ReducedProduct));
+    ReducedProduct *product = &sr->products[sr->product_count++];
+    product->iv = iv;
+    product->factor = factor;
+    product->temporary = optimizer_new_temporary(sr->optimizer);
+    return product->temporary;
+}
+
+static void sr_expression(StrengthReduction *sr, ASTNode **slot)
+{
+    ASTNode *expression = *slot;
+    if (!expression || expression->type != NODE_BINARY_OP)
+        return;
+
+    long long factor;
+    InductionVariable *iv = iv_match_product(sr->info, expression, &factor);
+    if (iv)
+    {
+        const char *temporary = sr_temporary_for(sr, iv, factor);
+        ast_destroy_node(expression);
+        *slot = ast_create_identifier(temporary);
+        sr->optimizer->changes_made++;
+        return;
+    }
+
+    sr_expression(sr, &expression->data.binary_op.left);
+    sr_expression(sr, &expression->data.binary_op.right);
+}
+
+static void sr_statement(StrengthReduction *sr, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    int changes_before = sr->optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            sr_statement(sr, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_IF:
+        sr_expression(sr, &node->data.if_stmt.condition);
+        sr_statement(sr, node->data.if_stmt.if_body);
+        sr_statement(sr, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        sr_expression(sr, &node->data.while_loop.condition);
+        sr_statement(sr, node->data.while_loop.body);
+        break;
+
+    case NODE_ASSIGNMENT:
+        sr_expression(sr, &node->data.assignment.value);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(sr->optimizer, node, changes_before);
+}
+
+// Linear function test replacement: once iv only feeds the exit test, test
+// the reduced product instead and drop iv's own update. Only done when the
+// entry value and bound are constants that prove the product never wraps.
+static InductionVariable *iv_replace_exit_test(StrengthReduction *sr, ASTNode **statements, size_t loop_index,
+                                               ASTNode *post)
+{
+    ASTNode *loop = sr->info->loop;
+    ASTNode *condition = loop->data.while_loop.condition;
+    if (condition->type != NODE_BINARY_OP)
+        return NULL;
+
+    TokenType relation = condition->data.binary_op.operator;
+    ASTNode *variable = condition->data.binary_op.left;
+    ASTNode *bound = condition->data.binary_op.right;
+    if (optimizer_is_constant(variable))
+    {
+        ASTNode *swap = variable;
+        variable = bound;
+        bound = swap;
+        if (relation == TOKEN_LESS)
+            relation = TOKEN_GREATER;
+        else if (relation == TOKEN_GREATER)
+            relation = TOKEN_LESS;
+    }
+
+    InductionVariable *iv = loop_find_induction_variable(sr->info, variable);
+    if (!iv || !optimizer_is_constant(bound))
+        return NULL;
+
+    ReducedProduct *product = NULL;
+    for (size_t i = 0; i < sr->product_count && !product; i++)
+    {
+        if (sr->products[i].iv == iv)
+            product = &sr->products[i];
+    }
+    if (!product)
+        return NULL;
+
+    ASTNode *body = sr->info->body;
+    for (size_t i = 0; i < body->data.block.statement_count; i++)
+    {
+        if (i != iv->update_index && loop_uses_variable(sr->optimizer, body->data.block.statements[i], iv->id))
+            return NULL;
+    }
+
+    long long start;
+    if (!loop_entry_constant(statements, loop_index, iv->name, &start))
+        return NULL;
+
+    long long limit = bound->data.integer.value;
+    if (!iv_fits_int(start) || !iv_fits_int(limit))
+        return NULL;
+
+    long long step = iv->step;
+    switch (relation)
+    {
+    case TOKEN_LESS:
+        if (step < 0 && start < limit)
+            return NULL;
+        break;
+    case TOKEN_GREATER:
+        if (step > 0 && start > limit)
+            return NULL;
+        break;
+    case TOKEN_NOT_EQUAL:
+        if ((limit - start) % step != 0 || (limit - start) / step < 0)
+            return NULL;
+        break;
+    default:
+        return NULL;
+    }
+
+    long long scaled_limit = limit * product->factor;
+    if (!iv_fits_int(scaled_limit))
+        return NULL;
+
+    if (product->factor < 0)
+    {
+        if (relation == TOKEN_LESS)
+            relation = TOKEN_GREATER;
+        else if (relation == TOKEN_GREATER)
+            relation = TOKEN_LESS;
+    }
+
+    BitSet live;
+    bitset_init(&live, 0);
+    optimizer_live_after(sr->optimizer, loop, &live);
+    int live_after = bitset_test(&live, iv->id);
+    bitset_free(&live);
+
+    ast_destroy_node(condition);
+    loop->data.while_loop.condition = ast_create_binary_op(relation,
+                                                          ast_create_identifier(product->temporary),
+                                                          ast_create_integer(scaled_limit));
+
+    // The product never wraps, so the division recovers iv exactly.
+    if (live_after)
+    {
+        ast_add_statement(post, ast_create_assignment(iv->name,
+                                                      ast_create_binary_op(TOKEN_DIVIDE,
+                                                                           ast_create_identifier(product->temporary),
+                                                                           ast_create_integer(product->factor))));
+    }
+    return iv;
+}
+
+static ASTNode *iv_reduce_loop(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop)
+{
+    LoopInfo info;
+    loop_analyze(optimizer, loop, &info);
+    if (info.iv_count == 0)
+    {
+        loop_info_free(&info);
+        return loop;
+    }
+
+    StrengthReduction sr;
+    sr.optimizer = optimizer;
+    sr.info = &info;
+    sr.products = NULL;
+    sr.product_count = 0;
+
+    sr_expression(&sr, &loop->data.while_loop.condition);
+    sr_statement(&sr, info.body);
+    if (sr.product_count == 0)
+    {
+        loop_info_free(&info);
+        return loop;
+    }
+
+    ASTNode *replacement = ast_create_block();
+    ASTNode *post = ast_create_block();
+    for (size_t i = 0; i < sr.product_count; i++)
+    {
+        ReducedProduct *product = &sr.products[i];
+        ast_add_statement(replacement,
+                          ast_create_assignment(product->temporary,
+                                                ast_create_binary_op(TOKEN_MULTIPLY,
+                                                                     ast_create_identifier(product->iv->name),
+                                                                     ast_create_integer(product->factor))));
+    }
+
+    InductionVariable *dropped = iv_replace_exit_test(&sr, statements, loop_index, post);
+
+    ASTNode *body = info.body;
+    ASTNode *rebuilt = ast_create_block();
+    for (size_t i = 0; i < body->data.block.statement_count; i++)
+    {
+        if (dropped && dropped->update_index == i)
+            ast_destroy_node(body->data.block.statements[i]);
+        else
+            ast_add_statement(rebuilt, body->data.block.statements[i]);
+
+        for (size_t j = 0; j < sr.product_count; j++)
+        {
+            ReducedProduct *product = &sr.products[j];
+            if (product->iv->update_index != i)
+                continue;
+            ast_add_statement(rebuilt,
+                              ast_create_assignment(product->temporary,
+                                                    ast_create_binary_op(TOKEN_PLUS,
+                                                                         ast_create_identifier(product->temporary),
+                                                                         ast_create_integer(product->iv->step * product->factor))));
+        }
+    }
+    body->data.block.statement_count = 0;
+    ast_destroy_node(body);
+    loop->data.while_loop.body = rebuilt;
+    dataflow_invalidate(loop);
+
+    ast_add_statement(replacement, loop);
+    optimizer_append_flattened(replacement, post);
+
+    free(sr.products);
+    loop_info_free(&info);
+    return replacement;
+}
+
+
+ASTNode *optimizer_induction_variables(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        ASTNode *rebuilt = ast_create_block();
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *statement = optimizer_induction_variables(optimizer, node->data.block.statements[i]);
+            node->data.block.statements[i] = statement;
+            if (statement->type == NODE_WHILE)
+            {
+                // Entry values are read from the statements already placed.
+                ASTNode *result = iv_reduce_loop(optimizer, rebuilt->data.block.statements,
+                                                 rebuilt->data.block.statement_count, statement);
+                if (result != statement)
+                {
+                    optimizer_append_flattened(rebuilt, result);
+                    continue;
+                }
+            }
+            ast_add_statement(rebuilt, statement);
+        }
+        free(node->data.block.statements);
+        node->data.block.statements = rebuilt->data.block.statements;
+        node->data.block.statement_count = rebuilt->data.block.statement_count;
+        rebuilt->data.block.statements = NULL;
+        rebuilt->data.block.statement_count = 0;
+        ast_destroy_node(rebuilt);
+        break;
+    }
+
+    case NODE_IF:
+        node->data.if_stmt.if_body = optimizer_induction_variables(optimizer, node->data.if_stmt.if_body);
+        node->data.if_stmt.else_body = optimizer_induction_variables(optimizer, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        node->data.while_loop.body = optimizer_induction_variables(optimizer, node->data.while_loop.body);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
\ No newline at end of file
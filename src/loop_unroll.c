@@ -0,0 +1,118 @@
+#include "loop_analysis.h"
+
+// Size limits are in AST nodes, as counted by ast_size.
+#define UNROLL_MAX_FACTOR 4
+#define UNROLL_SIZE_BUDGET 64
+#define UNROLL_FULL_MAX_TRIPS 16
+
+static void unroll_append_copies(ASTNode *block, ASTNode *body, unsigned long long copies)
+{
+    for (unsigned long long i = 0; i < copies; i++)
+    {
+        optimizer_append_flattened(block, ast_clone(body));
+    }
+}
+
+static int unroll_factor(Optimizer *optimizer, int size)
+{
+    if (optimizer->options.unroll_factor)
+        return optimizer->options.unroll_factor;
+
+    int factor = UNROLL_SIZE_BUDGET / size;
+    return factor > UNROLL_MAX_FACTOR ? UNROLL_MAX_FACTOR : factor;
+}
+
+static int unroll_fully(Optimizer *optimizer, TripCount *trip, int size, unsigned long long *count)
+{
+    if (!optimizer_is_constant(trip->count))
+        return 0;
+
+    *count = (unsigned long long)trip->count->data.integer.value;
+    unsigned long long max_trips =
+        optimizer->options.unroll_factor ? (unsigned long long)optimizer->options.unroll_factor : UNROLL_FULL_MAX_TRIPS;
+    return *count <= max_trips && *count * size <= OPTIMIZER_FULL_UNROLL_BUDGET;
+}
+
+// Innermost loops with a computable trip count are either replaced by that
+// many copies of the body, or run `factor` copies per iteration of a loop
+// counting down count / factor, with the leftover iterations after it.
+static ASTNode *unroll_loop(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop)
+{
+    if (optimizer->options.unroll_factor == 1 || loop_contains_loop(loop->data.while_loop.body))
+        return loop;
+
+    LoopInfo info;
+    loop_analyze(optimizer, loop, &info);
+
+    TripCount trip;
+    if (!loop_trip_count(optimizer, &info, statements, loop_index, &trip))
+    {
+        loop_info_free(&info);
+        return loop;
+    }
+
+    ASTNode *body = info.body;
+    int size = ast_size(body);
+    int factor = unroll_factor(optimizer, size);
+    unsigned long long count;
+    ASTNode *replacement = NULL;
+    int keeps_loop = 0;
+
+    if (unroll_fully(optimizer, &trip, size, &count))
+    {
+        replacement = ast_create_block();
+        unroll_append_copies(replacement, body, count);
+    }
+    // A constant count below the factor would leave nothing but remainder
+    // copies: a full unrolling past its budget.
+    else if (factor >= 2 && !(optimizer_is_constant(trip.count) && count < (unsigned long long)factor))
+    {
+        replacement = ast_create_block();
+        const char *counter = optimizer_new_temporary(optimizer);
+
+        // A count past INT64_MAX divides to a negative number and leaves
+        // every iteration to the remainder loop.
+        ast_add_statement(replacement,
+                          ast_create_assignment(counter,
+                                                ast_create_binary_op(TOKEN_DIVIDE, ast_clone(trip.count),
+                                                                     ast_create_integer(factor))));
+
+        ASTNode *unrolled = ast_create_block();
+        unroll_append_copies(unrolled, body, factor);
+        ast_add_statement(unrolled, ast_create_assignment(counter,
+                                                          ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(counter),
+                                                                               ast_create_integer(1))));
+        ast_add_statement(replacement,
+                          ast_create_while(ast_create_binary_op(TOKEN_GREATER, ast_create_identifier(counter),
+                                                                ast_create_integer(0)),
+                                           unrolled));
+
+        if (optimizer_is_constant(trip.count) && trip.count->data.integer.value >= 0)
+        {
+            unroll_append_copies(replacement, body, (unsigned long long)trip.count->data.integer.value % factor);
+        }
+        else
+        {
+            ast_add_statement(replacement, loop);
+            keeps_loop = 1;
+        }
+    }
+
+    if (replacement)
+    {
+        if (trip.guarded)
+            replacement = ast_create_if(ast_clone(loop->data.while_loop.condition), replacement, NULL);
+        if (!keeps_loop)
+            ast_destroy_node(loop);
+        optimizer->changes_made++;
+    }
+
+    trip_count_free(&trip);
+    loop_info_free(&info);
+    return replacement ? replacement : loop;
+}
+
+ASTNode *optimizer_loop_unrolling(Optimizer *optimizer, ASTNode *node)
+{
+    return loop_rewrite(optimizer, node, unroll_loop);
+}
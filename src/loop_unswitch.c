@@ -0,0 +1,139 @@
+#include "loop_analysis.h"
+
+// Size limits are in AST nodes, as counted by ast_size. A loop is only
+// unswitched while it tests at most UNSWITCH_MAX_CONDITIONS invariant
+// conditions, and each copy tests one fewer, so a loop grows into at most
+// 2^UNSWITCH_MAX_CONDITIONS specialized versions.
+#define UNSWITCH_MAX_LOOP_SIZE 120
+#define UNSWITCH_MAX_CONDITIONS 3
+
+typedef struct
+{
+    Optimizer *optimizer;
+    const BitSet *loop_defs;
+    ASTNode *conditions[UNSWITCH_MAX_CONDITIONS + 1];
+    size_t condition_count;
+} UnswitchCandidates;
+
+// A test can move in front of the loop when nothing in the loop changes its
+// value and evaluating it early cannot fault.
+static int unswitch_is_invariant(UnswitchCandidates *candidates, ASTNode *condition)
+{
+    if (optimizer_is_constant(condition) || optimizer_expression_may_trap(condition))
+        return 0;
+
+    BitSet uses;
+    bitset_init(&uses, 0);
+    dataflow_collect_uses(candidates->optimizer->symbol_table, condition, &uses);
+    int invariant = !bitset_intersects(&uses, candidates->loop_defs);
+    bitset_free(&uses);
+    return invariant;
+}
+
+static void unswitch_collect(UnswitchCandidates *candidates, ASTNode *node)
+{
+    if (!node || candidates->condition_count > UNSWITCH_MAX_CONDITIONS)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            unswitch_collect(candidates, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_IF:
+    {
+        ASTNode *condition = node->data.if_stmt.condition;
+        if (unswitch_is_invariant(candidates, condition))
+        {
+            size_t i = 0;
+            while (i < candidates->condition_count && !ast_equal(candidates->conditions[i], condition))
+            {
+                i++;
+            }
+            if (i == candidates->condition_count)
+                candidates->conditions[candidates->condition_count++] = condition;
+        }
+        unswitch_collect(candidates, node->data.if_stmt.if_body);
+        unswitch_collect(candidates, node->data.if_stmt.else_body);
+        break;
+    }
+
+    case NODE_WHILE:
+        unswitch_collect(candidates, node->data.while_loop.body);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Replaces every test of `condition` with its known outcome; constant
+// folding and dead code elimination then drop the untaken branches.
+static void unswitch_specialize(ASTNode *node, ASTNode *condition, long long value)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            unswitch_specialize(node->data.block.statements[i], condition, value);
+        }
+        break;
+
+    case NODE_IF:
+        if (ast_equal(node->data.if_stmt.condition, condition))
+        {
+            ast_destroy_node(node->data.if_stmt.condition);
+            node->data.if_stmt.condition = ast_create_integer(value);
+        }
+        unswitch_specialize(node->data.if_stmt.if_body, condition, value);
+        unswitch_specialize(node->data.if_stmt.else_body, condition, value);
+        break;
+
+    case NODE_WHILE:
+        unswitch_specialize(node->data.while_loop.body, condition, value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static ASTNode *unswitch_loop(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop)
+{
+    (void)statements;
+    (void)loop_index;
+
+    if (ast_size(loop) > UNSWITCH_MAX_LOOP_SIZE)
+        return loop;
+
+    UnswitchCandidates candidates;
+    candidates.optimizer = optimizer;
+    candidates.loop_defs = &optimizer_def_use(optimizer, loop)->defs;
+    candidates.condition_count = 0;
+    unswitch_collect(&candidates, loop->data.while_loop.body);
+    if (candidates.condition_count == 0 || candidates.condition_count > UNSWITCH_MAX_CONDITIONS)
+        return loop;
+
+    ASTNode *condition = ast_clone(candidates.conditions[0]);
+    ASTNode *taken = ast_clone(loop);
+    ASTNode *not_taken = ast_clone(loop);
+    unswitch_specialize(taken->data.while_loop.body, condition, 1);
+    unswitch_specialize(not_taken->data.while_loop.body, condition, 0);
+
+    ast_destroy_node(loop);
+    optimizer->changes_made++;
+    return ast_create_if(condition, taken, not_taken);
+}
+
+ASTNode *optimizer_loop_unswitching(Optimizer *optimizer, ASTNode *node)
+{
+    return loop_rewrite(optimizer, node, unswitch_loop);
+}
@@ -6,7 +6,11 @@
 #include "ast.h"
 #include "symbol_table.h"
 #include "optimizer.h"
+#include "pass_manager.h"
 #include "codegen.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "jit.h"
 
 char *read_file(const char *filename)
 {
@@ -66,7 +70,34 @@ void print_tokens(const char *source)
     lexer_destroy(debug_lexer);
 }
 
-int compile_file(const char *input_filename, const char *output_filename)
+// -O3 lets the compile-time evaluator run unless a budget was given.
+#define O3_EVAL_BUDGET 1000000
+
+typedef enum
+{
+    MODE_ASSEMBLY, // write NASM text, or an ELF object when the output ends in .o
+    MODE_RUN,      // execute in the bytecode VM
+    MODE_JIT       // execute machine code compiled in-process
+} CompileMode;
+
+typedef struct
+{
+    OptimizerOptions options;
+    int level;
+    const char *passes; // replaces the level's pipeline when set
+    int pass_stats;
+    int emit_stats; // time the assembly text writer
+    int peephole_stats;
+    CompileMode mode;
+} CompileOptions;
+
+static int is_object_filename(const char *filename)
+{
+    size_t length = strlen(filename);
+    return length > 2 && strcmp(filename + length - 2, ".o") == 0;
+}
+
+int compile_file(const char *input_filename, const char *output_filename, const CompileOptions *compile_options)
 {
     char *source = read_file(input_filename);
     if (!source)
@@ -75,11 +106,14 @@ int compile_file(const char *input_filename, const char *output_filename)
         return 1;
     }
 
-    // Debug: Print file contents and tokens
-    print_tokens(source);
+    // Debug: Print file contents and tokens. --run and --jit keep stdout for
+    // the program's variables.
+    if (compile_options->mode == MODE_ASSEMBLY)
+        print_tokens(source);
 
-    FILE *output_file = fopen(output_filename, "w");
-    if (!output_file)
+    FILE *output_file = NULL;
+    int object = compile_options->mode == MODE_ASSEMBLY && is_object_filename(output_filename);
+    if (compile_options->mode == MODE_ASSEMBLY && !(output_file = fopen(output_filename, object ? "wb" : "w")))
     {
         free(source);
         perror("Error opening output file");
@@ -90,9 +124,21 @@ int compile_file(const char *input_filename, const char *output_filename)
     Parser *parser = parser_create(lexer);
     SymbolTable *symbol_table = symbol_table_create();
     Optimizer *optimizer = optimizer_create(symbol_table);
+    optimizer_set_options(optimizer, compile_options->options);
+    pass_manager_set_level(optimizer->pass_manager, compile_options->level);
+    optimizer->pass_manager->collect_stats = compile_options->pass_stats;
     CodeGenerator *generator = codegen_create(output_file, symbol_table);
+    generator->options.simplify_cfg = compile_options->level > 0;
+    generator->options.optimize_registers = compile_options->level > 0;
+    generator->options.peephole = compile_options->level > 0;
+    if (object)
+        generator->options.assembler = ASM_OBJECT;
+
+    ASTNode *ast = NULL;
+    if (compile_options->passes && !pass_manager_set_pipeline(optimizer->pass_manager, compile_options->passes))
+        goto cleanup;
 
-    ASTNode *ast = parser_parse_program(parser);
+    ast = parser_parse_program(parser);
     if (!ast)
     {
         fprintf(stderr, "Parsing failed\n");
@@ -100,11 +146,39 @@ int compile_file(const char *input_filename, const char *output_filename)
     }
 
     ast = optimizer_optimize(optimizer, ast);
-    if (!codegen_generate(generator, ast))
+    if (compile_options->level > 0)
+        optimizer_infer_widths(optimizer, ast);
+    if (compile_options->pass_stats)
+        pass_manager_print_stats(optimizer->pass_manager, stderr);
+    if (compile_options->mode == MODE_RUN)
+    {
+        Bytecode *bytecode = bytecode_compile(ast, symbol_table);
+        int failed = vm_run(bytecode, symbol_table, stdout);
+        bytecode_destroy(bytecode);
+        if (failed)
+            goto cleanup;
+    }
+    else if (compile_options->mode == MODE_JIT)
+    {
+        JitProgram *program = jit_compile(ast, symbol_table, generator->options);
+        int failed = !program || jit_run(program, stdout);
+        jit_destroy(program);
+        if (failed)
+            goto cleanup;
+    }
+    else if (!codegen_generate(generator, ast))
     {
         fprintf(stderr, "Code generation failed\n");
         goto cleanup;
     }
+    else
+    {
+        if (compile_options->peephole_stats)
+            peephole_print_stats(&generator->peephole, stderr);
+        if (compile_options->emit_stats && !object)
+            fprintf(stderr, "Emitted %zu bytes of assembly in %.3f ms (%.1f MB/s)\n", generator->emitted_bytes,
+                    generator->emit_seconds * 1e3, generator->emitted_bytes / 1e6 / generator->emit_seconds);
+    }
 
     ast_destroy_node(ast);
     codegen_destroy(generator);
@@ -112,7 +186,8 @@ int compile_file(const char *input_filename, const char *output_filename)
     symbol_table_destroy(symbol_table);
     parser_destroy(parser);
     lexer_destroy(lexer);
-    fclose(output_file);
+    if (output_file)
+        fclose(output_file);
     free(source);
 
     return 0;
@@ -125,18 +200,120 @@ cleanup:
     symbol_table_destroy(symbol_table);
     parser_destroy(parser);
     lexer_destroy(lexer);
-    fclose(output_file);
+    if (output_file)
+        fclose(output_file);
     free(source);
     return 1;
 }
 
+static void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [-O0|-O1|-O2|-O3] [--passes=NAME,...] [--pass-stats] [--peephole-stats] [--emit-stats] [--unroll=N] "
+            "[--eval-budget=N [--eval-keep-prefix]] <input.sl> <output.asm|output.o>\n"
+            "       %s [options] --run|--jit <input.sl>\n"
+            "  --unroll=N  run N copies of a counted innermost loop's body per iteration, 1 disables\n"
+            "              unrolling; a loop of at most N iterations is replaced by its copies when\n"
+            "              they total at most %d AST nodes\n",
+            program, program, OPTIMIZER_FULL_UNROLL_BUDGET);
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    CompileOptions compile_options;
+    compile_options.options = optimizer_default_options();
+    compile_options.level = OPTIMIZER_DEFAULT_LEVEL;
+    compile_options.passes = NULL;
+    compile_options.pass_stats = 0;
+    compile_options.emit_stats = 0;
+    compile_options.peephole_stats = 0;
+    compile_options.mode = MODE_ASSEMBLY;
+    OptimizerOptions *options = &compile_options.options;
+    const char *filenames[2];
+    int filename_count = 0;
+
+    for (int i = 1; i < argc; i++)
     {
-        fprintf(stderr, "Usage: %s <input.sl> <output.asm>\n", argv[0]);
+        if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '0' + OPTIMIZER_MAX_LEVEL &&
+            !argv[i][3])
+        {
+            compile_options.level = argv[i][2] - '0';
+        }
+        else if (strncmp(argv[i], "--passes=", 9) == 0)
+        {
+            compile_options.passes = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--pass-stats") == 0)
+        {
+            compile_options.pass_stats = 1;
+        }
+        else if (strcmp(argv[i], "--emit-stats") == 0)
+        {
+            compile_options.emit_stats = 1;
+        }
+        else if (strcmp(argv[i], "--peephole-stats") == 0)
+        {
+            compile_options.peephole_stats = 1;
+        }
+        else if (strcmp(argv[i], "--run") == 0)
+        {
+            compile_options.mode = MODE_RUN;
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            compile_options.mode = MODE_JIT;
+        }
+        else if (strncmp(argv[i], "--unroll=", 9) == 0)
+        {
+            char *end;
+            long factor = strtol(argv[i] + 9, &end, 10);
+            if (end == argv[i] + 9 || *end || factor < 1 || factor > 64)
+            {
+                fprintf(stderr, "Invalid unroll factor: %s\n", argv[i] + 9);
+                return 1;
+            }
+            options->unroll_factor = (int)factor;
+        }
+        else if (strncmp(argv[i], "--eval-budget=", 14) == 0)
+        {
+            char *end;
+            long long budget = strtoll(argv[i] + 14, &end, 10);
+            if (end == argv[i] + 14 || *end || budget < 1)
+            {
+                fprintf(stderr, "Invalid evaluation budget: %s\n", argv[i] + 14);
+                return 1;
+            }
+            options->eval_budget = budget;
+        }
+        else if (strcmp(argv[i], "--eval-keep-prefix") == 0)
+        {
+            options->eval_keep_prefix = 1;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+        else if (filename_count < 2)
+        {
+            filenames[filename_count++] = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (filename_count != (compile_options.mode == MODE_ASSEMBLY ? 2 : 1))
+    {
+        print_usage(argv[0]);
         return 1;
     }
 
-    return compile_file(argv[1], argv[2]);
-}
\ No newline at end of file
+    if (compile_options.level == 3 && !options->eval_budget)
+        options->eval_budget = O3_EVAL_BUDGET;
+
+    return compile_file(filenames[0], compile_options.mode == MODE_ASSEMBLY ? filenames[1] : NULL, &compile_options);
+}
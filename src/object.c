@@ -0,0 +1,117 @@
+#include "object.h"
+#include <elf.h>
+#include <string.h>
+
+// Section layout, in file order after the header: .text, then the symbol
+// and string tables, then the section headers. .note.GNU-stack is empty and
+// only tells the linker the stack need not be executable.
+
+enum
+{
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_NOTE_STACK,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_COUNT
+};
+
+static const char section_names[] = "\0.text\0.note.GNU-stack\0.symtab\0.strtab\0.shstrtab";
+
+// Offsets of each name within section_names.
+static const Elf64_Word section_name_offsets[SECTION_COUNT] = {0, 1, 7, 23, 31, 39};
+
+static size_t object_align(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static int object_pad(FILE *output, size_t *offset, size_t alignment)
+{
+    static const unsigned char zeros[16];
+    size_t padding = object_align(*offset, alignment) - *offset;
+    *offset += padding;
+    return fwrite(zeros, 1, padding, output) == padding;
+}
+
+int object_write_elf(FILE *output, const unsigned char *code, size_t size, const char *symbol)
+{
+    size_t symbol_length = strlen(symbol);
+    size_t string_table_size = symbol_length + 2;
+
+    size_t text_offset = object_align(sizeof(Elf64_Ehdr), 16);
+    size_t symtab_offset = object_align(text_offset + size, 8);
+    size_t strtab_offset = symtab_offset + 2 * sizeof(Elf64_Sym);
+    size_t shstrtab_offset = strtab_offset + string_table_size;
+    size_t headers_offset = object_align(shstrtab_offset + sizeof(section_names), 8);
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = headers_offset;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SECTION_COUNT;
+    header.e_shstrndx = SECTION_SHSTRTAB;
+
+    // The null symbol, then `symbol` itself: the first and only global.
+    Elf64_Sym symbols[2];
+    memset(symbols, 0, sizeof(symbols));
+    symbols[1].st_name = 1;
+    symbols[1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    symbols[1].st_shndx = SECTION_TEXT;
+    symbols[1].st_size = size;
+
+    Elf64_Shdr sections[SECTION_COUNT];
+    memset(sections, 0, sizeof(sections));
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        sections[i].sh_name = section_name_offsets[i];
+        sections[i].sh_addralign = 1;
+    }
+    sections[SECTION_NULL].sh_addralign = 0;
+
+    sections[SECTION_TEXT].sh_type = SHT_PROGBITS;
+    sections[SECTION_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[SECTION_TEXT].sh_offset = text_offset;
+    sections[SECTION_TEXT].sh_size = size;
+    sections[SECTION_TEXT].sh_addralign = 16;
+
+    sections[SECTION_NOTE_STACK].sh_type = SHT_PROGBITS;
+    sections[SECTION_NOTE_STACK].sh_offset = symtab_offset;
+
+    sections[SECTION_SYMTAB].sh_type = SHT_SYMTAB;
+    sections[SECTION_SYMTAB].sh_offset = symtab_offset;
+    sections[SECTION_SYMTAB].sh_size = sizeof(symbols);
+    sections[SECTION_SYMTAB].sh_link = SECTION_STRTAB;
+    sections[SECTION_SYMTAB].sh_info = 1;
+    sections[SECTION_SYMTAB].sh_addralign = 8;
+    sections[SECTION_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+    sections[SECTION_STRTAB].sh_type = SHT_STRTAB;
+    sections[SECTION_STRTAB].sh_offset = strtab_offset;
+    sections[SECTION_STRTAB].sh_size = string_table_size;
+
+    sections[SECTION_SHSTRTAB].sh_type = SHT_STRTAB;
+    sections[SECTION_SHSTRTAB].sh_offset = shstrtab_offset;
+    sections[SECTION_SHSTRTAB].sh_size = sizeof(section_names);
+
+    size_t offset = sizeof(header);
+    int written = fwrite(&header, sizeof(header), 1, output) == 1 && object_pad(output, &offset, 16) &&
+                  fwrite(code, 1, size, output) == size;
+    offset += size;
+    written = written && object_pad(output, &offset, 8) && fwrite(symbols, sizeof(symbols), 1, output) == 1 &&
+              fputc('\0', output) != EOF && fwrite(symbol, 1, symbol_length + 1, output) == symbol_length + 1 &&
+              fwrite(section_names, sizeof(section_names), 1, output) == 1;
+    offset = shstrtab_offset + sizeof(section_names);
+    written = written && object_pad(output, &offset, 8) && fwrite(sections, sizeof(sections), 1, output) == 1;
+    return written;
+}
@@ -1,18 +1,32 @@
 #include "optimizer.h"
+#include "pass_manager.h"
+#include <limits.h>
+
+OptimizerOptions optimizer_default_options(void)
+{
+    OptimizerOptions options;
+    options.unroll_factor = 0;
+    options.eval_budget = 0;
+    options.eval_keep_prefix = 0;
+    return options;
+}
 
 Optimizer *optimizer_create(SymbolTable *symbol_table)
 {
     Optimizer *optimizer = (Optimizer *)malloc(sizeof(Optimizer));
     optimizer->symbol_table = symbol_table;
+    optimizer->program = NULL;
     optimizer->changes_made = 0;
-    optimizer->options.constant_folding_enabled = 1;
-    optimizer->options.dead_code_elimination_enabled = 1;
-    optimizer->options.strength_reduction_enabled = 1;
+    optimizer->temporary_count = 0;
+    optimizer->options = optimizer_default_options();
+    optimizer->pass_manager = pass_manager_create();
+    pass_manager_set_level(optimizer->pass_manager, OPTIMIZER_DEFAULT_LEVEL);
     return optimizer;
 }
 
 void optimizer_destroy(Optimizer *optimizer)
 {
+    pass_manager_destroy(optimizer->pass_manager);
     free(optimizer);
 }
 
@@ -21,32 +35,51 @@ void optimizer_set_options(Optimizer *optimizer, OptimizerOptions options)
     optimizer->options = options;
 }
 
-ASTNode *optimizer_optimize(Optimizer *optimizer, ASTNode *ast)
+const DefUse *optimizer_def_use(Optimizer *optimizer, ASTNode *node)
 {
-    if (!ast)
-        return NULL;
+    return dataflow_def_use(optimizer->symbol_table, node);
+}
 
-    do
+void optimizer_note_rewrites(Optimizer *optimizer, ASTNode *node, int changes_before)
+{
+    // Anything rewritten below this node makes its cached summary stale.
+    if (optimizer->changes_made != changes_before)
     {
-        optimizer->changes_made = 0;
+        dataflow_invalidate(node);
+    }
+}
 
-        if (optimizer->options.constant_folding_enabled)
-        {
-            ast = optimizer_constant_folding(optimizer, ast);
-        }
+void optimizer_live_after(Optimizer *optimizer, ASTNode *statement, BitSet *live)
+{
+    // Every source variable is part of the program's observable final state;
+    // compiler temporaries are not.
+    optimizer_def_use(optimizer, optimizer->program);
 
-        if (optimizer->options.dead_code_elimination_enabled)
-        {
-            ast = optimizer_dead_code_elimination(optimizer, ast);
-        }
+    BitSet exit_live;
+    bitset_init(&exit_live, optimizer->symbol_table->symbol_count);
+    for (Symbol *symbol = optimizer->symbol_table->head; symbol; symbol = symbol->next)
+    {
+        if (symbol->name[0] != '.')
+            bitset_set(&exit_live, symbol->id);
+    }
 
-        if (optimizer->options.strength_reduction_enabled)
-        {
-            ast = optimizer_strength_reduction(optimizer, ast);
-        }
-    } while (optimizer->changes_made);
+    dataflow_live_after(optimizer->symbol_table, optimizer->program, statement, &exit_live, live);
+    bitset_free(&exit_live);
+}
+
+static void optimizer_note_source(const char *name, void *context)
+{
+    symbol_table_note_source((SymbolTable *)context, name);
+}
 
-    return ast;
+ASTNode *optimizer_optimize(Optimizer *optimizer, ASTNode *ast)
+{
+    if (!ast)
+        return NULL;
+    // --run and --jit print every source variable, even one whose every use
+    // a pass deletes.
+    ast_visit_variables(ast, optimizer_note_source, optimizer->symbol_table);
+    return pass_manager_run(optimizer->pass_manager, optimizer, ast);
 }
 
 ASTNode *optimizer_constant_folding(Optimizer *optimizer, ASTNode *node)
@@ -54,6 +87,8 @@ ASTNode *optimizer_constant_folding(Optimizer *optimizer, ASTNode *node)
     if (!node)
         return NULL;
 
+    int changes_before = optimizer->changes_made;
+
     switch (node->type)
     {
     case NODE_PROGRAM:
@@ -89,10 +124,16 @@ ASTNode *optimizer_constant_folding(Optimizer *optimizer, ASTNode *node)
         if (optimizer_is_constant(node->data.binary_op.left) &&
             optimizer_is_constant(node->data.binary_op.right))
         {
-            int result = optimizer_evaluate_constant_expression(node);
+            // A faulting division is left for the program to raise at runtime.
+            if (node->data.binary_op.operator== TOKEN_DIVIDE &&
+                optimizer_division_traps(node->data.binary_op.left->data.integer.value,
+                                         node->data.binary_op.right->data.integer.value))
+                break;
+
+            long long result = optimizer_evaluate_constant_expression(node);
             ASTNode *constant_node = ast_create_integer(result);
             ast_destroy_node(node);
-            optimizer->changes_made = 1;
+            optimizer->changes_made++;
             return constant_node;
         }
         break;
@@ -101,6 +142,7 @@ ASTNode *optimizer_constant_folding(Optimizer *optimizer, ASTNode *node)
         break;
     }
 
+    optimizer_note_rewrites(optimizer, node, changes_before);
     return node;
 }
 
@@ -109,6 +151,8 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
     if (!node)
         return NULL;
 
+    int changes_before = optimizer->changes_made;
+
     switch (node->type)
     {
     case NODE_PROGRAM:
@@ -124,7 +168,7 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
             }
             else
             {
-                optimizer->changes_made = 1;
+                optimizer->changes_made++;
             }
         }
         node->data.block.statement_count = new_count;
@@ -134,7 +178,7 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
     case NODE_IF:
         if (optimizer_is_constant(node->data.if_stmt.condition))
         {
-            int condition_value = optimizer_evaluate_constant_expression(node->data.if_stmt.condition);
+            long long condition_value = optimizer_evaluate_constant_expression(node->data.if_stmt.condition);
             ASTNode *result = condition_value ? node->data.if_stmt.if_body : node->data.if_stmt.else_body;
 
             if (condition_value)
@@ -147,7 +191,7 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
             }
 
             ast_destroy_node(node);
-            optimizer->changes_made = 1;
+            optimizer->changes_made++;
             return result;
         }
 
@@ -162,11 +206,11 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
     case NODE_WHILE:
         if (optimizer_is_constant(node->data.while_loop.condition))
         {
-            int condition_value = optimizer_evaluate_constant_expression(node->data.while_loop.condition);
+            long long condition_value = optimizer_evaluate_constant_expression(node->data.while_loop.condition);
             if (!condition_value)
             {
                 ast_destroy_node(node);
-                optimizer->changes_made = 1;
+                optimizer->changes_made++;
                 return NULL;
             }
         }
@@ -188,6 +232,7 @@ ASTNode *optimizer_dead_code_elimination(Optimizer *optimizer, ASTNode *node)
         break;
     }
 
+    optimizer_note_rewrites(optimizer, node, changes_before);
     return node;
 }
 
@@ -196,13 +241,15 @@ ASTNode *optimizer_strength_reduction(Optimizer *optimizer, ASTNode *node)
     if (!node)
         return NULL;
 
+    int changes_before = optimizer->changes_made;
+
     if (node->type == NODE_BINARY_OP)
     {
         if (node->data.binary_op.operator== TOKEN_MULTIPLY &&
             optimizer_is_constant(node->data.binary_op.right))
         {
-            int value = node->data.binary_op.right->data.integer.value;
-            if ((value & (value - 1)) == 0)
+            long long value = node->data.binary_op.right->data.integer.value;
+            if (value > 0 && (value & (value - 1)) == 0)
             {
                 int shift = 0;
                 while (value > 1)
@@ -214,7 +261,7 @@ ASTNode *optimizer_strength_reduction(Optimizer *optimizer, ASTNode *node)
                 node->data.binary_op.operator= TOKEN_SHIFT_LEFT;
                 ast_destroy_node(node->data.binary_op.right);
                 node->data.binary_op.right = shift_amount;
-                optimizer->changes_made = 1;
+                optimizer->changes_made++;
             }
         }
     }
@@ -256,10 +303,11 @@ ASTNode *optimizer_strength_reduction(Optimizer *optimizer, ASTNode *node)
         break;
     }
 
+    optimizer_note_rewrites(optimizer, node, changes_before);
     return node;
 }
 
-int optimizer_evaluate_constant_expression(ASTNode *node)
+long long optimizer_evaluate_constant_expression(ASTNode *node)
 {
     if (!node)
         return 0;
@@ -273,32 +321,9 @@ int optimizer_evaluate_constant_expression(ASTNode *node)
         if (optimizer_is_constant(node->data.binary_op.left) &&
             optimizer_is_constant(node->data.binary_op.right))
         {
-            int left = optimizer_evaluate_constant_expression(node->data.binary_op.left);
-            int right = optimizer_evaluate_constant_expression(node->data.binary_op.right);
-
-            switch (node->data.binary_op.operator)
-            {
-            case TOKEN_PLUS:
-                return left + right;
-            case TOKEN_MINUS:
-                return left - right;
-            case TOKEN_MULTIPLY:
-                return left * right;
-            case TOKEN_DIVIDE:
-                return right != 0 ? left / right : 0;
-            case TOKEN_LESS:
-                return left < right;
-            case TOKEN_GREATER:
-                return left > right;
-            case TOKEN_EQUAL:
-                return left == right;
-            case TOKEN_NOT_EQUAL:
-                return left != right;
-            case TOKEN_SHIFT_LEFT:
-                return left << right;
-            default:
-                return 0;
-            }
+            return optimizer_apply_operator(node->data.binary_op.operator,
+                                            optimizer_evaluate_constant_expression(node->data.binary_op.left),
+                                            optimizer_evaluate_constant_expression(node->data.binary_op.right));
         }
         break;
 
@@ -309,133 +334,125 @@ int optimizer_evaluate_constant_expression(ASTNode *node)
     return 0;
 }
 
+long long optimizer_apply_operator(TokenType operator, long long left, long long right)
+{
+    // Arithmetic wraps like the generated 64-bit code does.
+    unsigned long long left_bits = (unsigned long long)left;
+    unsigned long long right_bits = (unsigned long long)right;
+
+    switch (operator)
+    {
+    case TOKEN_PLUS:
+        return (long long)(left_bits + right_bits);
+    case TOKEN_MINUS:
+        return (long long)(left_bits - right_bits);
+    case TOKEN_MULTIPLY:
+        return (long long)(left_bits * right_bits);
+    case TOKEN_DIVIDE:
+        return optimizer_division_traps(left, right) ? 0 : left / right;
+    case TOKEN_LESS:
+        return left < right;
+    case TOKEN_GREATER:
+        return left > right;
+    case TOKEN_EQUAL:
+        return left == right;
+    case TOKEN_NOT_EQUAL:
+        return left != right;
+    case TOKEN_SHIFT_LEFT:
+        // shl only looks at the low six bits of the count.
+        return (long long)(left_bits << (right_bits & 63));
+    default:
+        return 0;
+    }
+}
+
+int optimizer_division_traps(long long dividend, long long divisor)
+{
+    return divisor == 0 || (dividend == LLONG_MIN && divisor == -1);
+}
+
 int optimizer_is_constant(ASTNode *node)
 {
     return node && node->type == NODE_INTEGER;
 }
 
-UsedVariables *optimizer_find_used_variables(ASTNode *node)
+int optimizer_expression_may_trap(ASTNode *node)
 {
-    UsedVariables *used = (UsedVariables *)malloc(sizeof(UsedVariables));
-    used->vars = NULL;
-    used->count = 0;
-
-    if (!node)
-        return used;
+    if (!node || node->type != NODE_BINARY_OP)
+        return 0;
 
-    if (node->type == NODE_IDENTIFIER)
+    if (node->data.binary_op.operator== TOKEN_DIVIDE)
     {
-        used->vars = (char **)malloc(sizeof(char *));
-        used->vars[0] = strdup(node->data.identifier.name);
-        used->count = 1;
-        return used;
+        // idiv faults on a zero divisor and on INT64_MIN / -1.
+        ASTNode *divisor = node->data.binary_op.right;
+        if (!optimizer_is_constant(divisor) ||
+            divisor->data.integer.value == 0 ||
+            divisor->data.integer.value == -1)
+            return 1;
     }
 
+    return optimizer_expression_may_trap(node->data.binary_op.left) ||
+           optimizer_expression_may_trap(node->data.binary_op.right);
+}
+
+// Whether dropping a statement can only lose its assignments: nothing in it
+// may fault, and it contains no loop that might never finish.
+int optimizer_can_eliminate_code(ASTNode *node)
+{
+    if (!node)
+        return 1;
+
     switch (node->type)
     {
     case NODE_PROGRAM:
     case NODE_BLOCK:
         for (size_t i = 0; i < node->data.block.statement_count; i++)
         {
-            UsedVariables *child_used = optimizer_find_used_variables(node->data.block.statements[i]);
-            used->vars = realloc(used->vars, (used->count + child_used->count) * sizeof(char *));
-            memcpy(used->vars + used->count, child_used->vars, child_used->count * sizeof(char *));
-            used->count += child_used->count;
-            free(child_used->vars);
-            free(child_used);
+            if (!optimizer_can_eliminate_code(node->data.block.statements[i]))
+                return 0;
         }
-        break;
+        return 1;
 
     case NODE_IF:
-    {
-        UsedVariables *cond_used = optimizer_find_used_variables(node->data.if_stmt.condition);
-        UsedVariables *if_used = optimizer_find_used_variables(node->data.if_stmt.if_body);
-        UsedVariables *else_used = node->data.if_stmt.else_body ? optimizer_find_used_variables(node->data.if_stmt.else_body) : NULL;
-
-        size_t total_size = cond_used->count + if_used->count;
-        if (else_used)
-            total_size += else_used->count;
-
-        used->vars = realloc(used->vars, total_size * sizeof(char *));
-        memcpy(used->vars, cond_used->vars, cond_used->count * sizeof(char *));
-        used->count = cond_used->count;
-
-        memcpy(used->vars + used->count, if_used->vars, if_used->count * sizeof(char *));
-        used->count += if_used->count;
-
-        if (else_used)
-        {
-            memcpy(used->vars + used->count, else_used->vars, else_used->count * sizeof(char *));
-            used->count += else_used->count;
-            used_variables_destroy(else_used);
-        }
-
-        used_variables_destroy(cond_used);
-        used_variables_destroy(if_used);
-    }
-    break;
-
-    case NODE_WHILE:
-    {
-        UsedVariables *cond_used = optimizer_find_used_variables(node->data.while_loop.condition);
-        UsedVariables *body_used = optimizer_find_used_variables(node->data.while_loop.body);
-
-        used->vars = realloc(used->vars, (cond_used->count + body_used->count) * sizeof(char *));
-        memcpy(used->vars, cond_used->vars, cond_used->count * sizeof(char *));
-        used->count = cond_used->count;
-
-        memcpy(used->vars + used->count, body_used->vars, body_used->count * sizeof(char *));
-        used->count += body_used->count;
-
-        used_variables_destroy(cond_used);
-        used_variables_destroy(body_used);
-    }
-    break;
+        return !optimizer_expression_may_trap(node->data.if_stmt.condition) &&
+               optimizer_can_eliminate_code(node->data.if_stmt.if_body) &&
+               optimizer_can_eliminate_code(node->data.if_stmt.else_body);
 
     case NODE_ASSIGNMENT:
-    {
-        UsedVariables *value_used = optimizer_find_used_variables(node->data.assignment.value);
-        used->vars = realloc(used->vars, (value_used->count + 1) * sizeof(char *));
-        memcpy(used->vars, value_used->vars, value_used->count * sizeof(char *));
-        used->count = value_used->count;
-        used->vars[used->count++] = strdup(node->data.assignment.name);
-        used_variables_destroy(value_used);
-    }
-    break;
+        return !optimizer_expression_may_trap(node->data.assignment.value);
 
-    case NODE_BINARY_OP:
-    {
-        UsedVariables *left_used = optimizer_find_used_variables(node->data.binary_op.left);
-        UsedVariables *right_used = optimizer_find_used_variables(node->data.binary_op.right);
-
-        used->vars = realloc(used->vars, (left_used->count + right_used->count) * sizeof(char *));
-        memcpy(used->vars, left_used->vars, left_used->count * sizeof(char *));
-        used->count = left_used->count;
-
-        memcpy(used->vars + used->count, right_used->vars, right_used->count * sizeof(char *));
-        used->count += right_used->count;
-
-        used_variables_destroy(left_used);
-        used_variables_destroy(right_used);
-    }
-    break;
+    case NODE_WHILE:
+        return 0;
 
     default:
-        break;
+        return !optimizer_expression_may_trap(node);
     }
+}
 
-    return used;
+const char *optimizer_new_temporary(Optimizer *optimizer)
+{
+    // The leading '.' keeps compiler temporaries out of the source namespace.
+    char name[32];
+    snprintf(name, sizeof(name), ".t%d", optimizer->temporary_count++);
+    Symbol *symbol = symbol_table_add(optimizer->symbol_table, name, SYMBOL_INTEGER);
+    return symbol->name;
 }
 
-void used_variables_destroy(UsedVariables *used_vars)
+void optimizer_append_flattened(ASTNode *block, ASTNode *statement)
 {
-    if (used_vars)
+    if (!statement)
+        return;
+
+    if (statement->type != NODE_BLOCK)
     {
-        for (int i = 0; i < used_vars->count; i++)
-        {
-            free(used_vars->vars[i]);
-        }
-        free(used_vars->vars);
-        free(used_vars);
+        ast_add_statement(block, statement);
+        return;
+    }
+
+    for (size_t i = 0; i < statement->data.block.statement_count; i++)
+    {
+        ast_add_statement(block, statement->data.block.statements[i]);
     }
+    statement->data.block.statement_count = 0;
+    ast_destroy_node(statement);
 }
\ No newline at end of file
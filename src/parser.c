@@ -125,7 +125,8 @@ static ASTNode *parser_parse_primary(Parser *parser)
     {
     case TOKEN_INTEGER:
     {
-        int value = atoi(parser->current_token->value);
+        // Literals past INT64_MAX wrap, matching the 64-bit arithmetic at runtime.
+        long long value = (long long)strtoull(parser->current_token->value, NULL, 10);
         ASTNode *node = ast_create_integer(value);
         parser_advance_token(parser);
         return node;
@@ -0,0 +1,221 @@
+#include "pass_manager.h"
+#include <string.h>
+#include <time.h>
+
+static const Pass builtin_passes[] = {
+    {"constant-folding", optimizer_constant_folding, PASS_REPEATED, 1},
+    {"algebraic-simplification", optimizer_algebraic_simplification, PASS_REPEATED, 1},
+    {"reassociation", optimizer_reassociation, PASS_REPEATED, 2},
+    {"value-range", optimizer_value_range_analysis, PASS_REPEATED, 2},
+    {"dead-code-elimination", optimizer_dead_code_elimination, PASS_REPEATED, 1},
+    {"loop-deletion", optimizer_loop_deletion, PASS_REPEATED, 1},
+    {"strength-reduction", optimizer_strength_reduction, PASS_REPEATED, 1},
+    {"scalar-evolution", optimizer_scalar_evolution, PASS_REPEATED, 2},
+    {"loop-fusion", optimizer_loop_fusion, PASS_REPEATED, 2},
+    {"loop-invariant-code-motion", optimizer_loop_invariant_code_motion, PASS_REPEATED, 2},
+    {"loop-unswitching", optimizer_loop_unswitching, PASS_REPEATED, 3},
+    {"induction-variables", optimizer_induction_variables, PASS_REPEATED, 2},
+    {"value-numbering", optimizer_value_numbering, PASS_REPEATED, 2},
+    // The loops unrolling emits would qualify again on every round.
+    {"loop-unrolling", optimizer_loop_unrolling, PASS_ONCE, 2},
+    {"evaluate", optimizer_evaluate_program, PASS_ONCE, 1},
+};
+
+PassManager *pass_manager_create(void)
+{
+    PassManager *manager = (PassManager *)malloc(sizeof(PassManager));
+    manager->registry = NULL;
+    manager->registry_count = 0;
+    manager->pipeline = NULL;
+    manager->pipeline_count = 0;
+    manager->collect_stats = 0;
+
+    for (size_t i = 0; i < sizeof(builtin_passes) / sizeof(builtin_passes[0]); i++)
+    {
+        const Pass *pass = &builtin_passes[i];
+        pass_manager_register(manager, pass->name, pass->run, pass->kind, pass->level);
+    }
+    return manager;
+}
+
+void pass_manager_destroy(PassManager *manager)
+{
+    if (!manager)
+        return;
+    free(manager->registry);
+    free(manager->pipeline);
+    free(manager);
+}
+
+// Registers a pass under a new name; returns 0 if the name is taken.
+int pass_manager_register(PassManager *manager, const char *name, PassFunction run, PassKind kind, int level)
+{
+    if (pass_manager_find(manager, name))
+        return 0;
+
+    manager->registry = (Pass *)realloc(manager->registry, (manager->registry_count + 1) * sizeof(Pass));
+    Pass *pass = &manager->registry[manager->registry_count++];
+    pass->name = name;
+    pass->run = run;
+    pass->kind = kind;
+    pass->level = level;
+    return 1;
+}
+
+const Pass *pass_manager_find(PassManager *manager, const char *name)
+{
+    for (size_t i = 0; i < manager->registry_count; i++)
+    {
+        if (strcmp(manager->registry[i].name, name) == 0)
+            return &manager->registry[i];
+    }
+    return NULL;
+}
+
+void pass_manager_clear(PassManager *manager)
+{
+    free(manager->pipeline);
+    manager->pipeline = NULL;
+    manager->pipeline_count = 0;
+}
+
+static void pass_manager_append(PassManager *manager, const Pass *pass)
+{
+    manager->pipeline = (PassRecord *)realloc(manager->pipeline, (manager->pipeline_count + 1) * sizeof(PassRecord));
+    PassRecord *record = &manager->pipeline[manager->pipeline_count++];
+    memset(record, 0, sizeof(PassRecord));
+    record->pass = *pass;
+}
+
+// Appends a registered pass to the pipeline; returns 0 for an unknown name.
+int pass_manager_add(PassManager *manager, const char *name)
+{
+    const Pass *pass = pass_manager_find(manager, name);
+    if (!pass)
+        return 0;
+    pass_manager_append(manager, pass);
+    return 1;
+}
+
+void pass_manager_set_level(PassManager *manager, int level)
+{
+    pass_manager_clear(manager);
+    for (size_t i = 0; i < manager->registry_count; i++)
+    {
+        if (manager->registry[i].level <= level)
+            pass_manager_append(manager, &manager->registry[i]);
+    }
+}
+
+// Replaces the pipeline with a comma-separated list of pass names.
+int pass_manager_set_pipeline(PassManager *manager, const char *names)
+{
+    pass_manager_clear(manager);
+
+    const char *start = names;
+    while (*start)
+    {
+        size_t length = strcspn(start, ",");
+        char name[64];
+        if (length == 0 || length >= sizeof(name))
+        {
+            fprintf(stderr, "Unknown pass: %.*s\n", (int)length, start);
+            return 0;
+        }
+        memcpy(name, start, length);
+        name[length] = '\0';
+        if (!pass_manager_add(manager, name))
+        {
+            fprintf(stderr, "Unknown pass: %s\n", name);
+            return 0;
+        }
+
+        start += length;
+        if (*start == ',')
+            start++;
+    }
+    return 1;
+}
+
+static double pass_manager_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static ASTNode *pass_manager_run_pass(PassManager *manager, PassRecord *record, Optimizer *optimizer, ASTNode *ast)
+{
+    optimizer->program = ast;
+    if (!manager->collect_stats)
+        return record->pass.run(optimizer, ast);
+
+    int changes_before = optimizer->changes_made;
+    record->nodes += ast_size(ast);
+    double start = pass_manager_now();
+    ast = record->pass.run(optimizer, ast);
+    record->seconds += pass_manager_now() - start;
+    record->runs++;
+    record->rewrites += optimizer->changes_made - changes_before;
+    return ast;
+}
+
+// Iterates the repeated passes among pipeline[first, last) until a whole
+// round leaves the tree alone.
+static ASTNode *pass_manager_settle(PassManager *manager, Optimizer *optimizer, ASTNode *ast, size_t first,
+                                    size_t last)
+{
+    do
+    {
+        optimizer->changes_made = 0;
+        for (size_t i = first; i < last; i++)
+        {
+            if (manager->pipeline[i].pass.kind == PASS_REPEATED)
+                ast = pass_manager_run_pass(manager, &manager->pipeline[i], optimizer, ast);
+        }
+    } while (optimizer->changes_made);
+    return ast;
+}
+
+// Runs the pipeline in order: each stretch of repeated passes settles, and
+// a pass that runs once is followed by every repeated pass settling again
+// if it changed anything.
+ASTNode *pass_manager_run(PassManager *manager, Optimizer *optimizer, ASTNode *ast)
+{
+    size_t i = 0;
+    while (i < manager->pipeline_count)
+    {
+        if (manager->pipeline[i].pass.kind == PASS_REPEATED)
+        {
+            size_t end = i;
+            while (end < manager->pipeline_count && manager->pipeline[end].pass.kind == PASS_REPEATED)
+            {
+                end++;
+            }
+            ast = pass_manager_settle(manager, optimizer, ast, i, end);
+            i = end;
+            continue;
+        }
+
+        optimizer->changes_made = 0;
+        ast = pass_manager_run_pass(manager, &manager->pipeline[i], optimizer, ast);
+        if (optimizer->changes_made)
+            ast = pass_manager_settle(manager, optimizer, ast, 0, manager->pipeline_count);
+        i++;
+    }
+    return ast;
+}
+
+void pass_manager_print_stats(PassManager *manager, FILE *output)
+{
+    double total = 0;
+    fprintf(output, "%-28s %6s %10s %12s %10s\n", "pass", "runs", "time (ms)", "nodes", "rewrites");
+    for (size_t i = 0; i < manager->pipeline_count; i++)
+    {
+        PassRecord *record = &manager->pipeline[i];
+        fprintf(output, "%-28s %6d %10.3f %12lld %10lld\n", record->pass.name, record->runs, record->seconds * 1000,
+                record->nodes, record->rewrites);
+        total += record->seconds;
+    }
+    fprintf(output, "%-28s %6s %10.3f\n", "total", "", total * 1000);
+}
@@ -0,0 +1,338 @@
+#include "peephole.h"
+#include "instruction.h"
+#include <stdlib.h>
+#include <string.h>
+
+const char *peephole_rule_names[PEEPHOLE_RULE_COUNT] = {"store-forwarding", "redundant-move", "zero-idiom",
+                                                        "test-zero"};
+
+typedef struct
+{
+    MachineInstruction *instruction; // in the block, rewritten in place; NULL past the last
+    int removed;
+} PeepholeEntry;
+
+static int peephole_is(const PeepholeEntry *entry, const char *mnemonic, int operand_count)
+{
+    return entry && entry->instruction->operand_count == operand_count &&
+           strcmp(entry->instruction->mnemonic, mnemonic) == 0;
+}
+
+static int peephole_is_register(const Operand *operand, int reg)
+{
+    return operand->kind == OPERAND_REGISTER && operand->reg == reg;
+}
+
+// The size an operand is accessed at; memory of unstated size takes that of
+// the register beside it.
+static int peephole_access_size(const MachineInstruction *instruction, int index)
+{
+    const Operand *operand = &instruction->operands[index];
+    if (operand->kind != OPERAND_MEMORY || operand->size)
+        return operand->size;
+    for (int i = 0; i < instruction->operand_count; i++)
+    {
+        if (instruction->operands[i].kind == OPERAND_REGISTER)
+            return instruction->operands[i].size;
+    }
+    return 0;
+}
+
+// How many bytes of register `reg` the instruction writes, 0 if none.
+static int peephole_written_size(const MachineInstruction *instruction, int reg)
+{
+    const char *mnemonic = instruction->mnemonic;
+    if (strcmp(mnemonic, "cmp") == 0 || strcmp(mnemonic, "test") == 0 || strcmp(mnemonic, "push") == 0)
+        return 0;
+    if (strcmp(mnemonic, "cqo") == 0 || strcmp(mnemonic, "cdq") == 0)
+        return reg == 2 ? (mnemonic[1] == 'q' ? 8 : 4) : 0;
+    if (instruction->operand_count == 1 && (strcmp(mnemonic, "mul") == 0 || strcmp(mnemonic, "imul") == 0 ||
+                                            strcmp(mnemonic, "div") == 0 || strcmp(mnemonic, "idiv") == 0))
+        return reg == 0 || reg == 2 ? instruction->operands[0].size : 0;
+    if (instruction->operand_count > 0 && peephole_is_register(&instruction->operands[0], reg))
+        return instruction->operands[0].size;
+    return 0;
+}
+
+// Whether the upper half of `reg` is clear before entries[index]: the last
+// write to it in the block was a 32-bit one.
+static int peephole_upper_clear(const PeepholeEntry *entries, size_t index, int reg)
+{
+    while (index-- > 0)
+    {
+        if (entries[index].removed)
+            continue;
+        int size = peephole_written_size(entries[index].instruction, reg);
+        if (size)
+            return size == 4;
+    }
+    return 0;
+}
+
+// Whether the instruction sets all of register `reg` without reading it.
+static int peephole_overwrites(const MachineInstruction *instruction, int reg)
+{
+    const Operand *operands = instruction->operands;
+    if (instruction->operand_count != 2 || !peephole_is_register(&operands[0], reg) || operands[0].size < 4)
+        return 0;
+    if (strcmp(instruction->mnemonic, "xor") == 0)
+        return peephole_is_register(&operands[1], reg);
+    if (strcmp(instruction->mnemonic, "mov") != 0 && strcmp(instruction->mnemonic, "movsxd") != 0)
+        return 0;
+    return !((operands[1].kind == OPERAND_REGISTER || operands[1].kind == OPERAND_MEMORY) && operands[1].reg == reg);
+}
+
+// Whether the instruction may read or write any part of register `reg`.
+// Only the mnemonics below touch no register but their operands.
+static int peephole_touches(const MachineInstruction *instruction, int reg)
+{
+    static const char *const explicit_only[] = {"mov", "movzx", "movsx", "movsxd", "lea", "add", "sub", "and",
+                                                "or",  "xor",   "imul",  "cmp",    "test", "shl", "shr", "sar",
+                                                "neg", "not",   NULL};
+    const char *mnemonic = instruction->mnemonic;
+    int known = strncmp(mnemonic, "set", 3) == 0 || strncmp(mnemonic, "cmov", 4) == 0;
+    for (int i = 0; explicit_only[i] && !known; i++)
+    {
+        known = strcmp(mnemonic, explicit_only[i]) == 0;
+    }
+    if (!known || (instruction->operand_count == 1 && strcmp(mnemonic, "imul") == 0))
+        return 1;
+    for (int i = 0; i < instruction->operand_count; i++)
+    {
+        const Operand *operand = &instruction->operands[i];
+        if ((operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && operand->reg == reg)
+            return 1;
+    }
+    return 0;
+}
+
+static int peephole_reads_flags(const PeepholeEntry *entry)
+{
+    if (!entry)
+        return 0;
+    const char *mnemonic = entry->instruction->mnemonic;
+    return strncmp(mnemonic, "set", 3) == 0 || strncmp(mnemonic, "cmov", 4) == 0 || mnemonic[0] == 'j' ||
+           strcmp(mnemonic, "adc") == 0 || strcmp(mnemonic, "sbb") == 0;
+}
+
+// mov [m], r and then a read of [m] at the same size: the read takes r.
+static int peephole_forward_store(PeepholeEntry *entries, size_t index, PeepholeEntry *next)
+{
+    PeepholeEntry *store = &entries[index];
+    if (!peephole_is(store, "mov", 2) || store->instruction->operands[0].kind != OPERAND_MEMORY ||
+        store->instruction->operands[1].kind != OPERAND_REGISTER || !next)
+        return 0;
+    const Operand *slot = &store->instruction->operands[0];
+    const Operand *value = &store->instruction->operands[1];
+
+    // Sources: what a two- or three-operand instruction takes after its
+    // destination, the left side of a comparison, and a one-operand
+    // multiply or divide's operand.
+    MachineInstruction *instruction = next->instruction;
+    const char *mnemonic = instruction->mnemonic;
+    int index_read = -1;
+    if (instruction->operand_count >= 2 &&
+        (strcmp(mnemonic, "mov") == 0 || strcmp(mnemonic, "movsxd") == 0 || strcmp(mnemonic, "add") == 0 ||
+         strcmp(mnemonic, "sub") == 0 || strcmp(mnemonic, "and") == 0 || strcmp(mnemonic, "or") == 0 ||
+         strcmp(mnemonic, "xor") == 0 || strcmp(mnemonic, "imul") == 0 || strcmp(mnemonic, "cmp") == 0 ||
+         strcmp(mnemonic, "test") == 0))
+        index_read = 1;
+    if ((instruction->operand_count == 2 && (strcmp(mnemonic, "cmp") == 0 || strcmp(mnemonic, "test") == 0)) ||
+        (instruction->operand_count == 1 && (strcmp(mnemonic, "mul") == 0 || strcmp(mnemonic, "imul") == 0 ||
+                                             strcmp(mnemonic, "div") == 0 || strcmp(mnemonic, "idiv") == 0)))
+    {
+        if (index_read < 0 || instruction_same_location(&instruction->operands[0], slot))
+            index_read = 0;
+    }
+    if (index_read < 0)
+        return 0;
+
+    Operand *operand = &instruction->operands[index_read];
+    if (operand->kind != OPERAND_MEMORY || !instruction_same_location(operand, slot) ||
+        peephole_access_size(instruction, index_read) != value->size)
+        return 0;
+    *operand = *value;
+    return 1;
+}
+
+static void peephole_remove(PeepholeEntry *entry)
+{
+    entry->removed = 1;
+}
+
+// Whether the block overwrites register `reg` from `entry` on, before
+// anything reads it.
+static int peephole_overwritten(const PeepholeEntry *entry, int reg)
+{
+    for (; entry->instruction; entry++)
+    {
+        if (entry->removed)
+            continue;
+        if (peephole_overwrites(entry->instruction, reg))
+            return 1;
+        if (peephole_touches(entry->instruction, reg))
+            return 0;
+    }
+    return 0;
+}
+
+// mov r, r on a full register; mov r32, r32 once the upper half is clear;
+// mov a, b then mov b, a; and a move whose register is overwritten before
+// it is read.
+static int peephole_redundant_move(PeepholeEntry *entries, size_t index, PeepholeEntry *next)
+{
+    PeepholeEntry *first = &entries[index];
+    const Operand *operands = first->instruction->operands;
+
+    if (peephole_is(first, "mov", 2) && operands[0].kind == OPERAND_REGISTER &&
+        instruction_same_location(&operands[0], &operands[1]) && operands[0].size == operands[1].size &&
+        (operands[0].size == 8 || peephole_upper_clear(entries, index, operands[0].reg)))
+    {
+        peephole_remove(first);
+        return 1;
+    }
+
+    if (peephole_is(first, "mov", 2) && peephole_is(next, "mov", 2))
+    {
+        const Operand *back = next->instruction->operands;
+        int sizes_match = peephole_access_size(first->instruction, 0) == peephole_access_size(next->instruction, 1) &&
+                          peephole_access_size(first->instruction, 1) == peephole_access_size(next->instruction, 0);
+        // Storing back what was just loaded changes nothing; a 32-bit move
+        // into a register would also clear its upper half.
+        int full = operands[1].kind == OPERAND_MEMORY || peephole_access_size(first->instruction, 0) == 8;
+        if (sizes_match && full && operands[1].kind != OPERAND_IMMEDIATE &&
+            instruction_same_location(&operands[0], &back[1]) && instruction_same_location(&operands[1], &back[0]))
+        {
+            peephole_remove(next);
+            return 1;
+        }
+    }
+
+    if (next && first->instruction->operand_count == 2 && operands[0].kind == OPERAND_REGISTER &&
+        (strcmp(first->instruction->mnemonic, "mov") == 0 || strcmp(first->instruction->mnemonic, "movsxd") == 0 ||
+         peephole_overwrites(first->instruction, operands[0].reg)) &&
+        peephole_overwritten(next, operands[0].reg))
+    {
+        peephole_remove(first);
+        return 1;
+    }
+    return 0;
+}
+
+// mov r, 0 becomes xor r32, r32, where nothing reads the flags it sets.
+static int peephole_zero_idiom(PeepholeEntry *entries, size_t index, PeepholeEntry *next)
+{
+    PeepholeEntry *entry = &entries[index];
+    if (!peephole_is(entry, "mov", 2) || entry->instruction->operands[0].kind != OPERAND_REGISTER ||
+        entry->instruction->operands[0].size < 4 || entry->instruction->operands[1].kind != OPERAND_IMMEDIATE ||
+        entry->instruction->operands[1].value != 0 || peephole_reads_flags(next))
+        return 0;
+
+    MachineInstruction *instruction = entry->instruction;
+    strcpy(instruction->mnemonic, "xor");
+    instruction->operands[0].size = 4;
+    instruction->operands[1] = instruction->operands[0];
+    return 1;
+}
+
+// cmp r, 0 sets the flags test r, r does, without the immediate.
+static int peephole_is_compare_zero(const MachineInstruction *instruction)
+{
+    return strcmp(instruction->mnemonic, "cmp") == 0 && instruction->operand_count == 2 &&
+           instruction->operands[0].kind == OPERAND_REGISTER && instruction->operands[0].size >= 4 &&
+           instruction->operands[1].kind == OPERAND_IMMEDIATE && instruction->operands[1].value == 0;
+}
+
+static void peephole_make_test(MachineInstruction *instruction)
+{
+    strcpy(instruction->mnemonic, "test");
+    instruction->operands[1] = instruction->operands[0];
+}
+
+static int peephole_test_zero(PeepholeEntry *entries, size_t index, PeepholeEntry *next)
+{
+    (void)next;
+    PeepholeEntry *entry = &entries[index];
+    if (!peephole_is_compare_zero(entry->instruction))
+        return 0;
+    peephole_make_test(entry->instruction);
+    return 1;
+}
+
+static int (*const peephole_rules[PEEPHOLE_RULE_COUNT])(PeepholeEntry *, size_t, PeepholeEntry *) = {
+    peephole_forward_store,
+    peephole_redundant_move,
+    peephole_zero_idiom,
+    peephole_test_zero,
+};
+
+static void peephole_closing_compare(BasicBlock *block, PeepholeStats *stats)
+{
+    if (block->exit != EXIT_BRANCH || !peephole_is_compare_zero(&block->compare))
+        return;
+    peephole_make_test(&block->compare);
+    stats->hits[PEEPHOLE_TEST_ZERO]++;
+}
+
+static void peephole_block(BasicBlock *block, PeepholeStats *stats)
+{
+    size_t count = block->instruction_count;
+    PeepholeEntry *entries = (PeepholeEntry *)calloc(count + 1, sizeof(PeepholeEntry));
+    for (size_t i = 0; i < count; i++)
+    {
+        entries[i].instruction = &block->instructions[i];
+    }
+
+    // Each rule looks at an instruction and the next one still standing, the
+    // redundant-move rule further; sweeps repeat until one changes nothing.
+    int changed;
+    do
+    {
+        changed = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t next = i + 1;
+            while (next < count && entries[next].removed)
+                next++;
+            for (int rule = 0; rule < PEEPHOLE_RULE_COUNT && !entries[i].removed; rule++)
+            {
+                if (peephole_rules[rule](entries, i, next < count ? &entries[next] : NULL))
+                {
+                    stats->hits[rule]++;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!entries[i].removed)
+            block->instructions[kept++] = block->instructions[i];
+    }
+    block->instruction_count = kept;
+    free(entries);
+
+    peephole_closing_compare(block, stats);
+}
+
+PeepholeStats peephole_optimize(ControlFlowGraph *cfg)
+{
+    PeepholeStats stats;
+    memset(&stats, 0, sizeof(stats));
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        peephole_block(cfg->blocks[i], &stats);
+    }
+    return stats;
+}
+
+void peephole_print_stats(const PeepholeStats *stats, FILE *output)
+{
+    fprintf(output, "%-28s %6s\n", "peephole rule", "hits");
+    for (int rule = 0; rule < PEEPHOLE_RULE_COUNT; rule++)
+    {
+        fprintf(output, "%-28s %6d\n", peephole_rule_names[rule], stats->hits[rule]);
+    }
+}
@@ -0,0 +1,193 @@
+#include "optimizer.h"
+#include <limits.h>
+
+// Rewrites each chain of + or * into a canonical left-leaning tree over its
+// operands: compound operands first in their original order, then variables
+// by symbol id, then a single constant holding every literal folded together.
+// Subtracting a literal joins a + chain as adding its negation. Both
+// operators wrap modulo 2^64, so any order gives the same value.
+
+typedef struct
+{
+    ASTNode **operands;
+    size_t count;
+    size_t capacity;
+} OperandList;
+
+static void operand_list_add(OperandList *list, ASTNode *operand)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->operands = (ASTNode **)realloc(list->operands, list->capacity * sizeof(ASTNode *));
+    }
+    list->operands[list->count++] = operand;
+}
+
+static int reassociate_subtracts_constant(ASTNode *node)
+{
+    return node->type == NODE_BINARY_OP && node->data.binary_op.operator== TOKEN_MINUS &&
+           optimizer_is_constant(node->data.binary_op.right);
+}
+
+static int reassociate_is_chain(ASTNode *node, TokenType operator)
+{
+    if (node->type != NODE_BINARY_OP)
+        return 0;
+    return node->data.binary_op.operator== operator ||
+           (operator== TOKEN_PLUS && reassociate_subtracts_constant(node));
+}
+
+static ASTNode *reassociate_expression(Optimizer *optimizer, ASTNode *node);
+
+// Collects the chain's operands, freeing the interior nodes on the way.
+static void reassociate_flatten(Optimizer *optimizer, ASTNode *node, TokenType operator, OperandList *list)
+{
+    if (!reassociate_is_chain(node, operator))
+    {
+        operand_list_add(list, reassociate_expression(optimizer, node));
+        return;
+    }
+
+    reassociate_flatten(optimizer, node->data.binary_op.left, operator, list);
+    if (node->data.binary_op.operator== TOKEN_MINUS)
+    {
+        ASTNode *subtrahend = node->data.binary_op.right;
+        subtrahend->data.integer.value = (long long)(0 - (unsigned long long)subtrahend->data.integer.value);
+        operand_list_add(list, subtrahend);
+    }
+    else
+    {
+        reassociate_flatten(optimizer, node->data.binary_op.right, operator, list);
+    }
+    node->data.binary_op.left = NULL;
+    node->data.binary_op.right = NULL;
+    ast_destroy_node(node);
+}
+
+static int reassociate_rank(Optimizer *optimizer, ASTNode *operand)
+{
+    if (operand->type == NODE_IDENTIFIER)
+        return 1 + symbol_table_get_id(optimizer->symbol_table, operand->data.identifier.name);
+    return 0;
+}
+
+static ASTNode *reassociate_chain(Optimizer *optimizer, ASTNode *node, TokenType operator)
+{
+    ASTNode *original = ast_clone(node);
+
+    OperandList list = {NULL, 0, 0};
+    reassociate_flatten(optimizer, node, operator, &list);
+
+    unsigned long long constant = operator== TOKEN_PLUS ? 0 : 1;
+    int constant_count = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < list.count; i++)
+    {
+        ASTNode *operand = list.operands[i];
+        if (!optimizer_is_constant(operand))
+        {
+            list.operands[kept++] = operand;
+            continue;
+        }
+
+        unsigned long long value = (unsigned long long)operand->data.integer.value;
+        constant = operator== TOKEN_PLUS ? constant + value : constant * value;
+        constant_count++;
+        ast_destroy_node(operand);
+    }
+
+    // Stable insertion sort: chains are short and ties keep source order.
+    for (size_t i = 1; i < kept; i++)
+    {
+        ASTNode *operand = list.operands[i];
+        int rank = reassociate_rank(optimizer, operand);
+        size_t j = i;
+        while (j > 0 && reassociate_rank(optimizer, list.operands[j - 1]) > rank)
+        {
+            list.operands[j] = list.operands[j - 1];
+            j--;
+        }
+        list.operands[j] = operand;
+    }
+
+    ASTNode *result = kept ? list.operands[0] : NULL;
+    for (size_t i = 1; i < kept; i++)
+    {
+        result = ast_create_binary_op(operator, result, list.operands[i]);
+    }
+
+    // An identity constant only survives when it was written on its own.
+    unsigned long long identity = operator== TOKEN_PLUS ? 0 : 1;
+    if (constant_count && (constant != identity || !result))
+    {
+        if (!result)
+            result = ast_create_integer((long long)constant);
+        else if (operator== TOKEN_PLUS && (long long)constant < 0 && (long long)constant != LLONG_MIN)
+            result = ast_create_binary_op(TOKEN_MINUS, result, ast_create_integer(-(long long)constant));
+        else
+            result = ast_create_binary_op(operator, result, ast_create_integer((long long)constant));
+    }
+
+    if (!ast_equal(original, result))
+        optimizer->changes_made++;
+    ast_destroy_node(original);
+    free(list.operands);
+    return result;
+}
+
+static ASTNode *reassociate_expression(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node || node->type != NODE_BINARY_OP)
+        return node;
+
+    TokenType operator= node->data.binary_op.operator;
+    if (operator== TOKEN_PLUS || operator== TOKEN_MULTIPLY)
+        return reassociate_chain(optimizer, node, operator);
+    if (reassociate_subtracts_constant(node))
+        return reassociate_chain(optimizer, node, TOKEN_PLUS);
+
+    node->data.binary_op.left = reassociate_expression(optimizer, node->data.binary_op.left);
+    node->data.binary_op.right = reassociate_expression(optimizer, node->data.binary_op.right);
+    return node;
+}
+
+ASTNode *optimizer_reassociation(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            node->data.block.statements[i] = optimizer_reassociation(optimizer, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_IF:
+        node->data.if_stmt.condition = reassociate_expression(optimizer, node->data.if_stmt.condition);
+        node->data.if_stmt.if_body = optimizer_reassociation(optimizer, node->data.if_stmt.if_body);
+        node->data.if_stmt.else_body = optimizer_reassociation(optimizer, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        node->data.while_loop.condition = reassociate_expression(optimizer, node->data.while_loop.condition);
+        node->data.while_loop.body = optimizer_reassociation(optimizer, node->data.while_loop.body);
+        break;
+
+    case NODE_ASSIGNMENT:
+        node->data.assignment.value = reassociate_expression(optimizer, node->data.assignment.value);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
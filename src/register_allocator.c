@@ -0,0 +1,526 @@
+#include "register_allocator.h"
+#include "codegen.h"
+#include "instruction.h"
+#include <stdint.h>
+
+const char *allocatable_registers[ALLOCATABLE_REGISTER_COUNT] = {"rbx", "r12", "r13", "r14", "r15"};
+const char *allocatable_registers32[ALLOCATABLE_REGISTER_COUNT] = {"ebx", "r12d", "r13d", "r14d", "r15d"};
+
+// The same registers and rbp, numbered as instructions decode them.
+static const int allocatable_numbers[ALLOCATABLE_REGISTER_COUNT] = {3, 12, 13, 14, 15};
+#define ALLOCATOR_FRAME_REGISTER 5
+
+// References inside deeper loops weigh no more than at this depth.
+#define ALLOCATOR_MAX_LOOP_DEPTH 6
+
+typedef struct
+{
+    Symbol *symbol;
+    int start; // first and last position where the variable is live or referenced, -1 if never
+    int end;
+    double weight;
+    int definitions;
+    int constant;   // every definition so far stores `value`, and every read can take a constant
+    long long value;
+    int immediate_reads; // some read takes the constant as an imm32 operand
+    int rematerialize;
+} LiveInterval;
+
+typedef struct
+{
+    ControlFlowGraph *cfg;
+    Symbol **slots; // by stack offset
+    int slot_count;
+    LiveInterval *intervals; // by symbol id
+    int variable_count;
+
+    // Per block, in layout order.
+    BitSet *uses; // read before any write in the block
+    BitSet *defs;
+    BitSet *live_in;
+    BitSet *live_out;
+    int *successor; // block indices, -1 where there is none
+    int *branch_target;
+    int *start;
+    int *end; // position of the block's closing cmp and jumps
+    int *loop_depth;
+} Allocator;
+
+// The block's instruction at `index`, or at instruction_count its closing
+// compare.
+static MachineInstruction *allocator_instruction(BasicBlock *block, size_t index)
+{
+    return index < block->instruction_count ? &block->instructions[index] : &block->compare;
+}
+
+// Codegen's instructions reference at most one variable, always as [rbp-N].
+// Returns the index of that operand, or -1.
+static int allocator_reference(Allocator *allocator, const MachineInstruction *instruction, Symbol **symbol)
+{
+    for (int i = 0; i < instruction->operand_count; i++)
+    {
+        const Operand *operand = &instruction->operands[i];
+        if (operand->kind == OPERAND_MEMORY && operand->reg == ALLOCATOR_FRAME_REGISTER && operand->value < 0 &&
+            -operand->value <= allocator->slot_count && allocator->slots[-operand->value])
+        {
+            *symbol = allocator->slots[-operand->value];
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The instruction writes the slot when it is the destination.
+static int allocator_writes(const MachineInstruction *instruction, int index)
+{
+    return index == 0 && instruction->operand_count > 1 && strcmp(instruction->mnemonic, "cmp") != 0;
+}
+
+static int allocator_is_rax(const Operand *operand)
+{
+    return operand->kind == OPERAND_REGISTER && operand->reg == 0 && operand->size >= 4;
+}
+
+static int allocator_is_load(const MachineInstruction *instruction, int index)
+{
+    return index == 1 && allocator_is_rax(&instruction->operands[0]) &&
+           (strcmp(instruction->mnemonic, "mov") == 0 || strcmp(instruction->mnemonic, "movsxd") == 0);
+}
+
+// Whether the slot is a source operand an immediate could replace.
+static int allocator_takes_immediate(const MachineInstruction *instruction, int index)
+{
+    const char *mnemonic = instruction->mnemonic;
+    return index == 1 && instruction->operand_count == 2 &&
+           (strcmp(mnemonic, "add") == 0 || strcmp(mnemonic, "sub") == 0 || strcmp(mnemonic, "cmp") == 0 ||
+            strcmp(mnemonic, "mov") == 0 || strcmp(mnemonic, "imul") == 0);
+}
+
+// The constant a store writes, when the instruction before it put one in rax.
+static int allocator_stored_constant(BasicBlock *block, size_t index, long long *value)
+{
+    if (index == 0 || !allocator_is_rax(&block->instructions[index].operands[1]))
+        return 0;
+    const MachineInstruction *previous = &block->instructions[index - 1];
+    if (strcmp(previous->mnemonic, "mov") != 0 || previous->operand_count != 2 ||
+        !allocator_is_rax(&previous->operands[0]) || previous->operands[1].kind != OPERAND_IMMEDIATE)
+        return 0;
+    *value = previous->operands[1].value;
+    return 1;
+}
+
+static void allocator_extend(LiveInterval *interval, int position)
+{
+    if (interval->start < 0 || position < interval->start)
+        interval->start = position;
+    if (position > interval->end)
+        interval->end = position;
+}
+
+static void allocator_record(Allocator *allocator, size_t block_index, size_t index, int position)
+{
+    BasicBlock *block = allocator->cfg->blocks[block_index];
+    const MachineInstruction *instruction = allocator_instruction(block, index);
+    Symbol *symbol;
+    int reference = allocator_reference(allocator, instruction, &symbol);
+    if (reference < 0)
+        return;
+
+    LiveInterval *interval = &allocator->intervals[symbol->id];
+    allocator_extend(interval, position);
+    double weight = 1;
+    for (int depth = 0; depth < allocator->loop_depth[block_index] && depth < ALLOCATOR_MAX_LOOP_DEPTH; depth++)
+    {
+        weight *= 10;
+    }
+    interval->weight += weight;
+
+    if (!allocator_writes(instruction, reference))
+    {
+        if (!bitset_test(&allocator->defs[block_index], symbol->id))
+            bitset_set(&allocator->uses[block_index], symbol->id);
+        if (allocator_is_load(instruction, reference))
+            return;
+        if (allocator_takes_immediate(instruction, reference))
+            interval->immediate_reads = 1;
+        else
+            interval->constant = 0;
+        return;
+    }
+
+    bitset_set(&allocator->defs[block_index], symbol->id);
+    long long value;
+    if (!allocator_stored_constant(block, index, &value))
+    {
+        interval->constant = 0;
+    }
+    else
+    {
+        if (codegen_is_dword(symbol))
+            value = (int32_t)value;
+        if (interval->definitions && value != interval->value)
+            interval->constant = 0;
+        interval->value = value;
+    }
+    interval->definitions++;
+}
+
+// Resolves each block's exits to indices in layout order.
+static void allocator_index_edges(Allocator *allocator)
+{
+    ControlFlowGraph *cfg = allocator->cfg;
+    int label_count = 0;
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        if (cfg->blocks[i]->label >= label_count)
+            label_count = cfg->blocks[i]->label + 1;
+    }
+    int *index_of = (int *)malloc(label_count * sizeof(int));
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        index_of[cfg->blocks[i]->label] = (int)i;
+    }
+
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        allocator->successor[i] = block->exit == EXIT_RETURN ? -1 : index_of[block->successor->label];
+        allocator->branch_target[i] = block->exit == EXIT_BRANCH ? index_of[block->branch_target->label] : -1;
+    }
+    free(index_of);
+}
+
+// Blocks are laid out so that a loop's blocks sit between the target of its
+// back edge and the block taking it.
+static void allocator_loop_depths(Allocator *allocator)
+{
+    for (int i = 0; i < (int)allocator->cfg->block_count; i++)
+    {
+        int targets[2] = {allocator->successor[i], allocator->branch_target[i]};
+        if (targets[1] == targets[0])
+            targets[1] = -1;
+        for (int t = 0; t < 2; t++)
+        {
+            for (int j = targets[t]; j >= 0 && j <= i; j++)
+            {
+                allocator->loop_depth[j]++;
+            }
+        }
+    }
+}
+
+static void allocator_liveness(Allocator *allocator, const BitSet *exit_live)
+{
+    ControlFlowGraph *cfg = allocator->cfg;
+    BitSet in;
+    bitset_init(&in, allocator->variable_count);
+
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (size_t i = cfg->block_count; i-- > 0;)
+        {
+            BitSet *out = &allocator->live_out[i];
+            if (allocator->successor[i] < 0)
+                bitset_copy(out, exit_live);
+            else
+                bitset_copy(out, &allocator->live_in[allocator->successor[i]]);
+            if (allocator->branch_target[i] >= 0)
+                bitset_union_with(out, &allocator->live_in[allocator->branch_target[i]]);
+
+            bitset_copy(&in, out);
+            bitset_subtract(&in, &allocator->defs[i]);
+            bitset_union_with(&in, &allocator->uses[i]);
+            if (!bitset_equals(&in, &allocator->live_in[i]))
+            {
+                bitset_copy(&allocator->live_in[i], &in);
+                changed = 1;
+            }
+        }
+    }
+    bitset_free(&in);
+}
+
+static int allocator_compare_starts(const void *a, const void *b)
+{
+    const LiveInterval *left = *(LiveInterval *const *)a;
+    const LiveInterval *right = *(LiveInterval *const *)b;
+    if (left->start != right->start)
+        return left->start < right->start ? -1 : 1;
+    return left->symbol->id - right->symbol->id;
+}
+
+static void allocator_scan(Allocator *allocator, RegisterAllocationStats *stats)
+{
+    LiveInterval **order = (LiveInterval **)malloc(allocator->variable_count * sizeof(LiveInterval *));
+    int count = 0;
+    for (int id = 0; id < allocator->variable_count; id++)
+    {
+        LiveInterval *interval = &allocator->intervals[id];
+        if (interval->symbol && interval->weight > 0 && !interval->rematerialize)
+            order[count++] = interval;
+    }
+    qsort(order, count, sizeof(LiveInterval *), allocator_compare_starts);
+
+    LiveInterval *active[ALLOCATABLE_REGISTER_COUNT] = {NULL};
+    for (int i = 0; i < count; i++)
+    {
+        LiveInterval *interval = order[i];
+        int chosen = -1;
+        for (int r = ALLOCATABLE_REGISTER_COUNT - 1; r >= 0; r--)
+        {
+            if (active[r] && active[r]->end < interval->start)
+                active[r] = NULL;
+            if (!active[r])
+                chosen = r;
+        }
+
+        // Every register is taken: the cheapest of the live intervals and
+        // this one stays in memory.
+        if (chosen < 0)
+        {
+            int cheapest = 0;
+            for (int r = 1; r < ALLOCATABLE_REGISTER_COUNT; r++)
+            {
+                if (active[r]->weight < active[cheapest]->weight)
+                    cheapest = r;
+            }
+            stats->spilled++;
+            if (active[cheapest]->weight >= interval->weight)
+                continue;
+            active[cheapest]->symbol->register_index = -1;
+            chosen = cheapest;
+        }
+        interval->symbol->register_index = chosen;
+        active[chosen] = interval;
+    }
+    free(order);
+}
+
+static const char *allocator_register_name(const Symbol *symbol)
+{
+    return codegen_is_dword(symbol) ? allocatable_registers32[symbol->register_index]
+                                    : allocatable_registers[symbol->register_index];
+}
+
+static void allocator_set_immediate(Operand *operand, long long value)
+{
+    operand->kind = OPERAND_IMMEDIATE;
+    operand->reg = 0;
+    operand->size = 0;
+    operand->value = value;
+}
+
+// Replaces the variable's [rbp-N] operand by its register or constant. A
+// stated size on the operand decides the register's width.
+static void allocator_rewrite(Allocator *allocator, BasicBlock *block, size_t index)
+{
+    MachineInstruction *instruction = allocator_instruction(block, index);
+    Symbol *symbol;
+    int reference = allocator_reference(allocator, instruction, &symbol);
+    if (reference < 0)
+        return;
+
+    LiveInterval *interval = &allocator->intervals[symbol->id];
+    Operand *operand = &instruction->operands[reference];
+    int writes = allocator_writes(instruction, reference);
+    if (interval->rematerialize && !writes && allocator_is_load(instruction, reference))
+    {
+        strcpy(instruction->mnemonic, "mov");
+        instruction->operands[0].size = interval->value >= 0 && interval->value <= UINT32_MAX ? 4 : 8;
+        allocator_set_immediate(operand, interval->value);
+    }
+    else if (interval->rematerialize && !writes)
+    {
+        // imul only takes an immediate in its three-operand form.
+        allocator_set_immediate(operand, interval->value);
+        if (strcmp(instruction->mnemonic, "imul") == 0 && instruction->operand_count == 2)
+        {
+            instruction->operands[2] = *operand;
+            instruction->operands[1] = instruction->operands[0];
+            instruction->operand_count = 3;
+        }
+    }
+    else if (symbol->register_index >= 0)
+    {
+        int size = operand->size ? operand->size : codegen_is_dword(symbol) ? 4 : 8;
+        operand->kind = OPERAND_REGISTER;
+        operand->reg = allocatable_numbers[symbol->register_index];
+        operand->size = size;
+        operand->value = 0;
+    }
+}
+
+// Saves the registers in use and loads the variables live on entry, then
+// mirrors that in every block that returns.
+static void allocator_wrap(Allocator *allocator, int *stack_offset)
+{
+    ControlFlowGraph *cfg = allocator->cfg;
+    int used[ALLOCATABLE_REGISTER_COUNT] = {0};
+    for (int id = 0; id < allocator->variable_count; id++)
+    {
+        Symbol *symbol = allocator->intervals[id].symbol;
+        if (symbol && symbol->register_index >= 0)
+            used[symbol->register_index] = 1;
+    }
+
+    int saves[ALLOCATABLE_REGISTER_COUNT];
+    size_t inserted = 0;
+    BasicBlock *entry = cfg->blocks[0];
+    for (int r = 0; r < ALLOCATABLE_REGISTER_COUNT; r++)
+    {
+        if (!used[r])
+            continue;
+        *stack_offset += 8;
+        saves[r] = *stack_offset;
+        cfg_insert(entry, inserted++, "mov [rbp-%d], %s", saves[r], allocatable_registers[r]);
+    }
+    for (int id = 0; id < allocator->variable_count; id++)
+    {
+        Symbol *symbol = allocator->intervals[id].symbol;
+        if (symbol && symbol->register_index >= 0 && bitset_test(&allocator->live_in[0], id))
+            cfg_insert(entry, inserted++, "mov %s, [rbp-%d]", allocator_register_name(symbol), symbol->stack_offset);
+    }
+
+    // Every block that returns writes back what is live out of it and
+    // restores the caller's registers. A program that never returns has no
+    // such block and nothing to restore.
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        if (block->exit != EXIT_RETURN)
+            continue;
+        for (int id = 0; id < allocator->variable_count; id++)
+        {
+            Symbol *symbol = allocator->intervals[id].symbol;
+            if (symbol && symbol->register_index >= 0 && bitset_test(&allocator->live_out[i], id))
+                cfg_append(block, "mov [rbp-%d], %s", symbol->stack_offset, allocator_register_name(symbol));
+        }
+        for (int r = 0; r < ALLOCATABLE_REGISTER_COUNT; r++)
+        {
+            if (used[r])
+                cfg_append(block, "mov %s, [rbp-%d]", allocatable_registers[r], saves[r]);
+        }
+    }
+}
+
+RegisterAllocationStats register_allocate(ControlFlowGraph *cfg, SymbolTable *symbol_table, int *stack_offset)
+{
+    RegisterAllocationStats stats = {0, 0, 0};
+    size_t block_count = cfg->block_count;
+
+    Allocator allocator;
+    allocator.cfg = cfg;
+    allocator.slot_count = *stack_offset;
+    allocator.slots = (Symbol **)calloc(allocator.slot_count + 1, sizeof(Symbol *));
+    allocator.variable_count = symbol_table->symbol_count;
+    allocator.intervals = (LiveInterval *)calloc(allocator.variable_count + 1, sizeof(LiveInterval));
+    allocator.uses = (BitSet *)malloc(block_count * sizeof(BitSet));
+    allocator.defs = (BitSet *)malloc(block_count * sizeof(BitSet));
+    allocator.live_in = (BitSet *)malloc(block_count * sizeof(BitSet));
+    allocator.live_out = (BitSet *)malloc(block_count * sizeof(BitSet));
+    allocator.start = (int *)malloc(block_count * sizeof(int));
+    allocator.end = (int *)malloc(block_count * sizeof(int));
+    allocator.successor = (int *)malloc(block_count * sizeof(int));
+    allocator.branch_target = (int *)malloc(block_count * sizeof(int));
+    allocator.loop_depth = (int *)calloc(block_count, sizeof(int));
+
+    // Only variables the program leaves behind are live when it returns;
+    // the optimizer's temporaries start with '.'.
+    BitSet exit_live;
+    bitset_init(&exit_live, allocator.variable_count);
+    for (Symbol *symbol = symbol_table->head; symbol; symbol = symbol->next)
+    {
+        symbol->register_index = -1;
+        if (!symbol->stack_offset)
+            continue;
+        allocator.slots[symbol->stack_offset] = symbol;
+        LiveInterval *interval = &allocator.intervals[symbol->id];
+        interval->symbol = symbol;
+        interval->start = -1;
+        interval->end = -1;
+        interval->constant = 1;
+        if (symbol->name[0] != '.')
+            bitset_set(&exit_live, symbol->id);
+    }
+
+    allocator_index_edges(&allocator);
+    allocator_loop_depths(&allocator);
+    int position = 0;
+    for (size_t i = 0; i < block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        bitset_init(&allocator.uses[i], allocator.variable_count);
+        bitset_init(&allocator.defs[i], allocator.variable_count);
+        bitset_init(&allocator.live_in[i], allocator.variable_count);
+        bitset_init(&allocator.live_out[i], allocator.variable_count);
+        allocator.start[i] = position;
+        for (size_t j = 0; j <= block->instruction_count; j++)
+        {
+            allocator_record(&allocator, i, j, position++);
+        }
+        allocator.end[i] = position - 1;
+    }
+    allocator_liveness(&allocator, &exit_live);
+
+    for (int id = 0; id < allocator.variable_count; id++)
+    {
+        LiveInterval *interval = &allocator.intervals[id];
+        if (!interval->symbol)
+            continue;
+        for (size_t i = 0; i < block_count; i++)
+        {
+            if (bitset_test(&allocator.live_in[i], id))
+                allocator_extend(interval, allocator.start[i]);
+            if (bitset_test(&allocator.live_out[i], id))
+                allocator_extend(interval, allocator.end[i]);
+        }
+        // Rematerializing needs every read to see one of the definitions,
+        // never the value the variable starts with.
+        if (interval->constant && interval->definitions && !bitset_test(&allocator.live_in[0], id) &&
+            (!interval->immediate_reads || (interval->value >= INT32_MIN && interval->value <= INT32_MAX)))
+        {
+            interval->rematerialize = 1;
+            stats.rematerialized++;
+        }
+    }
+
+    allocator_scan(&allocator, &stats);
+    for (size_t i = 0; i < block_count; i++)
+    {
+        BasicBlock *block = cfg->blocks[i];
+        for (size_t j = 0; j <= block->instruction_count; j++)
+        {
+            allocator_rewrite(&allocator, block, j);
+        }
+    }
+    for (int id = 0; id < allocator.variable_count; id++)
+    {
+        Symbol *symbol = allocator.intervals[id].symbol;
+        stats.allocated += symbol && symbol->register_index >= 0;
+    }
+    if (stats.allocated)
+        allocator_wrap(&allocator, stack_offset);
+
+    for (size_t i = 0; i < block_count; i++)
+    {
+        bitset_free(&allocator.uses[i]);
+        bitset_free(&allocator.defs[i]);
+        bitset_free(&allocator.live_in[i]);
+        bitset_free(&allocator.live_out[i]);
+    }
+    bitset_free(&exit_live);
+    free(allocator.uses);
+    free(allocator.defs);
+    free(allocator.live_in);
+    free(allocator.live_out);
+    free(allocator.successor);
+    free(allocator.branch_target);
+    free(allocator.start);
+    free(allocator.end);
+    free(allocator.loop_depth);
+    free(allocator.intervals);
+    free(allocator.slots);
+    return stats;
+}
@@ -0,0 +1,671 @@
+#include "loop_analysis.h"
+
+// Scalar evolution keeps the value a variable holds at the top of iteration k
+// in the binomial basis, value(k) = sum of terms[j] * C(k, j), where the terms
+// are expressions over the values variables hold on loop entry. In that basis
+// stepping k and summing over iterations are both shifts of the terms, and the
+// identities hold modulo 2^64 just like the generated arithmetic.
+
+#define SCEV_MAX_DEGREE 3
+#define SCEV_TERMS (SCEV_MAX_DEGREE + 1)
+
+typedef struct
+{
+    ASTNode *terms[SCEV_TERMS];
+    long long self; // uses of the assigned variable's own previous value
+} Polynomial;
+
+typedef struct
+{
+    const char *name;
+    int id;
+    size_t index;
+    int solved;
+    int accumulates;
+    ASTNode *head[SCEV_TERMS];  // at the top of iteration k, when it accumulates
+    ASTNode *after[SCEV_TERMS]; // once iteration k has assigned it
+} Evolution;
+
+typedef struct
+{
+    Optimizer *optimizer;
+    ASTNode *body;
+    const BitSet *loop_defs;
+    Evolution *variables;
+    size_t variable_count;
+} ScalarEvolution;
+
+static int scev_value(ASTNode *term, unsigned long long *value)
+{
+    if (!term)
+    {
+        *value = 0;
+        return 1;
+    }
+    if (!optimizer_is_constant(term))
+        return 0;
+    *value = (unsigned long long)term->data.integer.value;
+    return 1;
+}
+
+static ASTNode *scev_constant(unsigned long long value)
+{
+    return value ? ast_create_integer((long long)value) : NULL;
+}
+
+static int scev_is_negation(ASTNode *term)
+{
+    return term->type == NODE_BINARY_OP && term->data.binary_op.operator== TOKEN_MINUS &&
+           optimizer_is_constant(term->data.binary_op.left) && term->data.binary_op.left->data.integer.value == 0;
+}
+
+// The term builders take ownership of their operands; NULL stands for zero.
+static ASTNode *scev_add(ASTNode *a, ASTNode *b)
+{
+    unsigned long long x, y;
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (scev_value(a, &x) && scev_value(b, &y))
+    {
+        ast_destroy_node(a);
+        ast_destroy_node(b);
+        return scev_constant(x + y);
+    }
+    if (scev_is_negation(b))
+    {
+        ASTNode *negated = b->data.binary_op.right;
+        b->data.binary_op.right = NULL;
+        ast_destroy_node(b);
+        return ast_create_binary_op(TOKEN_MINUS, a, negated);
+    }
+    return ast_create_binary_op(TOKEN_PLUS, a, b);
+}
+
+static ASTNode *scev_subtract(ASTNode *a, ASTNode *b)
+{
+    unsigned long long x, y;
+    if (!b)
+        return a;
+    if (scev_value(a, &x) && scev_value(b, &y))
+    {
+        ast_destroy_node(a);
+        ast_destroy_node(b);
+        return scev_constant(x - y);
+    }
+    return ast_create_binary_op(TOKEN_MINUS, a ? a : ast_create_integer(0), b);
+}
+
+static ASTNode *scev_multiply(ASTNode *a, ASTNode *b)
+{
+    unsigned long long x, y;
+    if (!a || !b)
+    {
+        ast_destroy_node(a);
+        ast_destroy_node(b);
+        return NULL;
+    }
+    int a_known = scev_value(a, &x);
+    int b_known = scev_value(b, &y);
+    if (a_known && b_known)
+    {
+        ast_destroy_node(a);
+        ast_destroy_node(b);
+        return scev_constant(x * y);
+    }
+    if (a_known && x == 1)
+    {
+        ast_destroy_node(a);
+        return b;
+    }
+    if (b_known && y == 1)
+    {
+        ast_destroy_node(b);
+        return a;
+    }
+    if (a_known && x == ~0ULL)
+    {
+        ast_destroy_node(a);
+        return scev_subtract(NULL, b);
+    }
+    if (b_known && y == ~0ULL)
+    {
+        ast_destroy_node(b);
+        return scev_subtract(NULL, a);
+    }
+    return ast_create_binary_op(TOKEN_MULTIPLY, a, b);
+}
+
+static void scev_clone_terms(ASTNode **dst, ASTNode **src)
+{
+    for (int j = 0; j < SCEV_TERMS; j++)
+    {
+        dst[j] = src[j] ? ast_clone(src[j]) : NULL;
+    }
+}
+
+static void scev_free_terms(ASTNode **terms)
+{
+    for (int j = 0; j < SCEV_TERMS; j++)
+    {
+        ast_destroy_node(terms[j]);
+        terms[j] = NULL;
+    }
+}
+
+static void polynomial_init(Polynomial *p)
+{
+    for (int j = 0; j < SCEV_TERMS; j++)
+    {
+        p->terms[j] = NULL;
+    }
+    p->self = 0;
+}
+
+static int polynomial_degree(Polynomial *p)
+{
+    for (int j = SCEV_MAX_DEGREE; j >= 0; j--)
+    {
+        if (p->terms[j])
+            return j;
+    }
+    return -1;
+}
+
+// Folds b into a, consuming b.
+static void polynomial_combine(Polynomial *a, Polynomial *b, TokenType operator)
+{
+    for (int j = 0; j < SCEV_TERMS; j++)
+    {
+        if (operator== TOKEN_PLUS)
+            a->terms[j] = scev_add(a->terms[j], b->terms[j]);
+        else
+            a->terms[j] = scev_subtract(a->terms[j], b->terms[j]);
+        b->terms[j] = NULL;
+    }
+    a->self += operator== TOKEN_PLUS ? b->self : -b->self;
+}
+
+static unsigned long long scev_factorial(int n)
+{
+    unsigned long long result = 1;
+    for (int i = 2; i <= n; i++)
+    {
+        result *= i;
+    }
+    return result;
+}
+
+// Multiplies two polynomials whose degrees add up to at most the limit,
+// expanding C(k, i) * C(k, j) as the sum over l of
+// (i + j - l)! / (l! (i - l)! (j - l)!) * C(k, i + j - l). Consumes both
+// operands.
+static int polynomial_multiply(Polynomial *a, Polynomial *b, Polynomial *out)
+{
+    polynomial_init(out);
+    int ok = !a->self && !b->self && polynomial_degree(a) + polynomial_degree(b) <= SCEV_MAX_DEGREE;
+
+    for (int i = 0; ok && i < SCEV_TERMS; i++)
+    {
+        for (int j = 0; j < SCEV_TERMS; j++)
+        {
+            if (!a->terms[i] || !b->terms[j])
+                continue;
+
+            ASTNode *product = scev_multiply(ast_clone(a->terms[i]), ast_clone(b->terms[j]));
+            for (int l = 0; l <= i && l <= j && product; l++)
+            {
+                unsigned long long weight = scev_factorial(i + j - l) /
+                                            (scev_factorial(l) * scev_factorial(i - l) * scev_factorial(j - l));
+                out->terms[i + j - l] = scev_add(out->terms[i + j - l],
+                                                 scev_multiply(scev_constant(weight), ast_clone(product)));
+            }
+            ast_destroy_node(product);
+        }
+    }
+
+    scev_free_terms(a->terms);
+    scev_free_terms(b->terms);
+    if (!ok)
+        scev_free_terms(out->terms);
+    return ok;
+}
+
+// value(k + 1) from value(k): C(k + 1, j) = C(k, j) + C(k, j - 1).
+static void scev_shift_forward(ASTNode **terms, ASTNode **shifted)
+{
+    for (int j = 0; j < SCEV_TERMS; j++)
+    {
+        shifted[j] = scev_add(terms[j] ? ast_clone(terms[j]) : NULL,
+                              j + 1 < SCEV_TERMS && terms[j + 1] ? ast_clone(terms[j + 1]) : NULL);
+    }
+}
+
+// value(k - 1) from value(k), inverting scev_shift_forward from the top down.
+static void scev_shift_back(ASTNode **terms, ASTNode **shifted)
+{
+    shifted[SCEV_MAX_DEGREE] = terms[SCEV_MAX_DEGREE] ? ast_clone(terms[SCEV_MAX_DEGREE]) : NULL;
+    for (int j = SCEV_MAX_DEGREE - 1; j >= 0; j--)
+    {
+        shifted[j] = scev_subtract(terms[j] ? ast_clone(terms[j]) : NULL,
+                                   shifted[j + 1] ? ast_clone(shifted[j + 1]) : NULL);
+    }
+}
+
+static Evolution *scev_find(ScalarEvolution *se, const char *name)
+{
+    for (size_t i = 0; i < se->variable_count; i++)
+    {
+        if (strcmp(se->variables[i].name, name) == 0)
+            return &se->variables[i];
+    }
+    return NULL;
+}
+
+static int scev_varies(ScalarEvolution *se, ASTNode *expression)
+{
+    BitSet uses;
+    bitset_init(&uses, 0);
+    dataflow_collect_uses(se->optimizer->symbol_table, expression, &uses);
+    int varies = bitset_intersects(&uses, se->loop_defs);
+    bitset_free(&uses);
+    return varies;
+}
+
+static int scev_reads(ScalarEvolution *se, ASTNode *expression, int id)
+{
+    BitSet uses;
+    bitset_init(&uses, 0);
+    dataflow_collect_uses(se->optimizer->symbol_table, expression, &uses);
+    int reads = bitset_test(&uses, id);
+    bitset_free(&uses);
+    return reads;
+}
+
+// Expresses `expression`, evaluated where `target` is assigned, as a
+// polynomial in the iteration number.
+static int scev_evaluate(ScalarEvolution *se, ASTNode *expression, Evolution *target, Polynomial *out)
+{
+    polynomial_init(out);
+
+    if (!scev_varies(se, expression))
+    {
+        unsigned long long value;
+        if (!scev_value(expression, &value) || value)
+            out->terms[0] = ast_clone(expression);
+        return 1;
+    }
+
+    if (expression->type == NODE_IDENTIFIER)
+    {
+        Evolution *variable = scev_find(se, expression->data.identifier.name);
+        if (variable == target)
+        {
+            out->self = 1;
+            return 1;
+        }
+        if (!variable->solved)
+            return 0;
+
+        // Earlier statements have already assigned this iteration's value.
+        if (variable->index < target->index)
+            scev_clone_terms(out->terms, variable->after);
+        else if (variable->accumulates)
+            scev_clone_terms(out->terms, variable->head);
+        else
+            return 0;
+        return 1;
+    }
+
+    if (expression->type != NODE_BINARY_OP)
+        return 0;
+
+    Polynomial left, right;
+    if (!scev_evaluate(se, expression->data.binary_op.left, target, &left))
+        return 0;
+    if (!scev_evaluate(se, expression->data.binary_op.right, target, &right))
+    {
+        scev_free_terms(left.terms);
+        return 0;
+    }
+
+    unsigned long long shift;
+    switch (expression->data.binary_op.operator)
+    {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+        polynomial_combine(&left, &right, expression->data.binary_op.operator);
+        *out = left;
+        return 1;
+
+    case TOKEN_MULTIPLY:
+        return polynomial_multiply(&left, &right, out);
+
+    case TOKEN_SHIFT_LEFT:
+        // A constant shift is a multiplication by a power of two.
+        if (!right.self && polynomial_degree(&right) <= 0 && scev_value(right.terms[0], &shift))
+        {
+            scev_free_terms(right.terms);
+            right.terms[0] = ast_create_integer((long long)(1ULL << (shift & 63)));
+            return polynomial_multiply(&left, &right, out);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    scev_free_terms(left.terms);
+    scev_free_terms(right.terms);
+    return 0;
+}
+
+static int scev_solve(ScalarEvolution *se, Evolution *variable)
+{
+    ASTNode *value = se->body->data.block.statements[variable->index]->data.assignment.value;
+    Polynomial update;
+    if (!scev_evaluate(se, value, variable, &update))
+        return 0;
+
+    if (update.self == 1 && polynomial_degree(&update) < SCEV_MAX_DEGREE)
+    {
+        // v(k + 1) = v(k) + d(k), and summing C(m, j) over m < k gives
+        // C(k, j + 1), so the terms of d move up one degree.
+        variable->accumulates = 1;
+        variable->head[0] = ast_create_identifier(variable->name);
+        for (int j = 0; j < SCEV_MAX_DEGREE; j++)
+        {
+            variable->head[j + 1] = update.terms[j];
+        }
+        scev_shift_forward(variable->head, variable->after);
+    }
+    else if (update.self == 0)
+    {
+        variable->accumulates = 0;
+        for (int j = 0; j < SCEV_TERMS; j++)
+        {
+            variable->after[j] = update.terms[j];
+        }
+    }
+    else
+    {
+        scev_free_terms(update.terms);
+        return 0;
+    }
+
+    variable->solved = 1;
+    return 1;
+}
+
+static ASTNode *scev_evaluate_at(ASTNode **terms, ASTNode **binomials)
+{
+    ASTNode *result = terms[0] ? ast_clone(terms[0]) : NULL;
+    for (int j = 1; j < SCEV_TERMS; j++)
+    {
+        if (terms[j])
+            result = scev_add(result, scev_multiply(ast_clone(terms[j]), ast_clone(binomials[j])));
+    }
+    return result ? result : ast_create_integer(0);
+}
+
+// Emits `target = C(n, 2)` modulo 2^64 for an unsigned count n held in a
+// variable. Halving the even factor first keeps the product exact; signed
+// division is off by 2^63 when n is past INT64_MAX, which the last step
+// corrects unless the count is known to fit.
+static void scev_emit_choose_two(ASTNode *block, const char *target, const char *count,
+                                 int nonnegative)
+{
+    ASTNode *even = ast_create_binary_op(TOKEN_EQUAL,
+                                         ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(count),
+                                                              ast_create_binary_op(TOKEN_MULTIPLY,
+                                                                                   ast_create_binary_op(TOKEN_DIVIDE, ast_create_identifier(count), ast_create_integer(2)),
+                                                                                   ast_create_integer(2))),
+                                         ast_create_integer(0));
+    ASTNode *half_first = ast_create_binary_op(TOKEN_MULTIPLY,
+                                               ast_create_binary_op(TOKEN_DIVIDE, ast_create_identifier(count), ast_create_integer(2)),
+                                               ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(count), ast_create_integer(1)));
+    ASTNode *half_second = ast_create_binary_op(TOKEN_MULTIPLY,
+                                                ast_create_binary_op(TOKEN_DIVIDE,
+                                                                     ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(count), ast_create_integer(1)),
+                                                                     ast_create_integer(2)),
+                                                ast_create_identifier(count));
+
+    ast_add_statement(block, ast_create_if(even, ast_create_assignment(target, half_first),
+                                           ast_create_assignment(target, half_second)));
+
+    if (!nonnegative)
+    {
+        ASTNode *correction = ast_create_binary_op(TOKEN_SHIFT_LEFT,
+                                                   ast_create_binary_op(TOKEN_LESS, ast_create_identifier(count), ast_create_integer(0)),
+                                                   ast_create_integer(63));
+        ast_add_statement(block, ast_create_assignment(target, ast_create_binary_op(TOKEN_PLUS, ast_create_identifier(target),
+                                                                                    correction)));
+    }
+}
+
+static ASTNode *scev_closed_form(ScalarEvolution *se, TripCount *trip, ASTNode *loop)
+{
+    Optimizer *optimizer = se->optimizer;
+    ASTNode *block = ast_create_block();
+    ASTNode *binomials[SCEV_TERMS] = {NULL};
+
+    BitSet live;
+    bitset_init(&live, 0);
+    optimizer_live_after(optimizer, loop, &live);
+
+    ASTNode **results = (ASTNode **)calloc(se->variable_count, sizeof(ASTNode *));
+    const char **staged = (const char **)calloc(se->variable_count, sizeof(const char *));
+    int degree = 0;
+    for (size_t i = 0; i < se->variable_count; i++)
+    {
+        Evolution *variable = &se->variables[i];
+        ASTNode **terms = variable->accumulates ? variable->head : variable->after;
+        for (int j = degree + 1; j < SCEV_TERMS && bitset_test(&live, variable->id); j++)
+        {
+            if (terms[j])
+                degree = j;
+        }
+    }
+
+    // C(n, 3) = C(n, 2) * (n - 2) / 3, and 3 is invertible modulo 2^64.
+    const unsigned long long inverse_of_three = 0xAAAAAAAAAAAAAAABULL;
+    unsigned long long count;
+    if (scev_value(trip->count, &count))
+    {
+        unsigned long long second = count % 2 == 0 ? count / 2 * (count - 1) : (count - 1) / 2 * count;
+        binomials[1] = ast_create_integer((long long)count);
+        binomials[2] = ast_create_integer((long long)second);
+        binomials[3] = ast_create_integer((long long)(second * (count - 2) * inverse_of_three));
+    }
+    else
+    {
+        const char *count_name = optimizer_new_temporary(optimizer);
+        ast_add_statement(block, ast_create_assignment(count_name, ast_clone(trip->count)));
+        binomials[1] = ast_create_identifier(count_name);
+        if (degree >= 2)
+        {
+            const char *second_name = optimizer_new_temporary(optimizer);
+            scev_emit_choose_two(block, second_name, count_name, trip->nonnegative);
+            binomials[2] = ast_create_identifier(second_name);
+        }
+        if (degree >= 3)
+        {
+            const char *third_name = optimizer_new_temporary(optimizer);
+            ASTNode *third = ast_create_binary_op(TOKEN_MULTIPLY,
+                                                  ast_create_binary_op(TOKEN_MULTIPLY, ast_create_identifier(binomials[2]->data.identifier.name),
+                                                                       ast_create_binary_op(TOKEN_MINUS, ast_create_identifier(count_name), ast_create_integer(2))),
+                                                  ast_create_integer((long long)inverse_of_three));
+            ast_add_statement(block, ast_create_assignment(third_name, third));
+            binomials[3] = ast_create_identifier(third_name);
+        }
+    }
+
+    // A variable assigned only as a copy of others is R(k) after iteration k,
+    // so its exit value is that polynomial one step back.
+    for (size_t i = 0; i < se->variable_count; i++)
+    {
+        Evolution *variable = &se->variables[i];
+        if (!bitset_test(&live, variable->id))
+            continue;
+
+        if (variable->accumulates)
+        {
+            results[i] = scev_evaluate_at(variable->head, binomials);
+        }
+        else
+        {
+            ASTNode *previous[SCEV_TERMS];
+            scev_shift_back(variable->after, previous);
+            results[i] = scev_evaluate_at(previous, binomials);
+            scev_free_terms(previous);
+        }
+
+        if (results[i]->type == NODE_IDENTIFIER && strcmp(results[i]->data.identifier.name, variable->name) == 0)
+        {
+            ast_destroy_node(results[i]);
+            results[i] = NULL;
+        }
+    }
+
+    // Results read entry values, so each variable is assigned once no pending
+    // result reads it; a cycle is broken by staging one result in a temporary
+    // that is copied back last.
+    size_t pending = 0;
+    for (size_t i = 0; i < se->variable_count; i++)
+    {
+        pending += results[i] != NULL;
+    }
+    while (pending)
+    {
+        int progress = 0;
+        for (size_t i = 0; i < se->variable_count; i++)
+        {
+            if (!results[i])
+                continue;
+
+            int read = 0;
+            for (size_t j = 0; j < se->variable_count && !read; j++)
+            {
+                read = j != i && results[j] && scev_reads(se, results[j], se->variables[i].id);
+            }
+            if (read)
+                continue;
+
+            ast_add_statement(block, ast_create_assignment(se->variables[i].name, results[i]));
+            results[i] = NULL;
+            pending--;
+            progress = 1;
+        }
+
+        for (size_t i = 0; i < se->variable_count && !progress; i++)
+        {
+            if (!results[i])
+                continue;
+            staged[i] = optimizer_new_temporary(optimizer);
+            ast_add_statement(block, ast_create_assignment(staged[i], results[i]));
+            results[i] = NULL;
+            pending--;
+            progress = 1;
+        }
+    }
+    for (size_t i = 0; i < se->variable_count; i++)
+    {
+        if (staged[i])
+            ast_add_statement(block, ast_create_assignment(se->variables[i].name, ast_create_identifier(staged[i])));
+    }
+
+    free(results);
+    free(staged);
+    scev_free_terms(binomials);
+    bitset_free(&live);
+
+    if (!trip->guarded)
+        return block;
+    return ast_create_if(ast_clone(loop->data.while_loop.condition), block, NULL);
+}
+
+static ASTNode *scev_replace_loop(Optimizer *optimizer, ASTNode **statements, size_t loop_index, ASTNode *loop)
+{
+    LoopInfo info;
+    loop_analyze(optimizer, loop, &info);
+
+    // Only straight-line bodies assigning each variable once are modelled.
+    ASTNode *body = info.body;
+    for (size_t i = 0; i < body->data.block.statement_count; i++)
+    {
+        ASTNode *statement = body->data.block.statements[i];
+        if (statement->type != NODE_ASSIGNMENT ||
+            loop_count_assignments(body, statement->data.assignment.name) != 1)
+        {
+            loop_info_free(&info);
+            return loop;
+        }
+    }
+
+    TripCount trip;
+    if (!loop_trip_count(optimizer, &info, statements, loop_index, &trip))
+    {
+        loop_info_free(&info);
+        return loop;
+    }
+
+    ScalarEvolution se;
+    se.optimizer = optimizer;
+    se.body = body;
+    se.loop_defs = &optimizer_def_use(optimizer, body)->defs;
+    se.variable_count = body->data.block.statement_count;
+    se.variables = (Evolution *)calloc(se.variable_count ? se.variable_count : 1, sizeof(Evolution));
+    for (size_t i = 0; i < se.variable_count; i++)
+    {
+        Evolution *variable = &se.variables[i];
+        variable->name = body->data.block.statements[i]->data.assignment.name;
+        variable->id = symbol_table_get_id(optimizer->symbol_table, variable->name);
+        variable->index = i;
+    }
+
+    // Solve in dependency order; anything left over (a cycle or an operator
+    // with no polynomial form) keeps the loop.
+    size_t solved = 0;
+    int progress = 1;
+    while (progress)
+    {
+        progress = 0;
+        for (size_t i = 0; i < se.variable_count; i++)
+        {
+            if (!se.variables[i].solved && scev_solve(&se, &se.variables[i]))
+            {
+                solved++;
+                progress = 1;
+            }
+        }
+    }
+
+    ASTNode *result = loop;
+    unsigned long long count;
+    if (solved == se.variable_count)
+    {
+        // A loop that provably never runs has nothing to compute.
+        if (!trip.guarded && scev_value(trip.count, &count) && count == 0)
+            result = ast_create_block();
+        else
+            result = scev_closed_form(&se, &trip, loop);
+        ast_destroy_node(loop);
+        optimizer->changes_made++;
+    }
+
+    for (size_t i = 0; i < se.variable_count; i++)
+    {
+        scev_free_terms(se.variables[i].head);
+        scev_free_terms(se.variables[i].after);
+    }
+    free(se.variables);
+    trip_count_free(&trip);
+    loop_info_free(&info);
+    return result;
+}
+
+ASTNode *optimizer_scalar_evolution(Optimizer *optimizer, ASTNode *node)
+{
+    return loop_rewrite(optimizer, node, scev_replace_loop);
+}
@@ -0,0 +1,182 @@
+#include "simplifier.h"
+
+const SimplifyRule simplify_rules[] = {
+    {"x + 0", TOKEN_PLUS, OPERAND_ANY, OPERAND_ZERO, RESULT_LEFT, TOKEN_EOF},
+    {"0 + x", TOKEN_PLUS, OPERAND_ZERO, OPERAND_ANY, RESULT_RIGHT, TOKEN_EOF},
+    {"x - 0", TOKEN_MINUS, OPERAND_ANY, OPERAND_ZERO, RESULT_LEFT, TOKEN_EOF},
+    {"x * 1", TOKEN_MULTIPLY, OPERAND_ANY, OPERAND_ONE, RESULT_LEFT, TOKEN_EOF},
+    {"1 * x", TOKEN_MULTIPLY, OPERAND_ONE, OPERAND_ANY, RESULT_RIGHT, TOKEN_EOF},
+    {"x * 0", TOKEN_MULTIPLY, OPERAND_ANY, OPERAND_ZERO, RESULT_ZERO, TOKEN_EOF},
+    {"0 * x", TOKEN_MULTIPLY, OPERAND_ZERO, OPERAND_ANY, RESULT_ZERO, TOKEN_EOF},
+    {"x / 1", TOKEN_DIVIDE, OPERAND_ANY, OPERAND_ONE, RESULT_LEFT, TOKEN_EOF},
+    {"x << 0", TOKEN_SHIFT_LEFT, OPERAND_ANY, OPERAND_ZERO, RESULT_LEFT, TOKEN_EOF},
+    {"0 << x", TOKEN_SHIFT_LEFT, OPERAND_ZERO, OPERAND_ANY, RESULT_ZERO, TOKEN_EOF},
+    {"x - x", TOKEN_MINUS, OPERAND_ANY, OPERAND_SAME, RESULT_ZERO, TOKEN_EOF},
+    {"x == x", TOKEN_EQUAL, OPERAND_ANY, OPERAND_SAME, RESULT_ONE, TOKEN_EOF},
+    {"x != x", TOKEN_NOT_EQUAL, OPERAND_ANY, OPERAND_SAME, RESULT_ZERO, TOKEN_EOF},
+    {"x < x", TOKEN_LESS, OPERAND_ANY, OPERAND_SAME, RESULT_ZERO, TOKEN_EOF},
+    {"x > x", TOKEN_GREATER, OPERAND_ANY, OPERAND_SAME, RESULT_ZERO, TOKEN_EOF},
+    {"0 - (0 - x)", TOKEN_MINUS, OPERAND_ZERO, OPERAND_NEGATION, RESULT_NEGATED, TOKEN_EOF},
+    {"x - (0 - y)", TOKEN_MINUS, OPERAND_ANY, OPERAND_NEGATION, RESULT_COMBINED, TOKEN_PLUS},
+    {"x + (0 - y)", TOKEN_PLUS, OPERAND_ANY, OPERAND_NEGATION, RESULT_COMBINED, TOKEN_MINUS},
+};
+
+const size_t simplify_rule_count = sizeof(simplify_rules) / sizeof(simplify_rules[0]);
+
+static int simplify_is_integer(ASTNode *node, long long value)
+{
+    return optimizer_is_constant(node) && node->data.integer.value == value;
+}
+
+static int simplify_is_negation(ASTNode *node)
+{
+    return node->type == NODE_BINARY_OP && node->data.binary_op.operator== TOKEN_MINUS &&
+           simplify_is_integer(node->data.binary_op.left, 0);
+}
+
+static int simplify_matches(OperandPattern pattern, ASTNode *operand, ASTNode *left)
+{
+    switch (pattern)
+    {
+    case OPERAND_ANY:
+        return 1;
+    case OPERAND_ZERO:
+        return simplify_is_integer(operand, 0);
+    case OPERAND_ONE:
+        return simplify_is_integer(operand, 1);
+    case OPERAND_SAME:
+        return ast_equal(operand, left);
+    case OPERAND_NEGATION:
+        return simplify_is_negation(operand);
+    }
+    return 0;
+}
+
+static const SimplifyRule *simplify_find_rule(ASTNode *node)
+{
+    ASTNode *left = node->data.binary_op.left;
+    ASTNode *right = node->data.binary_op.right;
+
+    for (size_t i = 0; i < simplify_rule_count; i++)
+    {
+        const SimplifyRule *rule = &simplify_rules[i];
+        if (rule->operator!= node->data.binary_op.operator||
+            !simplify_matches(rule->left, left, left) ||
+            !simplify_matches(rule->right, right, left))
+            continue;
+
+        // A constant result drops both operands, which must not fault.
+        if ((rule->result == RESULT_ZERO || rule->result == RESULT_ONE) &&
+            (optimizer_expression_may_trap(left) || optimizer_expression_may_trap(right)))
+            continue;
+
+        return rule;
+    }
+    return NULL;
+}
+
+static ASTNode *simplify_apply(const SimplifyRule *rule, ASTNode *node)
+{
+    ASTNode *left = node->data.binary_op.left;
+    ASTNode *right = node->data.binary_op.right;
+    ASTNode *result;
+
+    switch (rule->result)
+    {
+    case RESULT_LEFT:
+        result = left;
+        node->data.binary_op.left = NULL;
+        break;
+    case RESULT_RIGHT:
+        result = right;
+        node->data.binary_op.right = NULL;
+        break;
+    case RESULT_ZERO:
+        result = ast_create_integer(0);
+        break;
+    case RESULT_ONE:
+        result = ast_create_integer(1);
+        break;
+    case RESULT_NEGATED:
+        result = right->data.binary_op.right;
+        right->data.binary_op.right = NULL;
+        break;
+    case RESULT_COMBINED:
+        result = ast_create_binary_op(rule->rewrite, left, right->data.binary_op.right);
+        node->data.binary_op.left = NULL;
+        right->data.binary_op.right = NULL;
+        break;
+    default:
+        return node;
+    }
+
+    ast_destroy_node(node);
+    return result;
+}
+
+// Rewrites bottom-up, so each rule sees operands that are already simplified.
+ASTNode *optimizer_simplify_expression(ASTNode *node)
+{
+    if (!node || node->type != NODE_BINARY_OP)
+        return node;
+
+    node->data.binary_op.left = optimizer_simplify_expression(node->data.binary_op.left);
+    node->data.binary_op.right = optimizer_simplify_expression(node->data.binary_op.right);
+
+    const SimplifyRule *rule = simplify_find_rule(node);
+    if (!rule)
+        return node;
+
+    // The result may itself match a rule, e.g. `(x - x) + y`.
+    return optimizer_simplify_expression(simplify_apply(rule, node));
+}
+
+static ASTNode *simplify_operand(Optimizer *optimizer, ASTNode *expression)
+{
+    // Every rule shrinks the tree, so a smaller tree means something fired.
+    int size = ast_size(expression);
+    expression = optimizer_simplify_expression(expression);
+    if (ast_size(expression) != size)
+        optimizer->changes_made++;
+    return expression;
+}
+
+ASTNode *optimizer_algebraic_simplification(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    int changes_before = optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            node->data.block.statements[i] = optimizer_algebraic_simplification(optimizer, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_IF:
+        node->data.if_stmt.condition = simplify_operand(optimizer, node->data.if_stmt.condition);
+        node->data.if_stmt.if_body = optimizer_algebraic_simplification(optimizer, node->data.if_stmt.if_body);
+        node->data.if_stmt.else_body = optimizer_algebraic_simplification(optimizer, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        node->data.while_loop.condition = simplify_operand(optimizer, node->data.while_loop.condition);
+        node->data.while_loop.body = optimizer_algebraic_simplification(optimizer, node->data.while_loop.body);
+        break;
+
+    case NODE_ASSIGNMENT:
+        node->data.assignment.value = simplify_operand(optimizer, node->data.assignment.value);
+        break;
+
+    default:
+        break;
+    }
+
+    optimizer_note_rewrites(optimizer, node, changes_before);
+    return node;
+}
@@ -1,4 +1,5 @@
 #include "symbol_table.h"
+#include <limits.h>
 #include <stdio.h>
 
 SymbolTable *symbol_table_create(void)
@@ -6,6 +7,10 @@ SymbolTable *symbol_table_create(void)
     SymbolTable *table = (SymbolTable *)malloc(sizeof(SymbolTable));
     table->head = NULL;
     table->current_scope = 0;
+    table->symbol_count = 0;
+    table->source_names = NULL;
+    table->source_count = 0;
+    table->source_capacity = 0;
     return table;
 }
 
@@ -19,6 +24,11 @@ void symbol_table_destroy(SymbolTable *table)
         free(current);
         current = next;
     }
+    for (int i = 0; i < table->source_count; i++)
+    {
+        free(table->source_names[i]);
+    }
+    free(table->source_names);
     free(table);
 }
 
@@ -45,8 +55,13 @@ Symbol *symbol_table_add(SymbolTable *table, const char *name, SymbolType type)
     Symbol *symbol = (Symbol *)malloc(sizeof(Symbol));
     symbol->name = strdup(name);
     symbol->type = type;
+    symbol->id = table->symbol_count++;
     symbol->scope_level = table->current_scope;
     symbol->is_initialized = 0;
+    symbol->stack_offset = 0;
+    symbol->register_index = -1;
+    symbol->low = LLONG_MIN;
+    symbol->high = LLONG_MAX;
 
     
     symbol->next = table->head;
@@ -94,6 +109,31 @@ Symbol *symbol_table_lookup_current_scope(SymbolTable *table, const char *name)
     return NULL;
 }
 
+int symbol_table_get_id(SymbolTable *table, const char *name)
+{
+    Symbol *symbol = symbol_table_lookup(table, name);
+    if (symbol == NULL)
+    {
+        symbol = symbol_table_add(table, name, SYMBOL_INTEGER);
+    }
+    return symbol->id;
+}
+
+void symbol_table_note_source(SymbolTable *table, const char *name)
+{
+    for (int i = 0; i < table->source_count; i++)
+    {
+        if (strcmp(table->source_names[i], name) == 0)
+            return;
+    }
+    if (table->source_count >= table->source_capacity)
+    {
+        table->source_capacity = table->source_capacity ? table->source_capacity * 2 : 8;
+        table->source_names = (char **)realloc(table->source_names, table->source_capacity * sizeof(char *));
+    }
+    table->source_names[table->source_count++] = strdup(name);
+}
+
 void symbol_table_mark_initialized(SymbolTable *table, const char *name)
 {
     Symbol *symbol = symbol_table_lookup(table, name);
@@ -0,0 +1,503 @@
+#include "optimizer.h"
+
+// Value numbering over the structured AST. Code before an if or while
+// dominates its bodies, so each body is a scope: expressions it makes
+// available are dropped on exit, and variables it assigns get fresh numbers
+// after it. A repeated expression reuses the variable already holding its
+// value, or its first occurrence is moved into a temporary both can read.
+
+#define VN_INITIAL_CAPACITY 64
+
+typedef struct
+{
+    TokenType operator;
+    int left;
+    int right;
+    int number; // 0 marks an empty slot
+} ExpressionKey;
+
+typedef struct
+{
+    int number;
+    int holder_id; // variable holding the value, or -1
+    const char *holder;
+    ASTNode **slot;     // first occurrence, while it can still be moved out
+    ASTNode *container; // statement (or temporary assignment) holding slot
+    int shadowed;       // entry for the same number in an outer scope, or -1
+} Available;
+
+typedef struct
+{
+    int id;
+    int number;
+} Rebinding;
+
+typedef struct
+{
+    ASTNode *before;
+    ASTNode *assignment;
+} Insertion;
+
+typedef struct
+{
+    Optimizer *optimizer;
+    int next_number;
+
+    ExpressionKey *table;
+    size_t table_capacity;
+    size_t table_count;
+
+    int *variable_numbers;
+    size_t variable_capacity;
+    Rebinding *rebindings;
+    size_t rebinding_count;
+    size_t rebinding_capacity;
+
+    Available *available;
+    size_t available_count;
+    size_t available_capacity;
+    int *top_entry;
+    size_t top_capacity;
+
+    Insertion *insertions;
+    size_t insertion_count;
+} ValueNumbering;
+
+static void vn_grow_ints(int **array, size_t *capacity, size_t needed, int fill)
+{
+    if (needed <= *capacity)
+        return;
+
+    size_t grown = *capacity ? *capacity : VN_INITIAL_CAPACITY;
+    while (grown < needed)
+    {
+        grown *= 2;
+    }
+    *array = (int *)realloc(*array, grown * sizeof(int));
+    for (size_t i = *capacity; i < grown; i++)
+    {
+        (*array)[i] = fill;
+    }
+    *capacity = grown;
+}
+
+static unsigned int vn_hash(TokenType op, int left, int right)
+{
+    unsigned int hash = (unsigned int)op * 2654435761u;
+    hash = (hash ^ (unsigned int)left) * 2246822519u;
+    hash = (hash ^ (unsigned int)right) * 3266489917u;
+    return hash ^ (hash >> 15);
+}
+
+static void vn_rehash(ValueNumbering *vn);
+
+// Hash-conses (operator, left, right) to a value number.
+static int vn_lookup(ValueNumbering *vn, TokenType op, int left, int right)
+{
+    if ((vn->table_count + 1) * 2 > vn->table_capacity)
+        vn_rehash(vn);
+
+    size_t mask = vn->table_capacity - 1;
+    size_t i = vn_hash(op, left, right) & mask;
+    while (vn->table[i].number)
+    {
+        ExpressionKey *key = &vn->table[i];
+        if (key->operator == op && key->left == left && key->right == right)
+            return key->number;
+        i = (i + 1) & mask;
+    }
+
+    vn->table[i].operator = op;
+    vn->table[i].left = left;
+    vn->table[i].right = right;
+    vn->table[i].number = vn->next_number++;
+    vn->table_count++;
+    return vn->table[i].number;
+}
+
+static void vn_rehash(ValueNumbering *vn)
+{
+    ExpressionKey *old = vn->table;
+    size_t old_capacity = vn->table_capacity;
+
+    vn->table_capacity = old_capacity ? old_capacity * 2 : VN_INITIAL_CAPACITY;
+    vn->table = (ExpressionKey *)calloc(vn->table_capacity, sizeof(ExpressionKey));
+    size_t mask = vn->table_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old[i].number)
+            continue;
+        size_t j = vn_hash(old[i].operator, old[i].left, old[i].right) & mask;
+        while (vn->table[j].number)
+        {
+            j = (j + 1) & mask;
+        }
+        vn->table[j] = old[i];
+    }
+    free(old);
+}
+
+static int vn_variable(ValueNumbering *vn, const char *name)
+{
+    int id = symbol_table_get_id(vn->optimizer->symbol_table, name);
+    vn_grow_ints(&vn->variable_numbers, &vn->variable_capacity, id + 1, 0);
+    if (!vn->variable_numbers[id])
+        vn->variable_numbers[id] = vn->next_number++;
+    return vn->variable_numbers[id];
+}
+
+// Rebinds a variable, logging the old number so scopes can undo it.
+static void vn_bind(ValueNumbering *vn, int id, int number)
+{
+    vn_grow_ints(&vn->variable_numbers, &vn->variable_capacity, id + 1, 0);
+    if (vn->rebinding_count == vn->rebinding_capacity)
+    {
+        vn->rebinding_capacity = vn->rebinding_capacity ? vn->rebinding_capacity * 2 : VN_INITIAL_CAPACITY;
+        vn->rebindings = (Rebinding *)realloc(vn->rebindings, vn->rebinding_capacity * sizeof(Rebinding));
+    }
+    vn->rebindings[vn->rebinding_count].id = id;
+    vn->rebindings[vn->rebinding_count].number = vn->variable_numbers[id];
+    vn->rebinding_count++;
+    vn->variable_numbers[id] = number;
+}
+
+static void vn_unbind_to(ValueNumbering *vn, size_t mark)
+{
+    while (vn->rebinding_count > mark)
+    {
+        Rebinding *rebinding = &vn->rebindings[--vn->rebinding_count];
+        vn->variable_numbers[rebinding->id] = rebinding->number;
+    }
+}
+
+static void vn_bind_fresh(ValueNumbering *vn, const BitSet *variables)
+{
+    for (size_t id = 0; id < variables->word_count * BITSET_WORD_BITS; id++)
+    {
+        if (bitset_test(variables, id))
+            vn_bind(vn, (int)id, vn->next_number++);
+    }
+}
+
+static int vn_expression(ValueNumbering *vn, ASTNode *expression)
+{
+    switch (expression->type)
+    {
+    case NODE_INTEGER:
+    {
+        // Constants share the table, split across the operand fields.
+        unsigned long long value = (unsigned long long)expression->data.integer.value;
+        return vn_lookup(vn, TOKEN_INTEGER, (int)(value >> 32), (int)(value & 0xFFFFFFFFu));
+    }
+    case NODE_IDENTIFIER:
+        return vn_variable(vn, expression->data.identifier.name);
+    case NODE_BINARY_OP:
+    {
+        TokenType op = expression->data.binary_op.operator;
+        int left = vn_expression(vn, expression->data.binary_op.left);
+        int right = vn_expression(vn, expression->data.binary_op.right);
+        int commutative = op == TOKEN_PLUS || op == TOKEN_MULTIPLY ||
+                          op == TOKEN_EQUAL || op == TOKEN_NOT_EQUAL;
+        if (commutative && left > right)
+        {
+            int swap = left;
+            left = right;
+            right = swap;
+        }
+        return vn_lookup(vn, op, left, right);
+    }
+    default:
+        return vn->next_number++;
+    }
+}
+
+static Available *vn_find(ValueNumbering *vn, int number)
+{
+    if ((size_t)number >= vn->top_capacity || vn->top_entry[number] < 0)
+        return NULL;
+    return &vn->available[vn->top_entry[number]];
+}
+
+static void vn_push(ValueNumbering *vn, int number, ASTNode **slot, ASTNode *container)
+{
+    if (vn->available_count == vn->available_capacity)
+    {
+        vn->available_capacity = vn->available_capacity ? vn->available_capacity * 2 : VN_INITIAL_CAPACITY;
+        vn->available = (Available *)realloc(vn->available, vn->available_capacity * sizeof(Available));
+    }
+    vn_grow_ints(&vn->top_entry, &vn->top_capacity, number + 1, -1);
+
+    Available *entry = &vn->available[vn->available_count];
+    entry->number = number;
+    entry->holder_id = -1;
+    entry->holder = NULL;
+    entry->slot = slot;
+    entry->container = container;
+    entry->shadowed = vn->top_entry[number];
+    vn->top_entry[number] = (int)vn->available_count++;
+}
+
+static void vn_pop_to(ValueNumbering *vn, size_t mark)
+{
+    while (vn->available_count > mark)
+    {
+        Available *entry = &vn->available[--vn->available_count];
+        vn->top_entry[entry->number] = entry->shadowed;
+    }
+}
+
+static void vn_set_holder(ValueNumbering *vn, Available *entry, const char *name)
+{
+    Symbol *symbol = symbol_table_lookup(vn->optimizer->symbol_table, name);
+    entry->holder_id = symbol->id;
+    entry->holder = symbol->name;
+}
+
+// Whatever a reassigned variable held is no longer available through it.
+static void vn_kill_holders(ValueNumbering *vn, const BitSet *variables)
+{
+    for (size_t i = 0; i < vn->available_count; i++)
+    {
+        Available *entry = &vn->available[i];
+        if (entry->holder_id >= 0 && bitset_test(variables, entry->holder_id))
+        {
+            entry->holder_id = -1;
+            entry->holder = NULL;
+        }
+    }
+}
+
+static int vn_subtree_has_slot(ASTNode *node, ASTNode **slot)
+{
+    if (!node || node->type != NODE_BINARY_OP)
+        return 0;
+    return &node->data.binary_op.left == slot || &node->data.binary_op.right == slot ||
+           vn_subtree_has_slot(node->data.binary_op.left, slot) ||
+           vn_subtree_has_slot(node->data.binary_op.right, slot);
+}
+
+// Moves a first occurrence into `.tN = expression` placed before the
+// statement that contains it, so later occurrences can read .tN.
+static void vn_materialize(ValueNumbering *vn, Available *entry)
+{
+    const char *temporary = optimizer_new_temporary(vn->optimizer);
+    ASTNode *expression = *entry->slot;
+    ASTNode *assignment = ast_create_assignment(temporary, expression);
+    *entry->slot = ast_create_identifier(temporary);
+
+    // Recorded occurrences inside the moved expression now live in the
+    // temporary's assignment.
+    for (size_t i = 0; i < vn->available_count; i++)
+    {
+        if (vn->available[i].slot && vn_subtree_has_slot(expression, vn->available[i].slot))
+            vn->available[i].container = assignment;
+    }
+
+    vn->insertions = (Insertion *)realloc(vn->insertions, (vn->insertion_count + 1) * sizeof(Insertion));
+    vn->insertions[vn->insertion_count].before = entry->container;
+    vn->insertions[vn->insertion_count].assignment = assignment;
+    vn->insertion_count++;
+
+    // Temporaries are never reassigned, so the binding needs no undo entry.
+    int id = symbol_table_get_id(vn->optimizer->symbol_table, temporary);
+    vn_grow_ints(&vn->variable_numbers, &vn->variable_capacity, id + 1, 0);
+    vn->variable_numbers[id] = entry->number;
+    vn_set_holder(vn, entry, temporary);
+    entry->slot = NULL;
+}
+
+// Replaces available subexpressions of *slot. Occurrences are recorded only
+// when `container` can take a temporary in front of it.
+static void vn_visit_expression(ValueNumbering *vn, ASTNode **slot, ASTNode *container)
+{
+    ASTNode *expression = *slot;
+    if (!expression || expression->type != NODE_BINARY_OP)
+        return;
+
+    int number = vn_expression(vn, expression);
+    Available *entry = vn_find(vn, number);
+    if (entry && !entry->holder && entry->slot)
+        vn_materialize(vn, entry);
+    if (entry && entry->holder)
+    {
+        ast_destroy_node(expression);
+        *slot = ast_create_identifier(entry->holder);
+        vn->optimizer->changes_made++;
+        return;
+    }
+
+    vn_visit_expression(vn, &expression->data.binary_op.left, container);
+    vn_visit_expression(vn, &expression->data.binary_op.right, container);
+    if (container)
+        vn_push(vn, number, slot, container);
+}
+
+static ASTNode *vn_as_block(ASTNode *body)
+{
+    if (!body || body->type == NODE_BLOCK)
+        return body;
+    ASTNode *block = ast_create_block();
+    ast_add_statement(block, body);
+    return block;
+}
+
+static void vn_visit_statement(ValueNumbering *vn, ASTNode *node);
+
+// Visits a body that may not run. Nothing it learns survives: its entries
+// are popped, its bindings undone, and outer entries it gave a holder to
+// lose that holder again.
+static void vn_visit_scope(ValueNumbering *vn, ASTNode *body)
+{
+    if (!body)
+        return;
+
+    size_t available_mark = vn->available_count;
+    size_t rebinding_mark = vn->rebinding_count;
+    vn_visit_statement(vn, body);
+    vn_pop_to(vn, available_mark);
+    vn_unbind_to(vn, rebinding_mark);
+    vn_kill_holders(vn, &optimizer_def_use(vn->optimizer, body)->defs);
+}
+
+static void vn_visit_statement(ValueNumbering *vn, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            vn_visit_statement(vn, node->data.block.statements[i]);
+        }
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        ASTNode **value = &node->data.assignment.value;
+        vn_visit_expression(vn, value, node);
+
+        int number = vn_expression(vn, *value);
+        const DefUse *summary = optimizer_def_use(vn->optimizer, node);
+        vn_kill_holders(vn, &summary->defs);
+        vn_bind(vn, symbol_table_get_id(vn->optimizer->symbol_table, node->data.assignment.name), number);
+
+        Available *entry = vn_find(vn, number);
+        if (entry && !entry->holder)
+            vn_set_holder(vn, entry, node->data.assignment.name);
+        break;
+    }
+
+    case NODE_IF:
+    {
+        vn_visit_expression(vn, &node->data.if_stmt.condition, node);
+        node->data.if_stmt.if_body = vn_as_block(node->data.if_stmt.if_body);
+        node->data.if_stmt.else_body = vn_as_block(node->data.if_stmt.else_body);
+
+        vn_visit_scope(vn, node->data.if_stmt.if_body);
+        vn_visit_scope(vn, node->data.if_stmt.else_body);
+
+        const DefUse *summary = optimizer_def_use(vn->optimizer, node);
+        vn_bind_fresh(vn, &summary->defs);
+        break;
+    }
+
+    case NODE_WHILE:
+    {
+        // The head merges the back edge: anything the loop assigns is unknown
+        // there, and the condition runs every iteration so it records nothing.
+        const DefUse *summary = optimizer_def_use(vn->optimizer, node);
+        vn_kill_holders(vn, &summary->defs);
+        vn_bind_fresh(vn, &summary->defs);
+        vn_visit_expression(vn, &node->data.while_loop.condition, NULL);
+        node->data.while_loop.body = vn_as_block(node->data.while_loop.body);
+        vn_visit_scope(vn, node->data.while_loop.body);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+static void vn_emit_before(ValueNumbering *vn, ASTNode *block, ASTNode *statement)
+{
+    for (size_t i = 0; i < vn->insertion_count; i++)
+    {
+        if (vn->insertions[i].before != statement)
+            continue;
+        vn_emit_before(vn, block, vn->insertions[i].assignment);
+        ast_add_statement(block, vn->insertions[i].assignment);
+    }
+}
+
+// Splices the temporaries in and drops every cached summary, since
+// rewritten statements may sit anywhere in the tree.
+static void vn_finish(ValueNumbering *vn, ASTNode *node)
+{
+    if (!node)
+        return;
+
+    dataflow_invalidate(node);
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+    {
+        ASTNode *rebuilt = ast_create_block();
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            ASTNode *statement = node->data.block.statements[i];
+            vn_finish(vn, statement);
+            vn_emit_before(vn, rebuilt, statement);
+            ast_add_statement(rebuilt, statement);
+        }
+        free(node->data.block.statements);
+        node->data.block.statements = rebuilt->data.block.statements;
+        node->data.block.statement_count = rebuilt->data.block.statement_count;
+        rebuilt->data.block.statements = NULL;
+        rebuilt->data.block.statement_count = 0;
+        ast_destroy_node(rebuilt);
+        break;
+    }
+
+    case NODE_IF:
+        vn_finish(vn, node->data.if_stmt.if_body);
+        vn_finish(vn, node->data.if_stmt.else_body);
+        break;
+
+    case NODE_WHILE:
+        vn_finish(vn, node->data.while_loop.body);
+        break;
+
+    default:
+        break;
+    }
+}
+
+ASTNode *optimizer_value_numbering(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    ValueNumbering vn;
+    memset(&vn, 0, sizeof(vn));
+    vn.optimizer = optimizer;
+    vn.next_number = 1;
+
+    int changes_before = optimizer->changes_made;
+    vn_visit_statement(&vn, node);
+    if (optimizer->changes_made != changes_before)
+        vn_finish(&vn, node);
+
+    free(vn.table);
+    free(vn.variable_numbers);
+    free(vn.rebindings);
+    free(vn.available);
+    free(vn.top_entry);
+    free(vn.insertions);
+    return node;
+}
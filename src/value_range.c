@@ -0,0 +1,595 @@
+#include "optimizer.h"
+#include "value_range.h"
+#include <limits.h>
+
+// Interval analysis over the structured AST. Every variable carries a signed
+// range; branch edges narrow the variables a condition compares, loop heads
+// are widened to a post-fixpoint and then narrowed, and any comparison or
+// condition whose outcome is the same on every path becomes a literal that
+// dead code elimination can act on.
+
+#define RANGE_WIDEN_DELAY 2
+#define RANGE_NARROW_STEPS 2
+
+typedef struct
+{
+    Interval *values;
+    int reachable;
+} RangeState;
+
+typedef struct
+{
+    Optimizer *optimizer;
+    size_t variable_count;
+    int fold;
+    Interval *observed; // per variable, every value read or assigned; NULL unless inferring widths
+    int recording;      // off while loop heads are still being iterated
+} RangeAnalysis;
+
+typedef enum
+{
+    RELATION_LESS,
+    RELATION_LESS_EQUAL,
+    RELATION_GREATER,
+    RELATION_GREATER_EQUAL,
+    RELATION_EQUAL,
+    RELATION_NOT_EQUAL
+} Relation;
+
+Interval range_full(void)
+{
+    Interval interval = {LLONG_MIN, LLONG_MAX};
+    return interval;
+}
+
+Interval range_constant(long long value)
+{
+    Interval interval = {value, value};
+    return interval;
+}
+
+// Bounds computed in 128 bits; anything that may wrap is unknown.
+static Interval range_from_wide(__int128 low, __int128 high)
+{
+    if (low < LLONG_MIN || high > LLONG_MAX)
+        return range_full();
+    Interval interval = {(long long)low, (long long)high};
+    return interval;
+}
+
+int range_within(Interval interval, long long low, long long high)
+{
+    return interval.low >= low && interval.high <= high;
+}
+
+static Interval range_from_corners(__int128 a, __int128 b, __int128 c, __int128 d)
+{
+    __int128 low = a, high = a;
+    __int128 corners[3] = {b, c, d};
+    for (int i = 0; i < 3; i++)
+    {
+        low = corners[i] < low ? corners[i] : low;
+        high = corners[i] > high ? corners[i] : high;
+    }
+    return range_from_wide(low, high);
+}
+
+static void range_state_init(RangeAnalysis *analysis, RangeState *state)
+{
+    state->values = (Interval *)malloc((analysis->variable_count + 1) * sizeof(Interval));
+    for (size_t i = 0; i < analysis->variable_count; i++)
+    {
+        state->values[i] = range_full();
+    }
+    state->reachable = 1;
+}
+
+static void range_state_copy(RangeAnalysis *analysis, RangeState *dst, const RangeState *src)
+{
+    memcpy(dst->values, src->values, analysis->variable_count * sizeof(Interval));
+    dst->reachable = src->reachable;
+}
+
+static void range_state_clone(RangeAnalysis *analysis, RangeState *dst, const RangeState *src)
+{
+    range_state_init(analysis, dst);
+    range_state_copy(analysis, dst, src);
+}
+
+static void range_state_free(RangeState *state)
+{
+    free(state->values);
+    state->values = NULL;
+}
+
+static void range_state_join(RangeAnalysis *analysis, RangeState *dst, const RangeState *src)
+{
+    if (!src->reachable)
+        return;
+    if (!dst->reachable)
+    {
+        range_state_copy(analysis, dst, src);
+        return;
+    }
+
+    for (size_t i = 0; i < analysis->variable_count; i++)
+    {
+        if (src->values[i].low < dst->values[i].low)
+            dst->values[i].low = src->values[i].low;
+        if (src->values[i].high > dst->values[i].high)
+            dst->values[i].high = src->values[i].high;
+    }
+}
+
+// Whether every state `inner` allows is allowed by `outer`.
+static int range_state_contains(RangeAnalysis *analysis, const RangeState *outer, const RangeState *inner)
+{
+    if (!inner->reachable)
+        return 1;
+    if (!outer->reachable)
+        return 0;
+
+    for (size_t i = 0; i < analysis->variable_count; i++)
+    {
+        if (inner->values[i].low < outer->values[i].low || inner->values[i].high > outer->values[i].high)
+            return 0;
+    }
+    return 1;
+}
+
+// Joins `next` into `head`, sending any bound that moved to its extreme.
+static void range_state_widen(RangeAnalysis *analysis, RangeState *head, const RangeState *next)
+{
+    if (!head->reachable)
+    {
+        range_state_copy(analysis, head, next);
+        return;
+    }
+    if (!next->reachable)
+        return;
+
+    for (size_t i = 0; i < analysis->variable_count; i++)
+    {
+        if (next->values[i].low < head->values[i].low)
+            head->values[i].low = LLONG_MIN;
+        if (next->values[i].high > head->values[i].high)
+            head->values[i].high = LLONG_MAX;
+    }
+}
+
+static Interval *range_variable(RangeAnalysis *analysis, RangeState *state, const char *name)
+{
+    size_t id = (size_t)symbol_table_get_id(analysis->optimizer->symbol_table, name);
+    return id < analysis->variable_count ? &state->values[id] : NULL;
+}
+
+static int range_relation(TokenType operator, Relation *relation)
+{
+    switch (operator)
+    {
+    case TOKEN_LESS:
+        *relation = RELATION_LESS;
+        return 1;
+    case TOKEN_GREATER:
+        *relation = RELATION_GREATER;
+        return 1;
+    case TOKEN_EQUAL:
+        *relation = RELATION_EQUAL;
+        return 1;
+    case TOKEN_NOT_EQUAL:
+        *relation = RELATION_NOT_EQUAL;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static Relation range_negate(Relation relation)
+{
+    static const Relation negated[] = {RELATION_GREATER_EQUAL, RELATION_GREATER, RELATION_LESS_EQUAL,
+                                       RELATION_LESS, RELATION_NOT_EQUAL, RELATION_EQUAL};
+    return negated[relation];
+}
+
+static Relation range_swap(Relation relation)
+{
+    static const Relation swapped[] = {RELATION_GREATER, RELATION_GREATER_EQUAL, RELATION_LESS,
+                                       RELATION_LESS_EQUAL, RELATION_EQUAL, RELATION_NOT_EQUAL};
+    return swapped[relation];
+}
+
+// 1 or 0 when `a relation b` holds for none or all values, else -1.
+static int range_decide(Relation relation, Interval a, Interval b)
+{
+    switch (relation)
+    {
+    case RELATION_LESS:
+        return a.high < b.low ? 1 : a.low >= b.high ? 0 : -1;
+    case RELATION_LESS_EQUAL:
+        return a.high <= b.low ? 1 : a.low > b.high ? 0 : -1;
+    case RELATION_GREATER:
+        return a.low > b.high ? 1 : a.high <= b.low ? 0 : -1;
+    case RELATION_GREATER_EQUAL:
+        return a.low >= b.high ? 1 : a.high < b.low ? 0 : -1;
+    case RELATION_EQUAL:
+        if (a.low == a.high && b.low == b.high && a.low == b.low)
+            return 1;
+        return a.high < b.low || b.high < a.low ? 0 : -1;
+    case RELATION_NOT_EQUAL:
+    {
+        int equal = range_decide(RELATION_EQUAL, a, b);
+        return equal < 0 ? -1 : !equal;
+    }
+    }
+    return -1;
+}
+
+Interval range_binary(TokenType operator, Interval a, Interval b)
+{
+    Relation relation;
+    if (range_relation(operator, &relation))
+    {
+        int decided = range_decide(relation, a, b);
+        Interval result = {decided == 1, decided != 0};
+        return result;
+    }
+
+    switch (operator)
+    {
+    case TOKEN_PLUS:
+        return range_from_wide((__int128)a.low + b.low, (__int128)a.high + b.high);
+    case TOKEN_MINUS:
+        return range_from_wide((__int128)a.low - b.high, (__int128)a.high - b.low);
+    case TOKEN_MULTIPLY:
+        return range_from_corners((__int128)a.low * b.low, (__int128)a.low * b.high,
+                                  (__int128)a.high * b.low, (__int128)a.high * b.high);
+    case TOKEN_DIVIDE:
+        // Truncating division is monotonic in each operand while the
+        // divisor keeps its sign; INT64_MIN / -1 lands out of range.
+        if (b.low <= 0 && b.high >= 0)
+            return range_full();
+        return range_from_corners((__int128)a.low / b.low, (__int128)a.low / b.high,
+                                  (__int128)a.high / b.low, (__int128)a.high / b.high);
+    case TOKEN_SHIFT_LEFT:
+        if (b.low != b.high)
+            return range_full();
+        return range_from_wide((__int128)a.low * ((__int128)1 << (b.low & 63)),
+                               (__int128)a.high * ((__int128)1 << (b.low & 63)));
+    default:
+        return range_full();
+    }
+}
+
+static void range_observe(RangeAnalysis *analysis, const char *name, Interval value)
+{
+    size_t id = (size_t)symbol_table_get_id(analysis->optimizer->symbol_table, name);
+    if (!analysis->observed || !analysis->recording || id >= analysis->variable_count)
+        return;
+
+    Interval *observed = &analysis->observed[id];
+    if (value.low < observed->low)
+        observed->low = value.low;
+    if (value.high > observed->high)
+        observed->high = value.high;
+}
+
+static Interval range_evaluate(RangeAnalysis *analysis, RangeState *state, ASTNode *expression)
+{
+    switch (expression->type)
+    {
+    case NODE_INTEGER:
+        return range_constant(expression->data.integer.value);
+
+    case NODE_IDENTIFIER:
+    {
+        Interval *variable = range_variable(analysis, state, expression->data.identifier.name);
+        Interval value = variable ? *variable : range_full();
+        range_observe(analysis, expression->data.identifier.name, value);
+        return value;
+    }
+
+    case NODE_BINARY_OP:
+        return range_binary(expression->data.binary_op.operator,
+                            range_evaluate(analysis, state, expression->data.binary_op.left),
+                            range_evaluate(analysis, state, expression->data.binary_op.right));
+
+    default:
+        return range_full();
+    }
+}
+
+static void range_refine_variable(RangeAnalysis *analysis, RangeState *state, ASTNode *side,
+                                  Relation relation, Interval other)
+{
+    if (side->type != NODE_IDENTIFIER)
+        return;
+    Interval *value = range_variable(analysis, state, side->data.identifier.name);
+    if (!value)
+        return;
+
+    switch (relation)
+    {
+    case RELATION_LESS:
+        if (other.high == LLONG_MIN)
+            state->reachable = 0;
+        else if (other.high - 1 < value->high)
+            value->high = other.high - 1;
+        break;
+    case RELATION_LESS_EQUAL:
+        if (other.high < value->high)
+            value->high = other.high;
+        break;
+    case RELATION_GREATER:
+        if (other.low == LLONG_MAX)
+            state->reachable = 0;
+        else if (other.low + 1 > value->low)
+            value->low = other.low + 1;
+        break;
+    case RELATION_GREATER_EQUAL:
+        if (other.low > value->low)
+            value->low = other.low;
+        break;
+    case RELATION_EQUAL:
+        if (other.low > value->low)
+            value->low = other.low;
+        if (other.high < value->high)
+            value->high = other.high;
+        break;
+    case RELATION_NOT_EQUAL:
+        // Only a single excluded value at either end narrows an interval.
+        if (other.low != other.high)
+            break;
+        if (value->low == other.low && value->high == other.low)
+            state->reachable = 0;
+        else if (value->low == other.low)
+            value->low++;
+        else if (value->high == other.low)
+            value->high--;
+        break;
+    }
+
+    if (value->low > value->high)
+        state->reachable = 0;
+}
+
+// Narrows `state` to the paths on which `condition` evaluates to `truth`.
+static void range_refine(RangeAnalysis *analysis, RangeState *state, ASTNode *condition, int truth)
+{
+    if (!state->reachable)
+        return;
+
+    Interval outcome = range_evaluate(analysis, state, condition);
+    if (truth ? (outcome.low == 0 && outcome.high == 0) : (outcome.low > 0 || outcome.high < 0))
+    {
+        state->reachable = 0;
+        return;
+    }
+
+    Relation relation;
+    if (condition->type == NODE_BINARY_OP && range_relation(condition->data.binary_op.operator, &relation))
+    {
+        if (!truth)
+            relation = range_negate(relation);
+        ASTNode *left = condition->data.binary_op.left;
+        ASTNode *right = condition->data.binary_op.right;
+        Interval left_value = range_evaluate(analysis, state, left);
+        Interval right_value = range_evaluate(analysis, state, right);
+        range_refine_variable(analysis, state, left, relation, right_value);
+        range_refine_variable(analysis, state, right, range_swap(relation), left_value);
+        return;
+    }
+
+    range_refine_variable(analysis, state, condition, truth ? RELATION_NOT_EQUAL : RELATION_EQUAL, range_constant(0));
+}
+
+// Replaces decided comparisons under *slot with literals. A whole condition
+// is also replaced when its truth value is decided.
+static void range_fold(RangeAnalysis *analysis, RangeState *state, ASTNode **slot, int is_condition)
+{
+    ASTNode *expression = *slot;
+    if (!expression || expression->type != NODE_BINARY_OP)
+        return;
+
+    Relation relation;
+    if (is_condition || range_relation(expression->data.binary_op.operator, &relation))
+    {
+        Interval value = range_evaluate(analysis, state, expression);
+        int decided = value.low > 0 || value.high < 0 ? 1 : value.low == 0 && value.high == 0 ? 0 : -1;
+        if (decided >= 0 && !optimizer_expression_may_trap(expression))
+        {
+            ast_destroy_node(expression);
+            *slot = ast_create_integer(decided);
+            analysis->optimizer->changes_made++;
+            return;
+        }
+    }
+
+    range_fold(analysis, state, &expression->data.binary_op.left, 0);
+    range_fold(analysis, state, &expression->data.binary_op.right, 0);
+}
+
+static void range_statement(RangeAnalysis *analysis, ASTNode *node, RangeState *state, int rewrite);
+
+// One trip around the loop: the head state joined with what the body
+// leaves behind when entered from `head`.
+static void range_loop_step(RangeAnalysis *analysis, ASTNode *loop, const RangeState *entry,
+                            const RangeState *head, RangeState *next)
+{
+    range_state_copy(analysis, next, head);
+    range_refine(analysis, next, loop->data.while_loop.condition, 1);
+    range_statement(analysis, loop->data.while_loop.body, next, 0);
+    range_state_join(analysis, next, entry);
+}
+
+static void range_loop(RangeAnalysis *analysis, ASTNode *loop, RangeState *state, int rewrite)
+{
+    RangeState entry, head, next, check;
+    range_state_clone(analysis, &entry, state);
+    range_state_clone(analysis, &head, state);
+    range_state_init(analysis, &next);
+    range_state_init(analysis, &check);
+
+    // Only the final walk from the settled head reflects values the program
+    // can actually produce.
+    int recording = analysis->recording;
+    analysis->recording = 0;
+
+    for (int iteration = 0;; iteration++)
+    {
+        range_loop_step(analysis, loop, &entry, &head, &next);
+        if (range_state_contains(analysis, &head, &next))
+            break;
+        if (iteration >= RANGE_WIDEN_DELAY)
+            range_state_widen(analysis, &head, &next);
+        else
+            range_state_join(analysis, &head, &next);
+    }
+
+    // head is now a post-fixpoint. Narrowing keeps a tighter candidate only
+    // once it is confirmed to be one as well.
+    range_loop_step(analysis, loop, &entry, &head, &next);
+    for (int step = 0; step < RANGE_NARROW_STEPS; step++)
+    {
+        range_loop_step(analysis, loop, &entry, &next, &check);
+        if (!range_state_contains(analysis, &next, &check))
+            break;
+        range_state_copy(analysis, &head, &next);
+        range_state_copy(analysis, &next, &check);
+    }
+
+    analysis->recording = recording;
+    if (rewrite)
+    {
+        if (analysis->fold)
+            range_fold(analysis, &head, &loop->data.while_loop.condition, 1);
+        range_state_copy(analysis, &next, &head);
+        range_refine(analysis, &next, loop->data.while_loop.condition, 1);
+        range_statement(analysis, loop->data.while_loop.body, &next, 1);
+    }
+
+    range_state_copy(analysis, state, &head);
+    range_refine(analysis, state, loop->data.while_loop.condition, 0);
+
+    range_state_free(&entry);
+    range_state_free(&head);
+    range_state_free(&next);
+    range_state_free(&check);
+}
+
+static void range_statement(RangeAnalysis *analysis, ASTNode *node, RangeState *state, int rewrite)
+{
+    if (!node || !state->reachable)
+        return;
+
+    int changes_before = analysis->optimizer->changes_made;
+
+    switch (node->type)
+    {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+        for (size_t i = 0; i < node->data.block.statement_count; i++)
+        {
+            range_statement(analysis, node->data.block.statements[i], state, rewrite);
+        }
+        break;
+
+    case NODE_ASSIGNMENT:
+    {
+        if (rewrite && analysis->fold)
+            range_fold(analysis, state, &node->data.assignment.value, 0);
+        Interval value = range_evaluate(analysis, state, node->data.assignment.value);
+        Interval *variable = range_variable(analysis, state, node->data.assignment.name);
+        if (variable)
+            *variable = value;
+        range_observe(analysis, node->data.assignment.name, value);
+        break;
+    }
+
+    case NODE_IF:
+    {
+        if (rewrite && analysis->fold)
+            range_fold(analysis, state, &node->data.if_stmt.condition, 1);
+
+        RangeState otherwise;
+        range_state_clone(analysis, &otherwise, state);
+        range_refine(analysis, state, node->data.if_stmt.condition, 1);
+        range_statement(analysis, node->data.if_stmt.if_body, state, rewrite);
+        range_refine(analysis, &otherwise, node->data.if_stmt.condition, 0);
+        range_statement(analysis, node->data.if_stmt.else_body, &otherwise, rewrite);
+        range_state_join(analysis, state, &otherwise);
+        range_state_free(&otherwise);
+        break;
+    }
+
+    case NODE_WHILE:
+        range_loop(analysis, node, state, rewrite);
+        break;
+
+    default:
+        break;
+    }
+
+    if (rewrite)
+        optimizer_note_rewrites(analysis->optimizer, node, changes_before);
+}
+
+ASTNode *optimizer_value_range_analysis(Optimizer *optimizer, ASTNode *node)
+{
+    if (!node)
+        return NULL;
+
+    // Summarizing the program first gives every variable its symbol id.
+    optimizer_def_use(optimizer, node);
+
+    RangeAnalysis analysis;
+    analysis.optimizer = optimizer;
+    analysis.variable_count = (size_t)optimizer->symbol_table->symbol_count;
+    analysis.fold = 1;
+    analysis.observed = NULL;
+    analysis.recording = 0;
+
+    RangeState state;
+    range_state_init(&analysis, &state);
+    range_statement(&analysis, node, &state, 1);
+    range_state_free(&state);
+    return node;
+}
+
+// Bounds every variable by the values it is assigned or read with on any
+// reachable path, for code generation to size slots and operations by.
+// Variables the analysis never sees keep the full range.
+void optimizer_infer_widths(Optimizer *optimizer, ASTNode *program)
+{
+    if (!program)
+        return;
+
+    optimizer_def_use(optimizer, program);
+
+    RangeAnalysis analysis;
+    analysis.optimizer = optimizer;
+    analysis.variable_count = (size_t)optimizer->symbol_table->symbol_count;
+    analysis.fold = 0;
+    analysis.observed = (Interval *)malloc((analysis.variable_count + 1) * sizeof(Interval));
+    analysis.recording = 1;
+    for (size_t i = 0; i < analysis.variable_count; i++)
+    {
+        analysis.observed[i].low = LLONG_MAX;
+        analysis.observed[i].high = LLONG_MIN;
+    }
+
+    RangeState state;
+    range_state_init(&analysis, &state);
+    range_statement(&analysis, program, &state, 1);
+    range_state_free(&state);
+
+    for (Symbol *symbol = optimizer->symbol_table->head; symbol; symbol = symbol->next)
+    {
+        size_t id = (size_t)symbol->id;
+        if (id < analysis.variable_count && analysis.observed[id].low <= analysis.observed[id].high)
+        {
+            symbol->low = analysis.observed[id].low;
+            symbol->high = analysis.observed[id].high;
+        }
+    }
+    free(analysis.observed);
+}
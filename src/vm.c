@@ -0,0 +1,193 @@
+#include <limits.h>
+#include "vm.h"
+
+// Each handler ends by dispatching the next instruction itself. With GCC's
+// labels as values that is an indirect jump per handler, which branch
+// predictors learn far better than the single jump of a switch; other
+// compilers get the switch.
+
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED
+#endif
+
+#ifdef VM_THREADED
+#define VM_CASE(label, opcode) label:
+#define VM_NEXT() goto *handlers[ip->opcode]
+#else
+#define VM_CASE(label, opcode) case opcode:
+#define VM_NEXT() continue
+#endif
+
+// Arithmetic wraps like the machine's; unsigned operands keep that defined.
+#define VM_ARITHMETIC(operator)                                                                                       \
+    r[ip->a] = (long long)((unsigned long long)r[ip->b] operator(unsigned long long) r[ip->c]);                     \
+    ip++;                                                                                                             \
+    VM_NEXT()
+
+#define VM_COMPARE(operator)                                                                                          \
+    r[ip->a] = r[ip->b] operator r[ip->c];                                                                            \
+    ip++;                                                                                                             \
+    VM_NEXT()
+
+#define VM_BRANCH(operator)                                                                                           \
+    ip = r[ip->b] operator r[ip->c] ? code + ip->a : ip + 1;                                                          \
+    VM_NEXT()
+
+#define VM_BRANCH_IMMEDIATE(operator)                                                                                 \
+    ip = r[ip->b] operator(long long) ip->c ? code + ip->a : ip + 1;                                                  \
+    VM_NEXT()
+
+VMStatus vm_execute(const Bytecode *bytecode, long long *r)
+{
+    const Instruction *code = bytecode->code;
+    const long long *constants = bytecode->constants;
+    const Instruction *ip = code;
+
+#ifdef VM_THREADED
+    static void *const handlers[OP_COUNT] = {
+        [OP_MOVE] = &&move,
+        [OP_LOAD] = &&load,
+        [OP_LOAD_CONSTANT] = &&load_constant,
+        [OP_ADD] = &&add,
+        [OP_SUB] = &&sub,
+        [OP_MUL] = &&mul,
+        [OP_DIV] = &&div,
+        [OP_SHL] = &&shl,
+        [OP_ADD_IMMEDIATE] = &&add_immediate,
+        [OP_LESS] = &&less,
+        [OP_GREATER] = &&greater,
+        [OP_EQUAL] = &&equal,
+        [OP_NOT_EQUAL] = &&not_equal,
+        [OP_JUMP] = &&jump,
+        [OP_JUMP_IF_ZERO] = &&jump_if_zero,
+        [OP_JUMP_IF_NOT_ZERO] = &&jump_if_not_zero,
+        [OP_BRANCH + RELATION_LESS] = &&branch_less,
+        [OP_BRANCH + RELATION_GREATER_EQUAL] = &&branch_greater_equal,
+        [OP_BRANCH + RELATION_GREATER] = &&branch_greater,
+        [OP_BRANCH + RELATION_LESS_EQUAL] = &&branch_less_equal,
+        [OP_BRANCH + RELATION_EQUAL] = &&branch_equal,
+        [OP_BRANCH + RELATION_NOT_EQUAL] = &&branch_not_equal,
+        [OP_BRANCH_IMMEDIATE + RELATION_LESS] = &&branch_immediate_less,
+        [OP_BRANCH_IMMEDIATE + RELATION_GREATER_EQUAL] = &&branch_immediate_greater_equal,
+        [OP_BRANCH_IMMEDIATE + RELATION_GREATER] = &&branch_immediate_greater,
+        [OP_BRANCH_IMMEDIATE + RELATION_LESS_EQUAL] = &&branch_immediate_less_equal,
+        [OP_BRANCH_IMMEDIATE + RELATION_EQUAL] = &&branch_immediate_equal,
+        [OP_BRANCH_IMMEDIATE + RELATION_NOT_EQUAL] = &&branch_immediate_not_equal,
+        [OP_HALT] = &&halt,
+    };
+
+    VM_NEXT();
+#else
+    for (;;)
+    {
+        switch (ip->opcode)
+        {
+#endif
+
+    VM_CASE(move, OP_MOVE)
+        r[ip->a] = r[ip->b];
+        ip++;
+        VM_NEXT();
+    VM_CASE(load, OP_LOAD)
+        r[ip->a] = ip->b;
+        ip++;
+        VM_NEXT();
+    VM_CASE(load_constant, OP_LOAD_CONSTANT)
+        r[ip->a] = constants[ip->b];
+        ip++;
+        VM_NEXT();
+    VM_CASE(add, OP_ADD)
+        VM_ARITHMETIC(+);
+    VM_CASE(sub, OP_SUB)
+        VM_ARITHMETIC(-);
+    VM_CASE(mul, OP_MUL)
+        VM_ARITHMETIC(*);
+    VM_CASE(div, OP_DIV)
+        if (r[ip->c] == 0 || (r[ip->b] == LLONG_MIN && r[ip->c] == -1))
+            return VM_DIVISION_FAULT;
+        r[ip->a] = r[ip->b] / r[ip->c];
+        ip++;
+        VM_NEXT();
+    VM_CASE(shl, OP_SHL)
+        // shl uses the count's low six bits
+        r[ip->a] = (long long)((unsigned long long)r[ip->b] << (r[ip->c] & 63));
+        ip++;
+        VM_NEXT();
+    VM_CASE(add_immediate, OP_ADD_IMMEDIATE)
+        r[ip->a] = (long long)((unsigned long long)r[ip->b] + (unsigned long long)(long long)ip->c);
+        ip++;
+        VM_NEXT();
+    VM_CASE(less, OP_LESS)
+        VM_COMPARE(<);
+    VM_CASE(greater, OP_GREATER)
+        VM_COMPARE(>);
+    VM_CASE(equal, OP_EQUAL)
+        VM_COMPARE(==);
+    VM_CASE(not_equal, OP_NOT_EQUAL)
+        VM_COMPARE(!=);
+    VM_CASE(jump, OP_JUMP)
+        ip = code + ip->a;
+        VM_NEXT();
+    VM_CASE(jump_if_zero, OP_JUMP_IF_ZERO)
+        ip = r[ip->b] == 0 ? code + ip->a : ip + 1;
+        VM_NEXT();
+    VM_CASE(jump_if_not_zero, OP_JUMP_IF_NOT_ZERO)
+        ip = r[ip->b] != 0 ? code + ip->a : ip + 1;
+        VM_NEXT();
+    VM_CASE(branch_less, OP_BRANCH + RELATION_LESS)
+        VM_BRANCH(<);
+    VM_CASE(branch_greater_equal, OP_BRANCH + RELATION_GREATER_EQUAL)
+        VM_BRANCH(>=);
+    VM_CASE(branch_greater, OP_BRANCH + RELATION_GREATER)
+        VM_BRANCH(>);
+    VM_CASE(branch_less_equal, OP_BRANCH + RELATION_LESS_EQUAL)
+        VM_BRANCH(<=);
+    VM_CASE(branch_equal, OP_BRANCH + RELATION_EQUAL)
+        VM_BRANCH(==);
+    VM_CASE(branch_not_equal, OP_BRANCH + RELATION_NOT_EQUAL)
+        VM_BRANCH(!=);
+    VM_CASE(branch_immediate_less, OP_BRANCH_IMMEDIATE + RELATION_LESS)
+        VM_BRANCH_IMMEDIATE(<);
+    VM_CASE(branch_immediate_greater_equal, OP_BRANCH_IMMEDIATE + RELATION_GREATER_EQUAL)
+        VM_BRANCH_IMMEDIATE(>=);
+    VM_CASE(branch_immediate_greater, OP_BRANCH_IMMEDIATE + RELATION_GREATER)
+        VM_BRANCH_IMMEDIATE(>);
+    VM_CASE(branch_immediate_less_equal, OP_BRANCH_IMMEDIATE + RELATION_LESS_EQUAL)
+        VM_BRANCH_IMMEDIATE(<=);
+    VM_CASE(branch_immediate_equal, OP_BRANCH_IMMEDIATE + RELATION_EQUAL)
+        VM_BRANCH_IMMEDIATE(==);
+    VM_CASE(branch_immediate_not_equal, OP_BRANCH_IMMEDIATE + RELATION_NOT_EQUAL)
+        VM_BRANCH_IMMEDIATE(!=);
+    VM_CASE(halt, OP_HALT)
+        return VM_OK;
+
+#ifndef VM_THREADED
+        default:
+            return VM_OK;
+        }
+    }
+#endif
+}
+
+int vm_run(const Bytecode *bytecode, SymbolTable *symbol_table, FILE *output)
+{
+    long long *registers = (long long *)calloc(bytecode->register_count + 1, sizeof(long long));
+    VMStatus status = vm_execute(bytecode, registers);
+    if (status != VM_OK)
+    {
+        fprintf(stderr, "Runtime error: division by zero or overflow\n");
+        free(registers);
+        return 1;
+    }
+
+    // A variable the optimizer removed keeps its initial zero.
+    for (int i = 0; i < symbol_table->source_count; i++)
+    {
+        Symbol *symbol = symbol_table_lookup(symbol_table, symbol_table->source_names[i]);
+        long long value = symbol && symbol->id < bytecode->variable_count ? registers[symbol->id] : 0;
+        fprintf(output, "%s = %lld\n", symbol_table->source_names[i], value);
+    }
+
+    free(registers);
+    return 0;
+}
@@ -10,18 +10,12 @@ run_test() {
     
     echo "Testing $base_name..."
     
-    ./compiler "$test_file" "output/${base_name}.asm"
+    ./compiler "$test_file" "output/${base_name}.o"
     if [ $? -ne 0 ]; then
         echo -e "${RED}Failed to compile ${base_name}${NC}"
         return 1
     fi
     
-    nasm -f elf64 "output/${base_name}.asm" -o "output/${base_name}.o"
-    if [ $? -ne 0 ]; then
-        echo -e "${RED}Failed to assemble ${base_name}${NC}"
-        return 1
-    fi
-    
     gcc "output/${base_name}.o" -o "output/${base_name}"
     if [ $? -ne 0 ]; then
         echo -e "${RED}Failed to link ${base_name}${NC}"
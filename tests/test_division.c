@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <limits.h>
+#include "division.h"
+#include "jit.h"
+
+// Checks the constant-division lowering against idiv: every divisor with
+// |d| <= DIVISOR_RANGE, every power of two and its neighbours, and the
+// extremes, each over edge-case and pseudo-random dividends.
+//
+// The plans are checked through division_apply, and the instructions codegen
+// emits for them are run in the JIT. Compiling is far slower than the model,
+// so the JIT covers |d| <= JIT_DIVISOR_RANGE, the powers of two and their
+// neighbours, the extremes and JIT_RANDOM_DIVISORS more: each program divides
+// the edge dividends into variables of their own and folds JIT_ITERATIONS
+// pseudo-random dividends, which it generates itself, into a checksum.
+
+#define DIVISOR_RANGE 65536
+#define RANDOM_DIVIDENDS 64
+
+#define JIT_DIVISOR_RANGE 1024
+#define JIT_RANDOM_DIVISORS 256
+#define JIT_ITERATIONS 64
+#define LCG_MULTIPLIER 6364136223846793005LL
+#define LCG_INCREMENT 1442695040888963407LL
+#define LCG_SEED 12345
+
+static long long dividends[32 + RANDOM_DIVIDENDS];
+static size_t dividend_count;
+
+static unsigned long long random_state = 0x9E3779B97F4A7C15ULL;
+
+static long long next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (long long)random_state;
+}
+
+static void add_dividend(long long value)
+{
+    dividends[dividend_count++] = value;
+}
+
+static const long long edges[] = {0, 1, -1, 2, -2, 3, -3, 7, -7, 100, -100, 65535, -65537,
+                                  LLONG_MAX, LLONG_MIN, LLONG_MAX - 1, LLONG_MIN + 1,
+                                  LLONG_MAX / 2, LLONG_MIN / 2, 0x5555555555555555LL, -0x5555555555555555LL};
+#define EDGE_COUNT (sizeof(edges) / sizeof(edges[0]))
+
+// The program run for each divisor, with the literal divisor of each of its
+// divisions patched in before compiling.
+static ASTNode *jit_program;
+static ASTNode *jit_divisors[EDGE_COUNT + 1];
+
+static int check_divisor(long long divisor)
+{
+    if (divisor == 0 || divisor == -1)
+        return 0;
+
+    DivisionPlan plan = division_plan(divisor);
+    if (plan.kind == DIVISION_IDIV)
+    {
+        printf("FAIL %lld: left to idiv\n", divisor);
+        return 1;
+    }
+
+    for (size_t i = 0; i < dividend_count; i++)
+    {
+        long long dividend = dividends[i];
+        long long expected = dividend / divisor;
+        long long actual = division_apply(&plan, dividend);
+        if (actual != expected)
+        {
+            printf("FAIL %lld / %lld: got %lld, expected %lld\n", dividend, divisor, actual, expected);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *quotient_name(size_t index)
+{
+    static char name[16];
+    snprintf(name, sizeof(name), "q%zu", index);
+    return name;
+}
+
+static ASTNode *divide_x(size_t divisor_index)
+{
+    jit_divisors[divisor_index] = ast_create_integer(1);
+    return ast_create_binary_op(TOKEN_DIVIDE, ast_create_identifier("x"), jit_divisors[divisor_index]);
+}
+
+// x = edge; q<i> = x / d; for each edge, then
+// s = 0; i = 0; x = seed;
+// while (i < JIT_ITERATIONS) { x = x * a + c; q = x / d; s = s * 31 + q; i = i + 1; }
+static void build_jit_program(void)
+{
+    jit_program = ast_create_node(NODE_PROGRAM);
+    jit_program->data.block.statements = NULL;
+    jit_program->data.block.statement_count = 0;
+    for (size_t i = 0; i < EDGE_COUNT; i++)
+    {
+        ast_add_statement(jit_program, ast_create_assignment("x", ast_create_integer(edges[i])));
+        ast_add_statement(jit_program, ast_create_assignment(quotient_name(i), divide_x(i)));
+    }
+
+    ast_add_statement(jit_program, ast_create_assignment("s", ast_create_integer(0)));
+    ast_add_statement(jit_program, ast_create_assignment("i", ast_create_integer(0)));
+    ast_add_statement(jit_program, ast_create_assignment("x", ast_create_integer(LCG_SEED)));
+    ASTNode *body = ast_create_block();
+    ast_add_statement(
+        body, ast_create_assignment(
+                  "x", ast_create_binary_op(TOKEN_PLUS,
+                                            ast_create_binary_op(TOKEN_MULTIPLY, ast_create_identifier("x"),
+                                                                 ast_create_integer(LCG_MULTIPLIER)),
+                                            ast_create_integer(LCG_INCREMENT))));
+    ast_add_statement(body, ast_create_assignment("q", divide_x(EDGE_COUNT)));
+    ast_add_statement(body, ast_create_assignment(
+                                "s", ast_create_binary_op(TOKEN_PLUS,
+                                                          ast_create_binary_op(TOKEN_MULTIPLY, ast_create_identifier("s"),
+                                                                               ast_create_integer(31)),
+                                                          ast_create_identifier("q"))));
+    ast_add_statement(body, ast_create_assignment("i", ast_create_binary_op(TOKEN_PLUS, ast_create_identifier("i"),
+                                                                            ast_create_integer(1))));
+    ast_add_statement(jit_program, ast_create_while(ast_create_binary_op(TOKEN_LESS, ast_create_identifier("i"),
+                                                                         ast_create_integer(JIT_ITERATIONS)),
+                                                    body));
+}
+
+static int check_emitted(long long divisor)
+{
+    if (divisor == 0 || divisor == -1)
+        return 0;
+    for (size_t i = 0; i <= EDGE_COUNT; i++)
+    {
+        jit_divisors[i]->data.integer.value = divisor;
+    }
+
+    SymbolTable *symbol_table = symbol_table_create();
+    CodeGenOptions options = {
+        .assembler = ASM_NASM, .optimize_registers = 1, .generate_comments = 0, .simplify_cfg = 1, .peephole = 1};
+    JitProgram *program = jit_compile(jit_program, symbol_table, options);
+    int failed = !program || jit_execute(program) != JIT_OK;
+    if (failed)
+        printf("FAIL %lld: emitted division did not compile or run\n", divisor);
+
+    for (size_t i = 0; i < EDGE_COUNT && !failed; i++)
+    {
+        long long actual = 0;
+        jit_variable(program, quotient_name(i), &actual);
+        if (actual != edges[i] / divisor)
+        {
+            printf("FAIL %lld / %lld: emitted code got %lld, expected %lld\n", edges[i], divisor, actual,
+                   edges[i] / divisor);
+            failed = 1;
+        }
+    }
+
+    // Unsigned arithmetic wraps the way the program's does.
+    unsigned long long x = LCG_SEED;
+    unsigned long long expected = 0;
+    for (int i = 0; i < JIT_ITERATIONS; i++)
+    {
+        x = x * (unsigned long long)LCG_MULTIPLIER + (unsigned long long)LCG_INCREMENT;
+        expected = expected * 31 + (unsigned long long)((long long)x / divisor);
+    }
+    long long actual = 0;
+    if (!failed && (!jit_variable(program, "s", &actual) || (unsigned long long)actual != expected))
+    {
+        printf("FAIL %lld: emitted code's checksum over random dividends is off\n", divisor);
+        failed = 1;
+    }
+
+    jit_destroy(program);
+    symbol_table_destroy(symbol_table);
+    return failed;
+}
+
+int main(void)
+{
+    int failures = 0;
+    long checked = 0;
+    long emitted = 0;
+
+    for (size_t i = 0; i < EDGE_COUNT; i++)
+    {
+        add_dividend(edges[i]);
+    }
+    for (int i = 0; i < RANDOM_DIVIDENDS; i++)
+    {
+        // Mix magnitudes so small dividends are covered as well as large.
+        long long value = next_random();
+        add_dividend(i % 2 ? value : value >> (i % 60));
+    }
+
+    build_jit_program();
+    for (long long divisor = -DIVISOR_RANGE; divisor <= DIVISOR_RANGE; divisor++)
+    {
+        failures += check_divisor(divisor);
+        checked++;
+        if (divisor >= -JIT_DIVISOR_RANGE && divisor <= JIT_DIVISOR_RANGE)
+        {
+            failures += check_emitted(divisor);
+            emitted++;
+        }
+    }
+
+    for (int k = 1; k < 64; k++)
+    {
+        unsigned long long power = 1ULL << k;
+        for (int offset = -1; offset <= 1; offset++)
+        {
+            long long divisor = (long long)(power + offset);
+            long long negated = (long long)(0 - (unsigned long long)divisor);
+            failures += check_divisor(divisor) + check_divisor(negated);
+            failures += check_emitted(divisor) + check_emitted(negated);
+            checked += 2;
+            emitted += 2;
+        }
+    }
+
+    long long extremes[] = {LLONG_MAX, LLONG_MIN, LLONG_MAX - 1, LLONG_MIN + 1, 1000000007, -1000000007};
+    for (size_t i = 0; i < sizeof(extremes) / sizeof(extremes[0]); i++)
+    {
+        failures += check_divisor(extremes[i]) + check_emitted(extremes[i]);
+        checked++;
+        emitted++;
+    }
+    for (int i = 0; i < 4096; i++)
+    {
+        long long divisor = next_random();
+        failures += check_divisor(divisor);
+        checked++;
+        if (i < JIT_RANDOM_DIVISORS)
+        {
+            failures += check_emitted(divisor);
+            emitted++;
+        }
+    }
+    ast_destroy_node(jit_program);
+
+    if (failures)
+    {
+        printf("%d divisor(s) lowered incorrectly\n", failures);
+        return 1;
+    }
+
+    printf("Constant division matches idiv for %ld divisors, %ld of them run as emitted code\n", checked, emitted);
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <string.h>
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "pass_manager.h"
+#include "jit.h"
+
+// Checks the assembler against encodings GNU as produces for the same
+// instructions and its choice of jump sizes, then compiles and runs small
+// programs in-process and checks jit_run prints the same variables at every
+// optimization level.
+
+static int failures = 0;
+
+#define EXPECT(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+static const struct
+{
+    const char *text;
+    const char *bytes;
+} encodings[] = {
+    {"mov rax, [rbp-8]", "48 8b 45 f8"},
+    {"mov [rbp-12], eax", "89 45 f4"},
+    {"movsxd rax, DWORD [rbp-400]", "48 63 85 70 fe ff ff"},
+    {"mov rax, -9223372036854775808", "48 b8 00 00 00 00 00 00 00 80"},
+    {"mov r9, 123456789012", "49 b9 14 1a 99 be 1c 00 00 00"},
+    {"mov rax, -1", "48 c7 c0 ff ff ff ff"},
+    {"mov eax, 4294967295", "b8 ff ff ff ff"},
+    {"imul r8, r11", "4d 0f af c3"},
+    {"imul rcx", "48 f7 e9"},
+    {"imul rax, rax, 7", "48 6b c0 07"},
+    {"imul r12d, DWORD [rbp-8], 1000", "44 69 65 f8 e8 03 00 00"},
+    {"add eax, DWORD [rbp-8]", "03 45 f8"},
+    {"cmp QWORD [rbp-16], rax", "48 39 45 f0"},
+    {"idiv QWORD [rbp-24]", "48 f7 7d e8"},
+    {"idiv r8d", "41 f7 f8"},
+    {"cqo", "48 99"},
+    {"shl eax, cl", "d3 e0"},
+    {"sar rcx, 63", "48 c1 f9 3f"},
+    {"cmp eax, 100", "83 f8 64"},
+    {"cmp rsi, rax", "48 39 c6"},
+    {"setl al", "0f 9c c0"},
+    {"movzx eax, al", "0f b6 c0"},
+    {"lea rbp, [rdi+4096]", "48 8d af 00 10 00 00"},
+    {"mov rax, [rsp+8]", "48 8b 44 24 08"},
+};
+
+static void format_bytes(const Assembler *assembler, char *text)
+{
+    text[0] = '\0';
+    for (size_t i = 0; i < assembler->size; i++)
+    {
+        sprintf(text + strlen(text), i ? " %02x" : "%02x", assembler->code[i]);
+    }
+}
+
+static void test_encodings(void)
+{
+    char bytes[64];
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++)
+    {
+        Assembler assembler;
+        assembler_init(&assembler);
+        EXPECT(assembler_instruction(&assembler, encodings[i].text));
+        format_bytes(&assembler, bytes);
+        if (strcmp(bytes, encodings[i].bytes) != 0)
+        {
+            fprintf(stderr, "%s: got %s, expected %s\n", encodings[i].text, bytes, encodings[i].bytes);
+            failures++;
+        }
+        assembler_free(&assembler);
+    }
+
+    Assembler assembler;
+    assembler_init(&assembler);
+    EXPECT(!assembler_instruction(&assembler, "mov [rbp-8], 5"));
+    EXPECT(!assembler_instruction(&assembler, "mov eax, rcx"));
+    EXPECT(!assembler_instruction(&assembler, "frobnicate rax"));
+    EXPECT(assembler.size == 0);
+
+    // A backward jl and a forward jmp, each counted from the jump's end.
+    assembler_label(&assembler, 0);
+    EXPECT(assembler_jump(&assembler, "jl", 0));
+    EXPECT(assembler_jump(&assembler, "jmp", 1));
+    assembler_label(&assembler, 1);
+    EXPECT(assembler_resolve(&assembler));
+    format_bytes(&assembler, bytes);
+    EXPECT(strcmp(bytes, "7c fe eb 00") == 0);
+    assembler_free(&assembler);
+
+    // A forward jne and a backward jmp around 124 bytes of cqo stay rel8;
+    // around 128 bytes both need rel32.
+    for (int extra = 0; extra < 2; extra++)
+    {
+        assembler_init(&assembler);
+        EXPECT(assembler_jump(&assembler, "jne", 1));
+        assembler_label(&assembler, 0);
+        for (int i = 0; i < 62 + 2 * extra; i++)
+        {
+            EXPECT(assembler_instruction(&assembler, "cqo"));
+        }
+        EXPECT(assembler_jump(&assembler, "jmp", 0));
+        assembler_label(&assembler, 1);
+        EXPECT(assembler_resolve(&assembler));
+        if (!extra)
+        {
+            EXPECT(assembler.size == 2 + 124 + 2);
+            EXPECT(assembler.code[0] == 0x75 && assembler.code[1] == 126);
+            EXPECT(assembler.code[126] == 0xEB && assembler.code[127] == 256 - 126);
+        }
+        else
+        {
+            EXPECT(assembler.size == 6 + 128 + 5);
+            EXPECT(assembler.code[0] == 0x0F && assembler.code[1] == 0x85 && assembler.code[2] == 133);
+            EXPECT(assembler.code[134] == 0xE9 && assembler.code[135] == 256 - 133);
+        }
+        assembler_free(&assembler);
+    }
+}
+
+typedef struct
+{
+    SymbolTable *symbol_table;
+    JitProgram *program;
+    JitStatus status;
+} Run;
+
+static Run run_source(const char *source)
+{
+    Run run = {symbol_table_create(), NULL, JIT_OK};
+    Lexer *lexer = lexer_create((char *)source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = parser_parse_program(parser);
+
+    CodeGenOptions options = {
+        .assembler = ASM_NASM, .optimize_registers = 1, .generate_comments = 0, .simplify_cfg = 1, .peephole = 1};
+    run.program = jit_compile(ast, run.symbol_table, options);
+    if (run.program)
+        run.status = jit_execute(run.program);
+
+    ast_destroy_node(ast);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    return run;
+}
+
+static long long run_value(Run *run, const char *name)
+{
+    long long value = -12345;
+    EXPECT(jit_variable(run->program, name, &value));
+    return value;
+}
+
+static void run_free(Run *run)
+{
+    jit_destroy(run->program);
+    symbol_table_destroy(run->symbol_table);
+}
+
+// Appends a balanced tree of `depth` levels over a = 3 and b = 5 to `text`
+// and returns its value. Each level holds one more value than the one below,
+// so deep trees outgrow the scratch registers.
+static unsigned long long append_tree(char *text, int depth, int *leaf)
+{
+    if (depth == 0)
+    {
+        int kind = (*leaf)++ % 3;
+        strcat(text, kind == 0 ? "(a - b)" : kind == 1 ? "(b * a)" : "(7 - a)");
+        return kind == 0 ? (unsigned long long)-2 : kind == 1 ? 15 : 4;
+    }
+
+    const char *operator= depth % 3 == 0 ? " * " : depth % 3 == 1 ? " - " : " + ";
+    strcat(text, "(");
+    unsigned long long left = append_tree(text, depth - 1, leaf);
+    strcat(text, operator);
+    unsigned long long right = append_tree(text, depth - 1, leaf);
+    strcat(text, ")");
+    return depth % 3 == 0 ? left * right : depth % 3 == 1 ? left - right : left + right;
+}
+
+static void test_programs(void)
+{
+    Run run = run_source("i = 0; s = 0; while (10 > i) { s = s + i * i; i = i + 1; }"
+                         "big = 9223372036854775807; big = big + 1; q = s / 7; r = 0 - s; r = r / 4;"
+                         "c = 0; if (s != 285) { c = 1; } else { c = 2; } shifted = 3 << 62;");
+    EXPECT(run.program && run.status == JIT_OK);
+    if (run.program)
+    {
+        EXPECT(run_value(&run, "s") == 285);
+        EXPECT(run_value(&run, "i") == 10);
+        EXPECT(run_value(&run, "big") == (long long)(1ULL << 63));
+        EXPECT(run_value(&run, "q") == 40);
+        EXPECT(run_value(&run, "r") == -71);
+        EXPECT(run_value(&run, "c") == 2);
+        EXPECT(run_value(&run, "shifted") == (long long)(3ULL << 62));
+
+        // Running again starts from zeroed variables.
+        EXPECT(jit_execute(run.program) == JIT_OK);
+        EXPECT(run_value(&run, "s") == 285);
+    }
+    run_free(&run);
+
+    static char deep[16384] = "a = 3; b = 5; x = ";
+    int leaf = 0;
+    unsigned long long expected = append_tree(deep, 9, &leaf);
+    strcat(deep, "; if (x < ");
+    unsigned long long bound = append_tree(deep, 8, &leaf);
+    strcat(deep, ") { y = 1; } else { y = 2; }");
+    run = run_source(deep);
+    EXPECT(run.program && run.status == JIT_OK);
+    if (run.program)
+    {
+        EXPECT(run_value(&run, "x") == (long long)expected);
+        EXPECT(run_value(&run, "y") == ((long long)expected < (long long)bound ? 1 : 2));
+    }
+    run_free(&run);
+
+    run = run_source("x = 0; y = 5 / x;");
+    EXPECT(run.program && run.status == JIT_DIVISION_FAULT);
+    run_free(&run);
+}
+
+// Writes what jit_run prints for `source` optimized at `level` into `text`.
+static void run_output(const char *source, int level, char *text, size_t size)
+{
+    SymbolTable *symbol_table = symbol_table_create();
+    Optimizer *optimizer = optimizer_create(symbol_table);
+    pass_manager_set_level(optimizer->pass_manager, level);
+    Lexer *lexer = lexer_create((char *)source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *ast = optimizer_optimize(optimizer, parser_parse_program(parser));
+
+    CodeGenOptions options = {.assembler = ASM_NASM,
+                              .optimize_registers = level > 0,
+                              .generate_comments = 0,
+                              .simplify_cfg = level > 0,
+                              .peephole = level > 0};
+    JitProgram *program = jit_compile(ast, symbol_table, options);
+    text[0] = '\0';
+    EXPECT(program);
+    if (program)
+    {
+        FILE *output = tmpfile();
+        EXPECT(jit_run(program, output) == 0);
+        rewind(output);
+        size_t length = fread(text, 1, size - 1, output);
+        text[length] = '\0';
+        fclose(output);
+    }
+
+    jit_destroy(program);
+    ast_destroy_node(ast);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    optimizer_destroy(optimizer);
+    symbol_table_destroy(symbol_table);
+}
+
+// A variable assigned only in a loop the optimizer deletes still prints.
+static void test_removed_variables(void)
+{
+    const char *source = "x = 5; while (x < 3) { y = 1; x = x + 1; } z = x * 2;";
+    fprintf(stderr, "(four JIT timing lines expected)\n");
+    for (int level = 0; level <= 3; level++)
+    {
+        char text[256];
+        run_output(source, level, text, sizeof(text));
+        EXPECT(strcmp(text, "x = 5\ny = 0\nz = 10\n") == 0);
+    }
+}
+
+int main(void)
+{
+    test_encodings();
+    test_programs();
+    test_removed_variables();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d JIT checks failed\n", failures);
+        return 1;
+    }
+    printf("Assembler encodings and JIT-compiled programs behave as expected\n");
+    return 0;
+}
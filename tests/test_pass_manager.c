@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include "pass_manager.h"
+
+// Checks the -O presets, pipeline parsing, and the order and number of times
+// repeated and run-once passes execute, using two counting passes.
+
+static int failures = 0;
+
+#define EXPECT(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+static int pending_rewrites = 0;
+static char trace[64];
+static size_t trace_length = 0;
+
+// Reports a rewrite while any are pending.
+static ASTNode *rewriting_pass(Optimizer *optimizer, ASTNode *node)
+{
+    trace[trace_length++] = 'r';
+    if (pending_rewrites > 0)
+    {
+        pending_rewrites--;
+        optimizer->changes_made++;
+    }
+    return node;
+}
+
+// Queues two rewrites for the repeated pass to report.
+static ASTNode *once_pass(Optimizer *optimizer, ASTNode *node)
+{
+    trace[trace_length++] = 'o';
+    pending_rewrites = 2;
+    optimizer->changes_made++;
+    return node;
+}
+
+static int pipeline_contains(PassManager *manager, const char *name)
+{
+    for (size_t i = 0; i < manager->pipeline_count; i++)
+    {
+        if (strcmp(manager->pipeline[i].pass.name, name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void test_levels(PassManager *manager)
+{
+    pass_manager_set_level(manager, 0);
+    EXPECT(manager->pipeline_count == 0);
+
+    size_t previous = 0;
+    for (int level = 1; level <= OPTIMIZER_MAX_LEVEL; level++)
+    {
+        pass_manager_set_level(manager, level);
+        EXPECT(manager->pipeline_count >= previous);
+        EXPECT(pipeline_contains(manager, "constant-folding"));
+        previous = manager->pipeline_count;
+    }
+
+    pass_manager_set_level(manager, 1);
+    EXPECT(!pipeline_contains(manager, "loop-unrolling"));
+    pass_manager_set_level(manager, OPTIMIZER_DEFAULT_LEVEL);
+    EXPECT(pipeline_contains(manager, "loop-unrolling"));
+}
+
+static void test_parsing(PassManager *manager)
+{
+    EXPECT(pass_manager_set_pipeline(manager, "dead-code-elimination,constant-folding"));
+    EXPECT(manager->pipeline_count == 2);
+    EXPECT(strcmp(manager->pipeline[0].pass.name, "dead-code-elimination") == 0);
+
+    EXPECT(pass_manager_set_pipeline(manager, ""));
+    EXPECT(manager->pipeline_count == 0);
+
+    fprintf(stderr, "(two unknown-pass messages expected)\n");
+    EXPECT(!pass_manager_set_pipeline(manager, "constant-folding,no-such-pass"));
+    EXPECT(!pass_manager_set_pipeline(manager, "constant-folding,,dead-code-elimination"));
+
+    EXPECT(pass_manager_register(manager, "test-rewrite", rewriting_pass, PASS_REPEATED, 9));
+    EXPECT(!pass_manager_register(manager, "test-rewrite", rewriting_pass, PASS_REPEATED, 9));
+    EXPECT(pass_manager_register(manager, "test-once", once_pass, PASS_ONCE, 9));
+}
+
+static void test_scheduling(PassManager *manager)
+{
+    SymbolTable *symbol_table = symbol_table_create();
+    Optimizer *optimizer = optimizer_create(symbol_table);
+    ASTNode *program = ast_create_block();
+    program->type = NODE_PROGRAM;
+
+    // The repeated pass settles (one quiet round), the once pass runs and
+    // queues two rewrites, and the repeated pass settles again: two rounds
+    // that rewrite and a quiet one.
+    EXPECT(pass_manager_set_pipeline(manager, "test-rewrite,test-once"));
+    manager->collect_stats = 1;
+    program = pass_manager_run(manager, optimizer, program);
+    trace[trace_length] = '\0';
+    EXPECT(strcmp(trace, "rorrr") == 0);
+    EXPECT(manager->pipeline[0].runs == 4);
+    EXPECT(manager->pipeline[0].rewrites == 2);
+    EXPECT(manager->pipeline[1].runs == 1);
+    EXPECT(manager->pipeline[1].rewrites == 1);
+
+    ast_destroy_node(program);
+    optimizer_destroy(optimizer);
+    symbol_table_destroy(symbol_table);
+}
+
+int main(void)
+{
+    PassManager *manager = pass_manager_create();
+    test_levels(manager);
+    test_parsing(manager);
+    test_scheduling(manager);
+    pass_manager_destroy(manager);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d pass manager checks failed\n", failures);
+        return 1;
+    }
+    printf("Pass manager presets, parsing and scheduling behave as expected\n");
+    return 0;
+}
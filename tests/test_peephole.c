@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include "peephole.h"
+#include "instruction.h"
+
+// Runs the peephole pass over hand-written blocks and checks what is left
+// of them and which rules fired.
+
+static int failures = 0;
+
+#define EXPECT(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+// Optimizes one block holding `instructions`, NULL-terminated, and compares
+// the result with `expected`.
+static PeepholeStats check_block(const char **instructions, const char **expected)
+{
+    ControlFlowGraph *cfg = cfg_create();
+    BasicBlock *block = cfg_new_block(0);
+    cfg_place(cfg, block);
+    for (size_t i = 0; instructions[i]; i++)
+    {
+        cfg_append(block, "%s", instructions[i]);
+    }
+
+    PeepholeStats stats = peephole_optimize(cfg);
+    size_t count = 0;
+    while (expected[count])
+        count++;
+    EXPECT(block->instruction_count == count);
+    for (size_t i = 0; i < block->instruction_count && i < count; i++)
+    {
+        char text[64];
+        instruction_format(&block->instructions[i], text, sizeof(text));
+        if (strcmp(text, expected[i]) != 0)
+        {
+            fprintf(stderr, "instruction %zu: got \"%s\", expected \"%s\"\n", i, text, expected[i]);
+            failures++;
+        }
+    }
+    cfg_destroy(cfg);
+    return stats;
+}
+
+static void test_rules(void)
+{
+    // The reload becomes the stored register, which then moves onto itself.
+    const char *forward[] = {"mov [rbp-8], rax", "mov rax, [rbp-8]", "add rax, QWORD [rbp-16]",
+                             "mov [rbp-16], rax", "imul rcx, QWORD [rbp-16]", NULL};
+    const char *forwarded[] = {"mov [rbp-8], rax", "add rax, QWORD [rbp-16]", "mov [rbp-16], rax", "imul rcx, rax",
+                               NULL};
+    PeepholeStats stats = check_block(forward, forwarded);
+    EXPECT(stats.hits[PEEPHOLE_STORE_FORWARDING] == 2);
+    EXPECT(stats.hits[PEEPHOLE_REDUNDANT_MOVE] == 1);
+
+    // A narrow reload still clears the upper half unless the last write did.
+    const char *narrow[] = {"mov rax, [rbp-24]", "mov [rbp-8], eax", "mov eax, [rbp-8]",
+                            "add eax, 1",        "mov [rbp-4], eax", "mov eax, [rbp-4]", NULL};
+    const char *narrowed[] = {"mov rax, [rbp-24]", "mov [rbp-8], eax", "mov eax, eax", "add eax, 1", "mov [rbp-4], eax",
+                              NULL};
+    stats = check_block(narrow, narrowed);
+    EXPECT(stats.hits[PEEPHOLE_STORE_FORWARDING] == 2);
+    EXPECT(stats.hits[PEEPHOLE_REDUNDANT_MOVE] == 1);
+
+    // A move straight back is dropped, as is one overwritten before use.
+    const char *moves[] = {"mov rbx, rax", "mov rax, rbx", "mov rcx, rax", "mov rcx, 5", "mov eax, ebx", "mov ebx, eax",
+                           NULL};
+    const char *moved[] = {"mov rbx, rax", "mov rcx, 5", "mov eax, ebx", "mov ebx, eax", NULL};
+    stats = check_block(moves, moved);
+    EXPECT(stats.hits[PEEPHOLE_REDUNDANT_MOVE] == 2);
+
+    // A write is dead if the register is overwritten later in the block with
+    // nothing reading it in between, cqo's implicit read of rax included.
+    const char *dead[] = {"xor eax, eax", "mov ebx, eax", "mov eax, 20", "mov ebx, eax",
+                          "mov ecx, ebx", "mov rax, rcx", "cqo",         "mov eax, 7",   NULL};
+    const char *live[] = {"mov eax, 20", "mov ebx, eax", "mov ecx, ebx", "mov rax, rcx", "cqo", "mov eax, 7", NULL};
+    stats = check_block(dead, live);
+    EXPECT(stats.hits[PEEPHOLE_REDUNDANT_MOVE] == 2);
+
+    // Zeroing may not clobber the flags a setcc is about to read.
+    const char *zeros[] = {"mov rcx, 0", "cmp rsi, 0", "mov eax, 0", "setl al", "mov r12, 0", NULL};
+    const char *zeroed[] = {"xor ecx, ecx", "test rsi, rsi", "mov eax, 0", "setl al", "xor r12d, r12d", NULL};
+    stats = check_block(zeros, zeroed);
+    EXPECT(stats.hits[PEEPHOLE_ZERO_IDIOM] == 2);
+    EXPECT(stats.hits[PEEPHOLE_TEST_ZERO] == 1);
+}
+
+static void test_closing_compare(void)
+{
+    ControlFlowGraph *cfg = cfg_create();
+    BasicBlock *blocks[3];
+    for (int i = 0; i < 3; i++)
+    {
+        blocks[i] = cfg_new_block(i);
+        cfg_place(cfg, blocks[i]);
+    }
+    cfg_branch(blocks[0], NULL, 0, blocks[1], blocks[2]);
+    cfg_branch(blocks[1], NULL, 0, blocks[2], blocks[0]);
+    cfg_compare(blocks[1], TOKEN_LESS, "eax, 0");
+
+    PeepholeStats stats = peephole_optimize(cfg);
+    EXPECT(stats.hits[PEEPHOLE_TEST_ZERO] == 2);
+    char text[64];
+    EXPECT(instruction_format(&blocks[0]->compare, text, sizeof(text)) && strcmp(text, "test rax, rax") == 0);
+    EXPECT(instruction_format(&blocks[1]->compare, text, sizeof(text)) && strcmp(text, "test eax, eax") == 0);
+
+    Assembler assembler;
+    assembler_init(&assembler);
+    EXPECT(cfg_assemble(cfg, &assembler) && assembler_resolve(&assembler));
+    assembler_free(&assembler);
+    cfg_destroy(cfg);
+}
+
+static void test_instructions(void)
+{
+    const char *texts[] = {"imul r12d, DWORD [rbp-8], 1000", "mov [rsp+16], rax", "movzx eax, al", "cqo"};
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+    {
+        MachineInstruction instruction;
+        char text[64];
+        EXPECT(instruction_parse(texts[i], &instruction));
+        EXPECT(instruction_format(&instruction, text, sizeof(text)) && strcmp(text, texts[i]) == 0);
+    }
+
+    MachineInstruction instruction;
+    EXPECT(!instruction_parse("mov rax, [xyz-8]", &instruction));
+    EXPECT(!instruction_parse("add rax, 1, 2, 3", &instruction));
+}
+
+int main(void)
+{
+    test_rules();
+    test_closing_compare();
+    test_instructions();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d peephole checks failed\n", failures);
+        return 1;
+    }
+    printf("Peephole rules rewrite instruction windows as expected\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include "lexer.h"
+#include "parser.h"
+#include "jit.h"
+
+// Lowers small programs with register allocation, checks which variables
+// end up in registers, and runs them in-process with and without it.
+
+static int failures = 0;
+
+#define EXPECT(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+typedef struct
+{
+    SymbolTable *symbol_table;
+    ASTNode *ast;
+    CodeGenerator *generator;
+} Lowered;
+
+static Lowered lower(const char *source)
+{
+    Lowered lowered = {symbol_table_create(), NULL, NULL};
+    Lexer *lexer = lexer_create((char *)source);
+    Parser *parser = parser_create(lexer);
+    lowered.ast = parser_parse_program(parser);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+
+    CodeGenOptions options = {
+        .assembler = ASM_NASM, .optimize_registers = 1, .generate_comments = 0, .simplify_cfg = 1, .peephole = 1};
+    lowered.generator = codegen_create(NULL, lowered.symbol_table);
+    codegen_set_options(lowered.generator, options);
+    codegen_lower(lowered.generator, lowered.ast);
+    return lowered;
+}
+
+static void lowered_free(Lowered *lowered)
+{
+    cfg_destroy(lowered->generator->cfg);
+    codegen_destroy(lowered->generator);
+    ast_destroy_node(lowered->ast);
+    symbol_table_destroy(lowered->symbol_table);
+}
+
+static int in_register(Lowered *lowered, const char *name)
+{
+    return symbol_table_lookup(lowered->symbol_table, name)->register_index >= 0;
+}
+
+// Whether any instruction still reads or writes the variable's slot, outside
+// the loads and stores around the whole program.
+static int touches_slot(Lowered *lowered, const char *name)
+{
+    char operand[32];
+    snprintf(operand, sizeof(operand), "[rbp-%d]", symbol_table_lookup(lowered->symbol_table, name)->stack_offset);
+    ControlFlowGraph *cfg = lowered->generator->cfg;
+    for (size_t i = 1; i + 1 < cfg->block_count; i++)
+    {
+        for (size_t j = 0; j < cfg->blocks[i]->instruction_count; j++)
+        {
+            char text[64];
+            instruction_format(&cfg->blocks[i]->instructions[j], text, sizeof(text));
+            if (strstr(text, operand))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static const char *programs[] = {
+    "i = 0; s = 0; while (i < 100) { s = s + i; i = i + 1; }",
+    "n = 6000; i = 0; while (i < n) { i = i + 1; }",
+    "y = 1; a = 1; b = 2; c = 3; d = 4; e = 5; i = 0;"
+    "while (i < 10) { a = a + i; b = b + a; c = c + b; d = d + c; e = e + d; i = i + 1; } y = y + e;",
+    "x = 0; if (x == 0) { r = q + 1; } else { r = 2; } q = 7;",
+    "k = 7; s = 0; i = 0; while (i < 10) { s = s + i * k; i = i + 1; }",
+};
+
+static int has_instruction(Lowered *lowered, const char *text)
+{
+    ControlFlowGraph *cfg = lowered->generator->cfg;
+    for (size_t i = 0; i < cfg->block_count; i++)
+    {
+        for (size_t j = 0; j < cfg->blocks[i]->instruction_count; j++)
+        {
+            char formatted[64];
+            instruction_format(&cfg->blocks[i]->instructions[j], formatted, sizeof(formatted));
+            if (strcmp(formatted, text) == 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static void test_assignment(void)
+{
+    Lowered lowered = lower(programs[0]);
+    EXPECT(lowered.generator->allocation.allocated == 2);
+    EXPECT(in_register(&lowered, "i") && in_register(&lowered, "s"));
+    EXPECT(!touches_slot(&lowered, "i") && !touches_slot(&lowered, "s"));
+    lowered_free(&lowered);
+
+    // n only ever holds 6000, so its loads become that constant.
+    lowered = lower(programs[1]);
+    EXPECT(lowered.generator->allocation.rematerialized == 1);
+    EXPECT(!in_register(&lowered, "n") && !touches_slot(&lowered, "n"));
+    lowered_free(&lowered);
+
+    // Seven variables are live across the loop; y, referenced least and
+    // never inside it, is one of the two left in memory.
+    lowered = lower(programs[2]);
+    EXPECT(lowered.generator->allocation.allocated == 5);
+    EXPECT(lowered.generator->allocation.spilled == 2);
+    EXPECT(!in_register(&lowered, "y"));
+    EXPECT(in_register(&lowered, "i") && in_register(&lowered, "a"));
+    lowered_free(&lowered);
+
+    // k is a memory operand of imul, which becomes the immediate form.
+    lowered = lower(programs[4]);
+    EXPECT(lowered.generator->allocation.rematerialized == 1);
+    EXPECT(has_instruction(&lowered, "imul rax, rax, 7"));
+    lowered_free(&lowered);
+}
+
+// Runs `source` with allocation on and off; every variable must agree.
+static void test_execution(const char *source)
+{
+    JitProgram *programs_run[2];
+    SymbolTable *symbol_tables[2];
+    ASTNode *asts[2];
+    for (int allocate = 0; allocate < 2; allocate++)
+    {
+        symbol_tables[allocate] = symbol_table_create();
+        Lexer *lexer = lexer_create((char *)source);
+        Parser *parser = parser_create(lexer);
+        asts[allocate] = parser_parse_program(parser);
+        parser_destroy(parser);
+        lexer_destroy(lexer);
+
+        CodeGenOptions options = {
+            .assembler = ASM_NASM, .optimize_registers = allocate, .generate_comments = 0, .simplify_cfg = 1, .peephole = 1};
+        programs_run[allocate] = jit_compile(asts[allocate], symbol_tables[allocate], options);
+        EXPECT(programs_run[allocate] && jit_execute(programs_run[allocate]) == JIT_OK);
+    }
+
+    for (Symbol *symbol = symbol_tables[0]->head; symbol; symbol = symbol->next)
+    {
+        long long expected = 0, actual = 1;
+        EXPECT(jit_variable(programs_run[0], symbol->name, &expected));
+        EXPECT(jit_variable(programs_run[1], symbol->name, &actual));
+        if (expected != actual)
+            fprintf(stderr, "%s: %lld with registers, %lld without\n", symbol->name, actual, expected);
+        EXPECT(expected == actual);
+    }
+
+    for (int allocate = 0; allocate < 2; allocate++)
+    {
+        jit_destroy(programs_run[allocate]);
+        ast_destroy_node(asts[allocate]);
+        symbol_table_destroy(symbol_tables[allocate]);
+    }
+}
+
+int main(void)
+{
+    test_assignment();
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++)
+    {
+        test_execution(programs[i]);
+    }
+
+    if (failures)
+    {
+        fprintf(stderr, "%d register allocation checks failed\n", failures);
+        return 1;
+    }
+    printf("Register allocation keeps programs' results and loops' variables in registers\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <limits.h>
+#include "simplifier.h"
+
+// Checks every rule in the simplifier's table: an instance of its pattern
+// over variables x and y must be rewritten, and the rewrite must give the
+// same 64-bit result (or the same fault) for every pair of sample values.
+
+static const long long samples[] = {
+    0, 1, -1, 2, -2, 3, 63, 64, 1000003, -987654321,
+    LLONG_MAX, LLONG_MIN, LLONG_MAX - 1, LLONG_MIN + 1, 0x5555555555555555LL,
+};
+
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+typedef struct
+{
+    long long x;
+    long long y;
+    int trapped;
+} Environment;
+
+static long long evaluate(ASTNode *node, Environment *env)
+{
+    switch (node->type)
+    {
+    case NODE_INTEGER:
+        return node->data.integer.value;
+    case NODE_IDENTIFIER:
+        return node->data.identifier.name[0] == 'x' ? env->x : env->y;
+    case NODE_BINARY_OP:
+    {
+        long long left = evaluate(node->data.binary_op.left, env);
+        long long right = evaluate(node->data.binary_op.right, env);
+        if (node->data.binary_op.operator== TOKEN_DIVIDE && optimizer_division_traps(left, right))
+        {
+            env->trapped = 1;
+            return 0;
+        }
+
+        // Reuse the folder's wrapping semantics on the evaluated operands.
+        ASTNode *folded = ast_create_binary_op(node->data.binary_op.operator,
+                                               ast_create_integer(left), ast_create_integer(right));
+        long long value = optimizer_evaluate_constant_expression(folded);
+        ast_destroy_node(folded);
+        return value;
+    }
+    default:
+        return 0;
+    }
+}
+
+static ASTNode *instantiate(OperandPattern pattern, ASTNode *left, const char *variable)
+{
+    switch (pattern)
+    {
+    case OPERAND_ZERO:
+        return ast_create_integer(0);
+    case OPERAND_ONE:
+        return ast_create_integer(1);
+    case OPERAND_SAME:
+        return ast_clone(left);
+    case OPERAND_NEGATION:
+        return ast_create_binary_op(TOKEN_MINUS, ast_create_integer(0), ast_create_identifier("y"));
+    default:
+        // A compound operand, so rules are not only tried on leaves.
+        return ast_create_binary_op(TOKEN_PLUS, ast_create_identifier(variable), ast_create_integer(7));
+    }
+}
+
+static int check_rule(const SimplifyRule *rule)
+{
+    ASTNode *left = instantiate(rule->left, NULL, "x");
+    ASTNode *right = instantiate(rule->right, left, "y");
+    ASTNode *original = ast_create_binary_op(rule->operator, left, right);
+    ASTNode *simplified = optimizer_simplify_expression(ast_clone(original));
+    int failures = 0;
+
+    if (ast_size(simplified) >= ast_size(original))
+    {
+        printf("FAIL %s: not rewritten\n", rule->name);
+        failures++;
+    }
+
+    for (size_t i = 0; i < SAMPLE_COUNT && !failures; i++)
+    {
+        for (size_t j = 0; j < SAMPLE_COUNT && !failures; j++)
+        {
+            Environment before = {samples[i], samples[j], 0};
+            Environment after = before;
+            long long expected = evaluate(original, &before);
+            long long actual = evaluate(simplified, &after);
+            if (before.trapped != after.trapped || (!before.trapped && expected != actual))
+            {
+                printf("FAIL %s: x = %lld, y = %lld gives %lld, expected %lld\n",
+                       rule->name, samples[i], samples[j], actual, expected);
+                failures++;
+            }
+        }
+    }
+
+    ast_destroy_node(original);
+    ast_destroy_node(simplified);
+    return failures;
+}
+
+// Dropping an operand that may fault would remove the fault.
+static int check_trapping_operand_kept(void)
+{
+    ASTNode *quotient = ast_create_binary_op(TOKEN_DIVIDE, ast_create_identifier("x"), ast_create_identifier("y"));
+    ASTNode *original = ast_create_binary_op(TOKEN_MULTIPLY, quotient, ast_create_integer(0));
+    ASTNode *simplified = optimizer_simplify_expression(ast_clone(original));
+    int failures = 0;
+
+    if (!ast_equal(original, simplified))
+    {
+        printf("FAIL (x / y) * 0: trapping operand dropped\n");
+        failures++;
+    }
+
+    ast_destroy_node(original);
+    ast_destroy_node(simplified);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < simplify_rule_count; i++)
+    {
+        failures += check_rule(&simplify_rules[i]);
+    }
+    failures += check_trapping_operand_kept();
+
+    if (failures)
+    {
+        printf("%d simplifier check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("All %zu simplifier rules preserve 64-bit semantics\n", simplify_rule_count);
+    return 0;
+}
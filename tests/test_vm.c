@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include "lexer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "pass_manager.h"
+#include "vm.h"
+
+// Runs small programs unoptimized through the bytecode VM: arithmetic that
+// wraps like the machine, shifts, faults, every branch form, and the shape
+// of a counted loop. Then checks vm_run prints the same variables at every
+// optimization level.
+
+static int failures = 0;
+
+#define EXPECT(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+typedef struct
+{
+    SymbolTable *symbol_table;
+    Bytecode *bytecode;
+    long long *registers;
+    VMStatus status;
+} Run;
+
+static Run run_source(const char *source)
+{
+    Run run = {symbol_table_create(), NULL, NULL, VM_OK};
+    Lexer *lexer = lexer_create((char *)source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *program = parser_parse_program(parser);
+
+    run.bytecode = bytecode_compile(program, run.symbol_table);
+    run.registers = (long long *)calloc(run.bytecode->register_count + 1, sizeof(long long));
+    run.status = vm_execute(run.bytecode, run.registers);
+
+    ast_destroy_node(program);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    return run;
+}
+
+static long long run_value(Run *run, const char *name)
+{
+    return run->registers[symbol_table_get_id(run->symbol_table, name)];
+}
+
+static void run_free(Run *run)
+{
+    bytecode_destroy(run->bytecode);
+    free(run->registers);
+    symbol_table_destroy(run->symbol_table);
+}
+
+static void test_arithmetic(void)
+{
+    Run run = run_source("x = 7; y = x * 3 - x / 2 + (1 << 4); z = 10 - x; w = 2 + x;"
+                         "big = 9223372036854775807; big = big + 1;"
+                         "shifted = 1 << 65; quotient = 0 - 7; quotient = quotient / 2;");
+    EXPECT(run.status == VM_OK);
+    EXPECT(run_value(&run, "y") == 34);
+    EXPECT(run_value(&run, "z") == 3);
+    EXPECT(run_value(&run, "w") == 9);
+    EXPECT(run_value(&run, "big") == LLONG_MIN);
+    EXPECT(run_value(&run, "shifted") == 2);
+    EXPECT(run_value(&run, "quotient") == -3);
+    run_free(&run);
+}
+
+static void test_faults(void)
+{
+    Run run = run_source("x = 0; y = 5 / x; z = 1;");
+    EXPECT(run.status == VM_DIVISION_FAULT);
+    EXPECT(run_value(&run, "z") == 0);
+    run_free(&run);
+
+    run = run_source("m = 9223372036854775807; m = m + 1; d = 0 - 1; q = m / d;");
+    EXPECT(run.status == VM_DIVISION_FAULT);
+    run_free(&run);
+}
+
+static void test_branches(void)
+{
+    Run run = run_source("i = 0; s = 0; while (10 > i) { s = s + i; i = i + 1; }"
+                         "n = 5; k = 0; while (k != n) { k = k + 1; }"
+                         "a = 0; if (3 == k) { a = 1; } else { a = 2; }"
+                         "b = 0; if (k == n) { b = 1; }"
+                         "c = 0; if (k - 5) { c = 1; } else { c = 2; }"
+                         "e = 0; if (k < 5) { e = 1; }"
+                         "f = 0; if (n > k - 1) { f = 1; }");
+    EXPECT(run.status == VM_OK);
+    EXPECT(run_value(&run, "s") == 45);
+    EXPECT(run_value(&run, "k") == 5);
+    EXPECT(run_value(&run, "a") == 2);
+    EXPECT(run_value(&run, "b") == 1);
+    EXPECT(run_value(&run, "c") == 2);
+    EXPECT(run_value(&run, "e") == 0);
+    EXPECT(run_value(&run, "f") == 1);
+    run_free(&run);
+}
+
+// A counted loop is an increment and one compare-and-branch per iteration.
+static void test_loop_shape(void)
+{
+    Run run = run_source("i = 0; while (i < 100) { i = i + 1; }");
+    EXPECT(run_value(&run, "i") == 100);
+    EXPECT(run.bytecode->code_count == 5);
+    EXPECT(run.bytecode->code[2].opcode == OP_ADD_IMMEDIATE);
+    EXPECT(run.bytecode->code[3].opcode == OP_BRANCH_IMMEDIATE + RELATION_LESS);
+    EXPECT(run.bytecode->code[3].a == 2);
+    run_free(&run);
+}
+
+// Writes what vm_run prints for `source` optimized at `level` into `text`.
+static void run_output(const char *source, int level, char *text, size_t size)
+{
+    SymbolTable *symbol_table = symbol_table_create();
+    Optimizer *optimizer = optimizer_create(symbol_table);
+    pass_manager_set_level(optimizer->pass_manager, level);
+    Lexer *lexer = lexer_create((char *)source);
+    Parser *parser = parser_create(lexer);
+    ASTNode *program = optimizer_optimize(optimizer, parser_parse_program(parser));
+
+    Bytecode *bytecode = bytecode_compile(program, symbol_table);
+    FILE *output = tmpfile();
+    EXPECT(vm_run(bytecode, symbol_table, output) == 0);
+    rewind(output);
+    size_t length = fread(text, 1, size - 1, output);
+    text[length] = '\0';
+    fclose(output);
+
+    bytecode_destroy(bytecode);
+    ast_destroy_node(program);
+    parser_destroy(parser);
+    lexer_destroy(lexer);
+    optimizer_destroy(optimizer);
+    symbol_table_destroy(symbol_table);
+}
+
+// A variable assigned only in a loop the optimizer deletes still prints.
+static void test_removed_variables(void)
+{
+    const char *source = "x = 5; while (x < 3) { y = 1; x = x + 1; } z = x * 2;";
+    for (int level = 0; level <= 3; level++)
+    {
+        char text[256];
+        run_output(source, level, text, sizeof(text));
+        EXPECT(strcmp(text, "x = 5\ny = 0\nz = 10\n") == 0);
+    }
+}
+
+int main(void)
+{
+    test_arithmetic();
+    test_faults();
+    test_branches();
+    test_loop_shape();
+    test_removed_variables();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d VM checks failed\n", failures);
+        return 1;
+    }
+    printf("Bytecode VM arithmetic, faults and branches behave as expected\n");
+    return 0;
+}